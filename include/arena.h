@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Size of the blocks an arena carves its allocations out of, unless asked otherwise
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+typedef struct arena_chunk ArenaChunk;
+
+// Bump-pointer allocator
+// Allocations cannot be freed one by one, arena_free releases all of them at once
+typedef struct {
+    ArenaChunk *chunks; // every chunk, newest first
+    char *cur;          // next free byte of the chunk being filled
+    char *end;          // end of the chunk being filled
+    size_t chunk_size;
+    size_t used;        // bytes handed out so far
+} Arena;
+
+void arena_init(Arena *arena, size_t chunk_size);
+
+void *arena_alloc(Arena *arena, size_t size);
+
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+void arena_merge(Arena *into, Arena *from);
+
+void arena_free(Arena *arena);
+
+#endif
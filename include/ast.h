@@ -1,7 +1,9 @@
 #ifndef AST_H
 #define AST_H
 
+#include "arena.h"
 #include "lexer.h"
+#include "writer.h"
 
 typedef struct expr Expr;
 typedef struct stmt Stmt;
@@ -46,13 +48,15 @@ typedef struct {
 } IdentifierExpr;
 
 // Integer literal expression e.g. 42
+// The decoded value is tok.int_val
 typedef struct {
-    char *value;
+    TokenData tok;
 } IntLiteral;
 
 // String literal expression e.g. "hello"
+// tok holds the raw text between the quotes, escapes are not resolved yet
 typedef struct {
-    char *value;
+    TokenData tok;
 } StringLiteral;
 
 // Boolean literal expression e.g. true or false
@@ -159,6 +163,9 @@ typedef struct {
     TokenData *parameter_names; 
     TokenData *parameter_types;
     int parameter_count;
+
+    // Set when the parser skipped the body, body stays NULL until parse_func_body fills it in
+    int body_start; // token index of the '{'
 } FuncDeclStmt;
 
 // If statement e.g. if (condition) { ... } else { ... }
@@ -202,33 +209,41 @@ typedef struct {
     Stmt **statements;
     int stmt_count;
     int capacity;
+    Arena arena; // owns every node and array in the program
+    // The token arrays skipped function bodies are parsed from later, NULL if every body was parsed
+    Lexer *lazy_lexer;
+    int lazy_ast_opt; // run the AST passes on each skipped body once it is parsed
 } Program;
 
 
 // Expressions
 
-Expr *binary_expr(Expr *left, TokenData op, Expr *right);
-Expr *unary_expr(TokenData op, Expr *right);
-Expr *increment_expr(TokenData op_token, TokenData identifier, int is_prefix);
-Expr *identifier_expr(TokenData identifier);
-Expr *int_literal(char *value);
-Expr *string_literal(char *value);
-Expr *bool_literal(int value);
-Expr *func_call(TokenData tok_function, Expr **args, int arg_count);
-
-Stmt *func_decl_stmt(TokenData identifier, Stmt *body, TokenData return_type, TokenData *parameter_names, TokenData *parameter_types, int parameter_count);
-Stmt *var_decl_stmt(TokenData type, TokenData identifier, Expr *value);
-Stmt *var_assign_stmt(TokenData identifier, TokenData modifying_tok, Expr *new_value);
-Stmt *global_var_decl_stmt(TokenData type, TokenData identifier, Expr *value);
-Stmt *return_stmt(Expr *value);
-Stmt *expression_stmt(Expr *expr);
-Stmt *block_stmt(Stmt **statements, int stmt_count);
-Stmt *if_stmt(Expr *condition, Stmt *then_branch, int else_if_count, Expr **else_if_conditions, Stmt **else_if_branches, Stmt *else_branch);
-Stmt *while_stmt(Expr *condition, Stmt *body);
+Expr *binary_expr(Arena *arena, Expr *left, TokenData op, Expr *right);
+Expr *unary_expr(Arena *arena, TokenData op, Expr *right);
+Expr *increment_expr(Arena *arena, TokenData op_token, TokenData identifier, int is_prefix);
+Expr *identifier_expr(Arena *arena, TokenData identifier);
+Expr *int_literal(Arena *arena, TokenData tok);
+Expr *string_literal(Arena *arena, TokenData tok);
+Expr *bool_literal(Arena *arena, int value);
+Expr *func_call(Arena *arena, TokenData tok_function, Expr **args, int arg_count);
+
+Stmt *func_decl_stmt(Arena *arena, TokenData identifier, Stmt *body, TokenData return_type, TokenData *parameter_names, TokenData *parameter_types, int parameter_count);
+Stmt *var_decl_stmt(Arena *arena, TokenData type, TokenData identifier, Expr *value);
+Stmt *var_assign_stmt(Arena *arena, TokenData identifier, TokenData modifying_tok, Expr *new_value);
+Stmt *global_var_decl_stmt(Arena *arena, TokenData type, TokenData identifier, Expr *value);
+Stmt *return_stmt(Arena *arena, Expr *value);
+Stmt *expression_stmt(Arena *arena, Expr *expr);
+Stmt *block_stmt(Arena *arena, Stmt **statements, int stmt_count);
+Stmt *if_stmt(Arena *arena, Expr *condition, Stmt *then_branch, int else_if_count, Expr **else_if_conditions, Stmt **else_if_branches, Stmt *else_branch);
+Stmt *while_stmt(Arena *arena, Expr *condition, Stmt *body);
 void free_program(Program *prog);
+size_t program_node_count(Program *prog);
 
+void write_expr(Writer *writer, Expr *expr);
+void write_stmt(Writer *writer, Stmt *stmt);
 char *expr_to_string(Expr *expr);
 char *stmt_to_string(Stmt *stmt);
+char *escape_c_string(const char *s);
 
 
 #endif
\ No newline at end of file
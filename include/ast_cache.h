@@ -0,0 +1,48 @@
+#ifndef AST_CACHE_H
+#define AST_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flat_ast.h"
+#include "source.h"
+
+// Part of every cache key together with the build ID, so entries written by any other build of the compiler (a
+// changed parser or FlatNode layout) are never used
+#define PHI_VERSION "0.1.0"
+
+// The Makefile passes a hash of the sources, a build without it only shares entries with builds from the same second
+#ifndef PHI_BUILD_ID
+#define PHI_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+// Bumped whenever the layout of a cache file or of the flat AST changes
+#define AST_CACHE_FORMAT 2
+
+// The cache directory is trimmed back under this many bytes after every write, unless asked otherwise
+#define AST_CACHE_DEFAULT_LIMIT (64 * 1024 * 1024)
+
+// The cache entry of one source file
+// Entries are flat ASTs stored as is, a hit maps the file and the FlatAst points straight into it
+typedef struct {
+    const char *dir;
+    size_t limit;    // most bytes the directory may hold
+    Source *source;
+    uint64_t key;    // hash of the compiler version, its build and the source bytes
+    char *path;      // <dir>/<key>.ast
+    uint64_t build;  // hash of the compiler's build ID and the flat AST layout
+
+    // the mapping of the entry after a hit
+    void *map;
+    size_t map_len;
+} AstCache;
+
+void ast_cache_init(AstCache *cache, const char *dir, size_t limit, Source *source);
+
+int ast_cache_load(AstCache *cache, FlatAst *ast);
+
+int ast_cache_store(AstCache *cache, FlatAst *ast);
+
+void ast_cache_free(AstCache *cache);
+
+#endif
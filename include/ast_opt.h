@@ -0,0 +1,27 @@
+#ifndef AST_OPT_H
+#define AST_OPT_H
+
+#include <stddef.h>
+
+#include "ast.h"
+
+// A rewrite of the program run between parse() and codegen_program
+// Passes change the tree in place and allocate whatever new nodes they need from the program's arena
+typedef struct {
+    const char *name;
+    void (*run)(Program *prog);
+} AstPass;
+
+// How a pass did on one program
+typedef struct {
+    const char *name;
+    size_t removed; // nodes in the tree before the pass minus nodes after it
+} AstPassResult;
+
+// The passes optimize_ast runs, in order
+extern const AstPass ast_passes[];
+extern const int ast_pass_count;
+
+size_t optimize_ast(Program *prog, AstPassResult *results);
+
+#endif
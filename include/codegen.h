@@ -4,33 +4,80 @@
 #include <llvm-c/Analysis.h>
 #include <llvm-c/BitWriter.h>
 #include <llvm-c/Core.h>
-#include <llvm-c/ExecutionEngine.h>
 #include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
 
 #include "ast.h"
+#include "ssa.h"
+#include "symbol_table.h"
+
+// A function of a program with skipped bodies and whether a call has reached it yet
+typedef struct {
+    LLVMValueRef value;
+    Stmt *decl;
+    int reached;
+} LazyFunction;
+
+// How optimize_module and the JIT treat the module, set from -O<level>, --passes and --verify-each
+typedef struct {
+    int level;          // 0 to 3, -Os and -Oz are 2
+    int size_level;     // 1 for -Os, 2 for -Oz
+    const char *passes; // a new pass manager pipeline that replaces the default<O..> one, NULL for the default
+    int verify_each;    // verify the module after every pass
+} OptOptions;
+
+// What --stream and the lazy JIT run on functions on their own, instead of the module-wide default<O..> pipeline
+// locals are SSA values already, there is nothing for mem2reg to promote
+#define FUNCTION_PIPELINE "function(instcombine,reassociate,gvn,simplifycfg)"
+
+// The machine code is generated for, set from --mcpu and --mattr
+typedef struct {
+    const char *cpu;      // NULL for the host's
+    const char *features; // like "+avx2,-avx512f", NULL for the host's if cpu is NULL too and none otherwise
+    int opt_level;        // how hard the backend works on the machine code, 0 to 3 like -O
+} TargetOptions;
 
 typedef struct {
     LLVMContextRef context;
     LLVMModuleRef module;
     LLVMBuilderRef builder;
-    LLVMExecutionEngineRef engine;
-    // Symbol Table
-    char **var_names;
-    LLVMValueRef *var_allocas;
-    int var_count;
-    int var_capacity;
+    // The module's triple and data layout come from it, and optimize_module's cost models ask it about the CPU
+    LLVMTargetMachineRef target_machine;
+    TargetOptions target; // what it was created from, the JIT creates one like it per compile thread
+    // target-cpu and target-features, every function gets them so it is compiled for the same CPU wherever it ends up
+    LLVMAttributeRef target_cpu;
+    LLVMAttributeRef target_features; // NULL if there are none
+    // Symbol Table, locals by scope plus every global, function and builtin resolved so far
+    SymbolTable symbols;
+    // Locals are SSA values, built block by block as the function is generated
+    SsaBuilder ssa;
+    int current_block; // the SsaBuilder block the builder is appending to
+    // Scratch space for handing token text to LLVM as a C string
+    char *name_buf;
+    size_t name_buf_capacity;
+    // Only set for programs with skipped bodies, where functions are emitted once a call reaches them
+    LazyFunction *lazy_funcs; // sorted by value
+    int lazy_func_count;
+    Stmt **pending; // reached but not emitted yet
+    int pending_count;
 } CodeGen;
 
-CodeGen *init_codegen(const char *module_name);
+CodeGen *init_codegen(const char *module_name, const TargetOptions *target);
+LLVMTargetMachineRef create_target_machine(const TargetOptions *target);
 void cleanup_codegen(CodeGen *this);
+LLVMValueRef codegen_declare(CodeGen *this, Stmt *stmt);
 LLVMValueRef codegen_program(CodeGen *this, Program *program);
 LLVMValueRef codegen_expr(CodeGen *this, Expr *expr);
 int codegen_stmt(CodeGen *this, Stmt *stmt);
+int optimize_module(CodeGen *this, const OptOptions *options);
+int run_function_passes(LLVMModuleRef module, LLVMTargetMachineRef target_machine);
 
 // Utility functions
 void dump_ir(CodeGen *this);
-void write_ir(CodeGen *this, const char *filename);
-int run_jit(CodeGen *this);
+int write_ir(CodeGen *this, const char *filename);
+int write_bitcode(CodeGen *this, const char *filename);
+int link_bitcode(CodeGen *this, const char *filename);
+int emit_file(CodeGen *this, const char *filename, LLVMCodeGenFileType type);
 void setup_stdlib(CodeGen *this);
 LLVMValueRef handle_stdlib_call(CodeGen *this, const char *func_name, Expr **args, int arg_count);
 LLVMTypeRef get_type(TokenData type, LLVMContextRef context);
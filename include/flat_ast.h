@@ -0,0 +1,99 @@
+#ifndef FLAT_AST_H
+#define FLAT_AST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+// A compact encoding of the AST
+// Every node is 16 bytes in one array and refers to other nodes by index
+// Token text is kept as (offset, length) spans into the source, and lists of children
+// (block statements, call arguments, parameters, else-ifs) live in a separate array of indices
+
+// Index of a node in FlatAst.nodes
+typedef uint32_t FlatRef;
+
+// Marks a missing child, e.g. a return without a value
+#define FLAT_NONE UINT32_MAX
+
+typedef enum {
+    FLAT_BINARY,          // a = left, b = right, c = operator span, op = operator
+    FLAT_UNARY,           // a = operand, c = operator span, op = operator
+    FLAT_INCREMENT,       // a = identifier span, b = operator span, op = operator, flags = FLAT_PREFIX
+    FLAT_IDENTIFIER,      // a = span
+    FLAT_INT,             // a = value, b = span
+    FLAT_STRING,          // a = span of the raw text between the quotes
+    FLAT_BOOL,            // a = value
+    FLAT_CALL,            // a = name span, b = extra: count, arguments...
+    FLAT_VAR_DECL,        // a = type span, b = name span, c = value
+    FLAT_GLOBAL_VAR_DECL, // a = type span, b = name span, c = value
+    FLAT_VAR_ASSIGN,      // a = name span, b = operator span, c = value, op = operator
+    FLAT_FUNC_DECL,       // a = name span, b = body, c = extra: return type span, count, (name span, type span)...
+    FLAT_RETURN,          // a = value or FLAT_NONE
+    FLAT_EXPR_STMT,       // a = expression
+    FLAT_BLOCK,           // a = extra: count, statements...
+    FLAT_IF,              // a = condition, b = then block, c = extra: count, (condition, block)..., else block or FLAT_NONE
+    FLAT_WHILE,           // a = condition, b = body
+} FlatKind;
+
+// FLAT_INCREMENT flag for ++x (as opposed to x++)
+#define FLAT_PREFIX 1
+
+typedef struct {
+    uint8_t kind;   // FlatKind
+    uint8_t op;     // Token of the operator, if the node has one
+    uint16_t flags;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} FlatNode;
+
+// A piece of the source text
+typedef struct {
+    uint32_t offset; // from FlatAst.source
+    uint32_t len;
+} FlatSpan;
+
+typedef struct {
+    const char *source;
+
+    FlatNode *nodes;
+    uint32_t node_count;
+    uint32_t node_capacity;
+
+    FlatSpan *spans;
+    uint32_t span_count;
+    uint32_t span_capacity;
+
+    uint32_t *extra;
+    uint32_t extra_count;
+    uint32_t extra_capacity;
+
+    FlatRef root; // FLAT_BLOCK of the top level statements
+} FlatAst;
+
+void flatten_program(Program *prog, const char *source, FlatAst *ast);
+
+// The pointer tree again, for codegen
+Program *unflatten_program(FlatAst *ast);
+
+// 1 if every index and span of an AST from outside is in bounds and its nodes form a tree, see unflatten_program
+int flat_ast_check(FlatAst *ast, size_t source_len);
+
+void free_flat_ast(FlatAst *ast);
+
+// Bytes the nodes, spans and child lists take up
+size_t flat_ast_bytes(FlatAst *ast);
+
+TokenData flat_span_token(FlatAst *ast, uint32_t span);
+
+// Number of statements in a FLAT_BLOCK and the i-th one
+uint32_t flat_block_count(FlatAst *ast, FlatRef block);
+FlatRef flat_block_child(FlatAst *ast, FlatRef block, uint32_t i);
+
+// Formats a statement exactly like write_stmt and stmt_to_string do
+void write_flat_stmt(Writer *writer, FlatAst *ast, FlatRef stmt);
+char *flat_stmt_to_string(FlatAst *ast, FlatRef stmt);
+
+#endif
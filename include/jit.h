@@ -0,0 +1,23 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "codegen.h"
+
+// Below this many instructions per thread the module is compiled on one thread, a share would not pay for its copy
+#define JIT_MIN_PARTITION_INSTRUCTIONS 2000
+
+// What a function's body is called behind its lazy stub, the stub keeps the function's own name
+#define JIT_LAZY_BODY_SUFFIX ".body"
+
+// How run_jit compiles the module, set from -j, --lazy-jit and -O
+typedef struct {
+    int compile_threads;    // threads compiling the whole module up front, unused when lazy
+    int lazy;               // compile each function on its first call instead
+    int optimize_functions; // run FUNCTION_PIPELINE on each lazily compiled function first
+} JitOptions;
+
+// Compiles the module, links it with ORC LLJIT and calls main
+// Returns main's return value, or -1 if the module could not be compiled or has no main
+int run_jit(CodeGen *codegen, const JitOptions *options);
+
+#endif
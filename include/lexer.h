@@ -2,6 +2,9 @@
 #define LEXER_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "scanner.h"
 
 typedef enum {
     tok_eof,
@@ -47,31 +50,65 @@ typedef enum {
     tok_while,
 } Token;
 
+// Computed on demand with token_location, tokens don't carry it
 typedef struct {
     size_t line;
     size_t col;
 } Location;
 
+// Tokens do not own their text, start and len point back into the source buffer
+// so the buffer has to outlive every token (and every AST node made from them)
 typedef struct {
     Token type; // The type of the token
-    char *val; // The value of the token
-    Location loc; // The location of the token
+    int int_val; // The decoded value of a tok_number
+    const char *start; // The text of the token (not null-terminated)
+    size_t len; // The length of the text
 } TokenData;
 
+// Expands to the arguments for a "%.*s" conversion so a token can be printed directly
+#define TOK_FMT(tok) (int)(tok).len, (tok).start
+
 typedef struct {
-    char *start_tok;
-    char *cur_tok;
-    TokenData *tokens;
+    const char *start_tok;
+    const char *cur_tok;
+
+    // The token stream lex() produces, stored as parallel arrays (9 bytes per token)
+    // Use token_at to get a TokenData back
+    uint8_t *kinds;     // Token
+    uint32_t *offsets;  // from start_tok
+    uint32_t *lengths;
     int token_count;
     size_t capacity;
-    size_t line_number;
-    char *line_start;
+
+    // Offset of the first character of every line, built by the first token_location call
+    uint32_t *line_starts;
+    int line_count;
+
+    const Scanner *scanner; // picked on the first next_token()
+    int quiet; // fail without printing, lex_parallel re-lexes serially to report the error
 } Lexer;
 
+// Sources under this many bytes per thread are not worth splitting up
+#define LEX_PARALLEL_MIN_CHUNK (1024 * 1024)
+
 int lex(Lexer *lexer);
 
+int lex_until(Lexer *lexer, const char *end);
+
+int lex_parallel(Lexer *lexer, int thread_count, size_t min_chunk);
+
+int next_token(Lexer *lexer, TokenData *tok);
+
+TokenData token_at(Lexer *lexer, int index);
+
+Location token_location(Lexer *lexer, TokenData tok);
+
 void free_lexer(Lexer *lexer);
 
 char *token_to_string(Token token);
 
+int token_equals(TokenData tok, const char *str);
+
+char *unescape_string(const char *str, size_t len);
+
 #endif
\ No newline at end of file
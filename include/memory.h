@@ -9,4 +9,7 @@ void *s_calloc(size_t nmemb, size_t size);
 void *s_realloc(void *ptr, size_t size);
 void s_free(void *ptr);
 
+// Number of allocations made through the functions above so far
+size_t s_alloc_count(void);
+
 #endif
@@ -1,14 +1,37 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <setjmp.h>
+
 #include "lexer.h"
 #include "ast.h"
 
+// The parser only ever looks at the current token and the one after it
+// Must be a power of two
+#define PARSER_WINDOW 2
+
 typedef struct {
     Lexer *lexer;
     Token cur_tok;
     Token next_tok;
     int next_tok_index;
+    // Ring buffer holding the tokens the parser can still see, token i lives in window[i % PARSER_WINDOW]
+    // Tokens come from the lexer's token arrays if lex() already ran, otherwise they are pulled with next_token()
+    TokenData window[PARSER_WINDOW];
+
+    // The program's arena while parse() runs, every node is allocated from it
+    Arena *arena;
+    // Chunk size for the program's arena, 0 uses ARENA_DEFAULT_CHUNK_SIZE
+    size_t arena_chunk_size;
+    // Only brace-match block function bodies and leave them for parse_func_body
+    // Needs the token arrays, without them every body is parsed as usual
+    int lazy_bodies;
+    // Brace-match function bodies and drop them, with or without token arrays
+    // For collecting the prototypes of a program, the bodies are never parsed afterwards
+    int skip_bodies;
+    // Set for the workers of parse_parallel, a syntax error jumps here without printing instead of exiting
+    // NULL reports the error and exits
+    jmp_buf *bail;
 } Parser;
 
 typedef enum {
@@ -25,4 +48,14 @@ Parser init_parser(Lexer *lexer);
 
 Program *parse(Parser *this);
 
+Stmt *parse_declaration(Parser *this);
+
+// Inputs with fewer tokens than this per thread are not worth parsing in parallel
+#define PARSE_PARALLEL_MIN_TOKENS (64 * 1024)
+
+Program *parse_parallel(Parser *this, int thread_count, int min_tokens);
+
+// Parses the body of a function the parser skipped, does nothing if it is already there
+void parse_func_body(Program *prog, Stmt *func);
+
 #endif
@@ -0,0 +1,28 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+
+#include "ast_opt.h"
+#include "codegen.h"
+#include "source.h"
+
+// How compile_streaming treats each declaration
+typedef struct {
+    int ast_opt;            // run the AST passes on each declaration before codegen
+    int optimize_functions; // run FUNCTION_PIPELINE on the functions once they are all generated
+    // If set, the AST passes add what they removed here, ast_pass_count entries
+    AstPassResult *ast_results;
+} StreamOptions;
+
+// What compile_streaming went through
+typedef struct {
+    int function_count;
+    int global_count;
+    size_t peak_ast_bytes;  // the most AST memory a single declaration needed
+    size_t total_ast_bytes; // what the whole program's AST would have needed at once
+} StreamStats;
+
+LLVMValueRef compile_streaming(CodeGen *codegen, Source *source, StreamOptions *options, StreamStats *stats);
+
+#endif
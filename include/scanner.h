@@ -0,0 +1,26 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <stddef.h>
+
+// Kernels the lexer uses to skip over runs of characters
+// Each one returns a pointer to the first character that ends the run
+// The source has to be null-terminated, '\0' always ends a run
+typedef struct {
+    // Skips spaces and newlines
+    const char *(*whitespace)(const char *p);
+    // Finds the '\n' (or '\0') that ends a // comment
+    const char *(*line_end)(const char *p);
+    // Finds the closing '"' (or '\0') of a string literal
+    const char *(*string_end)(const char *p);
+    // Skips [A-Za-z0-9_]
+    const char *(*identifier_end)(const char *p);
+    // Skips [0-9]
+    const char *(*digits_end)(const char *p);
+    const char *name;
+} Scanner;
+
+// Returns the fastest scanner the CPU supports (AVX2, SSE2, NEON or plain C)
+const Scanner *get_scanner(void);
+
+#endif
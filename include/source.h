@@ -0,0 +1,18 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+
+// A loaded source file
+// text is always followed by a '\0' so the lexer can run off the end safely
+typedef struct {
+    const char *text;
+    size_t len;
+    size_t mapped_len; // size of the mapping if the file was mmap'ed, 0 if text is on the heap
+} Source;
+
+int load_source(const char *path, Source *source);
+
+void free_source(Source *source);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <llvm-c/Core.h>
+
+// Maps a 64 bit key to a value, open addressing with linear probing
+// Used for the definition of each variable in each block and for where removed phis went
+typedef struct {
+    uint64_t *keys;
+    LLVMValueRef *values; // NULL for an empty slot
+    uint32_t capacity;    // a power of two
+    uint32_t count;
+} SsaValueMap;
+
+// A phi created before its block had all of its predecessors, it gets its operands when the block is sealed
+typedef struct {
+    int variable;
+    LLVMValueRef phi;
+} SsaIncompletePhi;
+
+typedef struct {
+    LLVMBasicBlockRef block;
+    int *preds;
+    int pred_count;
+    int pred_capacity;
+    int sealed; // every predecessor is known
+    SsaIncompletePhi *incomplete;
+    int incomplete_count;
+    int incomplete_capacity;
+} SsaBlock;
+
+// A phi at a join whose operands are being read, one per predecessor
+typedef struct {
+    int start; // the block the read started in, it and the blocks up to join get the phi's final value
+    int join;
+    LLVMValueRef phi;
+    int next_pred;
+} SsaPendingPhi;
+
+typedef struct {
+    LLVMTypeRef type;
+    const char *name; // token text, not null-terminated, phis are named after the variable
+    size_t len;
+} SsaVariable;
+
+// Builds SSA form for the locals of one function while its code is generated
+// (Braun et al., "Simple and Efficient Construction of Static Single Assignment Form")
+// Writes record the current value of a variable in a block, reads look for it there and otherwise in the
+// predecessors, placing phis where paths join. A block is sealed once all of its predecessors are known,
+// until then reads in it get placeholder phis that are completed on sealing. Phis that turn out to merge
+// a single value are replaced by it.
+typedef struct {
+    LLVMContextRef context;
+    LLVMBuilderRef phi_builder; // positioned at the top of whichever block gets a phi
+
+    SsaBlock *blocks;
+    int block_count;
+    int block_capacity;
+
+    SsaVariable *variables;
+    int variable_count;
+    int variable_capacity;
+
+    SsaValueMap defs;      // (block, variable) to the variable's current value at the end of the block
+    SsaValueMap forwarded; // removed phi to what replaced it
+
+    LLVMValueRef *removed; // phis with no uses left, erased at the end of the function
+    int removed_count;
+    int removed_capacity;
+
+    // Reads are resolved with this stack rather than recursion, a value can come from thousands of joins back
+    SsaPendingPhi *pending;
+    int pending_count;
+    int pending_capacity;
+} SsaBuilder;
+
+void ssa_init(SsaBuilder *ssa, LLVMContextRef context);
+void ssa_free(SsaBuilder *ssa);
+
+// Forgets the blocks and variables of the previous function
+void ssa_begin_function(SsaBuilder *ssa);
+// Erases the phis that were replaced, every block should be sealed by now
+void ssa_end_function(SsaBuilder *ssa);
+
+int ssa_add_block(SsaBuilder *ssa, LLVMValueRef func, const char *name);
+LLVMBasicBlockRef ssa_block(SsaBuilder *ssa, int block);
+void ssa_add_predecessor(SsaBuilder *ssa, int block, int pred);
+void ssa_seal_block(SsaBuilder *ssa, int block);
+
+int ssa_add_variable(SsaBuilder *ssa, LLVMTypeRef type, const char *name, size_t len);
+void ssa_write(SsaBuilder *ssa, int variable, int block, LLVMValueRef value);
+LLVMValueRef ssa_read(SsaBuilder *ssa, int variable, int block);
+
+#endif
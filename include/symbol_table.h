@@ -0,0 +1,69 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <llvm-c/Core.h>
+
+typedef enum {
+    SYMBOL_LOCAL,    // an SSA variable of the function being generated, lives until its scope is popped
+    SYMBOL_GLOBAL,   // a global variable of the module
+    SYMBOL_FUNCTION, // a function of the module
+    SYMBOL_BUILTIN,  // a standard library function, generated by handle_stdlib_call
+} SymbolKind;
+
+// Functions and builtins are looked up in their own namespace, so a variable never hides a function or the other
+// way around, like when globals and functions came straight from the module
+#define SYMBOL_IS_CALLABLE(kind) ((kind) == SYMBOL_FUNCTION || (kind) == SYMBOL_BUILTIN)
+
+typedef struct {
+    const char *name; // token text, not owned and not null-terminated, NULL for an empty slot
+    size_t len;
+    uint32_t hash;
+    SymbolKind kind;
+    LLVMValueRef value;  // the global or function, NULL for locals and builtins
+    LLVMTypeRef type;    // the value type of locals and globals, the function type for functions
+    int variable;        // the SsaBuilder variable of a local
+    const char *builtin; // name handle_stdlib_call knows a builtin by
+} Symbol;
+
+// What a slot held before a local was declared into it, undone when the local's scope is popped
+typedef struct {
+    Symbol previous; // name is NULL if the local did not hide anything
+    const char *name;
+    size_t len;
+    uint32_t hash;
+} ShadowedSymbol;
+
+// Open addressing hash table over every name codegen can see
+// Locals are declared into the innermost scope and hide anything with the same name until the scope ends,
+// globals, functions and builtins are cached the first time they are resolved and stay for good
+typedef struct {
+    Symbol *slots;     // linear probing, kept at most half full
+    uint32_t capacity; // a power of two
+    uint32_t count;
+
+    ShadowedSymbol *shadowed; // one entry per local declared in any open scope, innermost last
+    int shadowed_count;
+    int shadowed_capacity;
+
+    int *scopes; // shadowed_count when each open scope was pushed
+    int scope_count;
+    int scope_capacity;
+} SymbolTable;
+
+void symbol_table_init(SymbolTable *table);
+void symbol_table_free(SymbolTable *table);
+
+// The symbol in the variable namespace or the callable one, NULL if there is none
+// The pointer stays valid until the next symbol is defined
+Symbol *symbol_lookup(SymbolTable *table, const char *name, size_t len, int callable);
+
+// Binds symbol.name, hash is filled in. A local is dropped again when the innermost open scope is popped
+Symbol *symbol_define(SymbolTable *table, Symbol symbol);
+
+void symbol_push_scope(SymbolTable *table);
+void symbol_pop_scope(SymbolTable *table);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+
+// Calls work on each of the count jobs (job_size bytes apart) on its own thread and waits for all of them
+// The first job runs on the calling thread, jobs whose thread cannot be started run there too
+void run_workers(void *jobs, size_t job_size, int count, void *(*work)(void *));
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Where the AST printers send their output
+// Either a growable heap buffer or a FILE*, so a whole program can be printed in one pass without
+// building a string per node
+typedef struct {
+    FILE *file; // output goes straight here if set, otherwise into data
+
+    char *data; // always '\0' terminated once anything was written
+    size_t len;
+    size_t capacity;
+} Writer;
+
+void writer_init_buffer(Writer *writer);
+void writer_init_file(Writer *writer, FILE *file);
+
+void write_bytes(Writer *writer, const char *bytes, size_t len);
+void write_str(Writer *writer, const char *str);
+void write_char(Writer *writer, char c);
+
+// Writes the bytes of a string with C-style escapes, like escape_c_string does
+void write_escaped(Writer *writer, const char *str, size_t len);
+
+// Hands over the buffer as a heap string the caller frees, the writer is left empty
+char *writer_take(Writer *writer);
+
+void writer_free(Writer *writer);
+
+#endif
@@ -0,0 +1,117 @@
+#include "arena.h"
+
+#include <string.h>
+
+#include "memory.h"
+
+// Every allocation is aligned for any type
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena_chunk {
+    ArenaChunk *next;
+};
+
+// The chunk header is padded so the data after it stays aligned
+#define CHUNK_HEADER ALIGN_UP(sizeof(ArenaChunk))
+
+static char *new_chunk(Arena *arena, size_t size);
+
+/**
+ * Sets up an empty arena, no memory is taken until the first allocation.
+ * @param arena The arena to set up.
+ * @param chunk_size How much to take from malloc at a time, 0 for ARENA_DEFAULT_CHUNK_SIZE.
+ */
+void arena_init(Arena *arena, size_t chunk_size) {
+    memset(arena, 0, sizeof(Arena));
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+}
+
+/**
+ * Allocates size bytes that live until arena_free.
+ * This is a pointer bump except when the current chunk is full.
+ * @return The (uninitialized) memory.
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ALIGN_UP(size);
+    arena->used += size;
+
+    if ((size_t)(arena->end - arena->cur) >= size) {
+        char *ptr = arena->cur;
+        arena->cur += size;
+        return ptr;
+    }
+
+    // anything bigger than half a chunk gets a chunk of its own so the current one keeps filling up
+    if (size > arena->chunk_size / 2) {
+        return new_chunk(arena, size);
+    }
+
+    char *ptr = new_chunk(arena, arena->chunk_size);
+    arena->cur = ptr + size;
+    arena->end = ptr + arena->chunk_size;
+    return ptr;
+}
+
+/**
+ * Resizes an array allocated from the arena.
+ * If it was the last allocation and the chunk has room it grows in place, otherwise it is copied
+ * and the old space is simply left behind until arena_free.
+ * @param ptr The array, or NULL to allocate a new one.
+ * @param old_size The size ptr was allocated with.
+ * @param new_size The size needed now.
+ * @return The resized array.
+ */
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return arena_alloc(arena, new_size);
+
+    old_size = ALIGN_UP(old_size);
+    new_size = ALIGN_UP(new_size);
+    if (new_size <= old_size) return ptr;
+
+    char *block = (char *)ptr;
+    if (block + old_size == arena->cur && (size_t)(arena->end - block) >= new_size) {
+        arena->cur = block + new_size;
+        arena->used += new_size - old_size;
+        return ptr;
+    }
+
+    void *copy = arena_alloc(arena, new_size);
+    memcpy(copy, ptr, old_size);
+    return copy;
+}
+
+/**
+ * Hands every chunk of one arena over to another, so memory allocated from either is freed with into.
+ * from is left empty. Bumping carries on in into's current chunk, from's last chunk is not reused.
+ */
+void arena_merge(Arena *into, Arena *from) {
+    if (from->chunks) {
+        ArenaChunk *last = from->chunks;
+        while (last->next) last = last->next;
+        last->next = into->chunks;
+        into->chunks = from->chunks;
+    }
+    into->used += from->used;
+    arena_init(from, from->chunk_size);
+}
+
+// Releases every chunk, everything allocated from the arena is gone afterwards
+void arena_free(Arena *arena) {
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        s_free(chunk);
+        chunk = next;
+    }
+    arena_init(arena, arena->chunk_size);
+}
+
+// Takes a new chunk from malloc with room for size bytes and returns its data
+static char *new_chunk(Arena *arena, size_t size) {
+    ArenaChunk *chunk = (ArenaChunk *)s_malloc(CHUNK_HEADER + size);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+
+    return (char *)chunk + CHUNK_HEADER;
+}
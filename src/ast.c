@@ -6,19 +6,17 @@
 
 #include "memory.h"
 
-// Helper: write a string with C-style escapes into a buffer (returns buffer pointer)
-static char* escape_c_string(const char* s);
-
 
 /**
  * Creates a binary expression node.
+ * @param arena The arena the node is allocated from.
  * @param left The left operand expression.
  * @param op The operator token data.
  * @param right The right operand expression.
  * @return Pointer to the created Expr node (of type BinaryExpr).
  */
-Expr* binary_expr(Expr* left, TokenData op, Expr* right) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* binary_expr(Arena *arena, Expr* left, TokenData op, Expr* right) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_BINARY;
     expr->binary.left = left;
@@ -30,12 +28,13 @@ Expr* binary_expr(Expr* left, TokenData op, Expr* right) {
 
 /**
  * Creates a unary expression node.
+ * @param arena The arena the node is allocated from.
  * @param op The operator token data.
  * @param right The right operand expression.
  * @return Pointer to the created Expr node (of type UnaryExpr).
  */
-Expr* unary_expr(TokenData op, Expr* right) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* unary_expr(Arena *arena, TokenData op, Expr* right) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_UNARY;
     expr->unary.op_token = op;
@@ -46,12 +45,13 @@ Expr* unary_expr(TokenData op, Expr* right) {
 
 /**
  * Creates an increment expression node.
+ * @param arena The arena the node is allocated from.
  * @param op_token The operator token data. (++ or --)
  * @param identifier The identifier token data.
  * @param is_prefix 1 if prefix (e.g. ++x), 0 if postfix (e.g. x++).
  */
-Expr *increment_expr(TokenData op_token, TokenData identifier, int is_prefix) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr *increment_expr(Arena *arena, TokenData op_token, TokenData identifier, int is_prefix) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_INCREMENT;
     expr->increment.op_token = op_token;
@@ -63,11 +63,12 @@ Expr *increment_expr(TokenData op_token, TokenData identifier, int is_prefix) {
 
 /**
  * Creates an identifier expression node.
+ * @param arena The arena the node is allocated from.
  * @param identifier The token data for the identifier.
  * @return Pointer to the created Expr node (of type IdentifierExpr).
  */
-Expr* identifier_expr(TokenData identifier) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* identifier_expr(Arena *arena, TokenData identifier) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_IDENTIFIER;
     expr->identifier.tok = identifier;
@@ -77,39 +78,42 @@ Expr* identifier_expr(TokenData identifier) {
 
 /**
  * Creates an integer literal expression node.
- * @param value The string value of the integer literal.
+ * @param arena The arena the node is allocated from.
+ * @param tok The number token (carries both the text and the decoded value).
  * @return Pointer to the created Expr node (of type IntLiteral).
  */
-Expr* int_literal(char* value) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* int_literal(Arena *arena, TokenData tok) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_LITERAL_INT;
-    expr->int_literal.value = value;
+    expr->int_literal.tok = tok;
 
     return expr;
 }
 
 /**
  * Creates a string literal expression node.
- * @param value The string value of the string literal.
+ * @param arena The arena the node is allocated from.
+ * @param tok The string token (raw text between the quotes).
  * @return Pointer to the created Expr node (of type StringLiteral).
  */
-Expr* string_literal(char* value) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* string_literal(Arena *arena, TokenData tok) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_LITERAL_STRING;
-    expr->str_literal.value = value;
+    expr->str_literal.tok = tok;
 
     return expr;
 }
 
 /**
  * Creates a boolean literal expression node.
+ * @param arena The arena the node is allocated from.
  * @param value The integer value of the boolean literal (0 or 1).
  * @return Pointer to the created Expr node (of type BoolLiteral).
  */
-Expr* bool_literal(int value) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* bool_literal(Arena *arena, int value) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_LITERAL_BOOL;
     expr->bool_literal.value = value;
@@ -119,13 +123,14 @@ Expr* bool_literal(int value) {
 
 /**
  * Creates a function call expression node.
+ * @param arena The arena the node is allocated from.
  * @param tok_function The token data for name of the function being called.
  * @param args Array of argument expressions.
  * @param arg_count Number of arguments.
  * @return Pointer to the created Expr node (of type FuncCallExpr).
  */
-Expr* func_call(TokenData tok_function, Expr** args, int arg_count) {
-    Expr* expr = (Expr*)s_malloc(sizeof(Expr));
+Expr* func_call(Arena *arena, TokenData tok_function, Expr** args, int arg_count) {
+    Expr* expr = (Expr*)arena_alloc(arena, sizeof(Expr));
 
     expr->type = EXPR_FUNC_CALL;
     expr->func_call.tok_function = tok_function;
@@ -137,16 +142,17 @@ Expr* func_call(TokenData tok_function, Expr** args, int arg_count) {
 
 /**
  * Creates a function declaration statement node.
+ * @param arena The arena the node is allocated from.
  * @param identifier The token data for the function name.
- * @param body The function body statement (should be a BlockStmt).
+ * @param body The function body statement (should be a BlockStmt), NULL if the parser skipped it.
  * @param return_type The token data for the return type (since it's specified in the declaration).
  * @param parameter_names Array of token data for parameter names.
  * @param parameter_types Array of token data for parameter types.
  * @param parameter_count Number of parameters.
  * @return Pointer to the created Stmt node (of type FuncDeclStmt).
  */
-Stmt* func_decl_stmt(TokenData identifier, Stmt* body, TokenData return_type, TokenData* parameter_names, TokenData* parameter_types, int parameter_count) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt* func_decl_stmt(Arena *arena, TokenData identifier, Stmt* body, TokenData return_type, TokenData* parameter_names, TokenData* parameter_types, int parameter_count) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_FUNC_DECL;
     stmt->func_decl.tok_identifier = identifier;
@@ -155,6 +161,7 @@ Stmt* func_decl_stmt(TokenData identifier, Stmt* body, TokenData return_type, To
     stmt->func_decl.parameter_names = parameter_names;
     stmt->func_decl.parameter_types = parameter_types;
     stmt->func_decl.parameter_count = parameter_count;
+    stmt->func_decl.body_start = 0;
 
     return stmt;
 }
@@ -162,13 +169,14 @@ Stmt* func_decl_stmt(TokenData identifier, Stmt* body, TokenData return_type, To
 /**
  * Currently this function is UNUSED
  * Creates a global variable declaration statement node.
+ * @param arena The arena the node is allocated from.
  * @param type The type of the variable (string or int)
  * @param identifier The token data for the variable name.
  * @param value The expression for the variable's initial value.
  * @return Pointer to the created Stmt node (of type GlobalVarDeclStmt).
  */
-Stmt *global_var_decl_stmt(TokenData type, TokenData identifier, Expr* value) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt *global_var_decl_stmt(Arena *arena, TokenData type, TokenData identifier, Expr* value) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_GLOBAL_VAR_DECL;
     stmt->global_var_decl.type = type;
@@ -180,13 +188,14 @@ Stmt *global_var_decl_stmt(TokenData type, TokenData identifier, Expr* value) {
 
 /**
  * Creates a variable declaration statement node.
+ * @param arena The arena the node is allocated from.
  * @param type The type of the variable (string or int)
  * @param identifier The token data for the variable name.
  * @param value The expression for the variable's initial value.
  * @return Pointer to the created Stmt node (of type VarDeclStmt).
  */
-Stmt* var_decl_stmt(TokenData type, TokenData identifier, Expr* value) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt* var_decl_stmt(Arena *arena, TokenData type, TokenData identifier, Expr* value) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_VAR_DECL;
     stmt->var_decl.type = type;
@@ -198,13 +207,14 @@ Stmt* var_decl_stmt(TokenData type, TokenData identifier, Expr* value) {
 
 /**
  * Creates a variable assignment statement node.
+ * @param arena The arena the node is allocated from.
  * @param identifier The token data for the variable name.
  * @param modifying_tok The token data for the assignment operator (=, +=, -=, *=, /=).
  * @param new_value The expression for the new value to assign.
  * @return Pointer to the created Stmt node (of type VarAssignStmt).
  */
-Stmt *var_assign_stmt(TokenData identifier, TokenData modifying_tok, Expr* new_value) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt *var_assign_stmt(Arena *arena, TokenData identifier, TokenData modifying_tok, Expr* new_value) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_VAR_ASSIGN;
     stmt->var_assign.tok_identifier = identifier;
@@ -216,11 +226,12 @@ Stmt *var_assign_stmt(TokenData identifier, TokenData modifying_tok, Expr* new_v
 
 /**
  * Creates a return statement node.
+ * @param arena The arena the node is allocated from.
  * @param value The expression to return.
  * @return Pointer to the created Stmt node (of type ReturnStmt).
  */
-Stmt* return_stmt(Expr* value) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt* return_stmt(Arena *arena, Expr* value) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_RETURN;
     stmt->return_stmt.value = value;
@@ -230,11 +241,12 @@ Stmt* return_stmt(Expr* value) {
 
 /**
  * Creates an expression statement node.
+ * @param arena The arena the node is allocated from.
  * @param expr The expression contained in the statement.
  * @return Pointer to the created Stmt node (of type ExprStmt).
  */
-Stmt *expression_stmt(Expr *expr) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt *expression_stmt(Arena *arena, Expr *expr) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_EXPR;
     stmt->expression_stmt.value = expr;
@@ -244,12 +256,13 @@ Stmt *expression_stmt(Expr *expr) {
 
 /**
  * Creates a block statement node.
+ * @param arena The arena the node is allocated from.
  * @param statements Array of statement pointers in the block.
  * @param stmt_count Number of statements in the block.
  * @return Pointer to the created Stmt node (of type BlockStmt).
  */
-Stmt* block_stmt(Stmt** statements, int stmt_count) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt* block_stmt(Arena *arena, Stmt** statements, int stmt_count) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_BLOCK;
     stmt->block_stmt.statements = statements;
@@ -260,13 +273,14 @@ Stmt* block_stmt(Stmt** statements, int stmt_count) {
 
 /**
  * Creates an if statement node.
+ * @param arena The arena the node is allocated from.
  * @param condition The condition expression.
  * @param then_branch The 'then' branch statement (should be a BlockStmt).
  * @param else_branch The 'else' branch statement (should be a BlockStmt, can be NULL).
  * @return Pointer to the created Stmt node (of type IfStmt).
  */
-Stmt *if_stmt(Expr *condition, Stmt *then_branch, int else_if_count, Expr **else_if_conditions, Stmt **else_if_branches, Stmt *else_branch) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt *if_stmt(Arena *arena, Expr *condition, Stmt *then_branch, int else_if_count, Expr **else_if_conditions, Stmt **else_if_branches, Stmt *else_branch) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_IF;
     stmt->if_stmt.condition = condition;
@@ -281,11 +295,12 @@ Stmt *if_stmt(Expr *condition, Stmt *then_branch, int else_if_count, Expr **else
 
 /**
  * Creates a while statement node.
+ * @param arena The arena the node is allocated from.
  * @param condition The condition expression.
  * @param body The body statement (should be a BlockStmt).
  */
-Stmt *while_stmt(Expr *condition, Stmt *body) {
-    Stmt* stmt = (Stmt*)s_malloc(sizeof(Stmt));
+Stmt *while_stmt(Arena *arena, Expr *condition, Stmt *body) {
+    Stmt* stmt = (Stmt*)arena_alloc(arena, sizeof(Stmt));
 
     stmt->type = STMT_WHILE;
     stmt->while_stmt.condition = condition;
@@ -294,275 +309,284 @@ Stmt *while_stmt(Expr *condition, Stmt *body) {
     return stmt;
 }
 
-/**
- * Creates a program node (the root of the AST).
- * @param statements Array of statement pointers in the program.
- * @param stmt_count Number of statements in the program.
- * @return Pointer to the created Program node.
- */
-Program* create_program(Stmt** statements, int stmt_count) {
-    Program* program = (Program*)s_malloc(sizeof(Program));
-
-    program->statements = statements;
-    program->stmt_count = stmt_count;
-
-    return program;
+static void write_tok(Writer *writer, TokenData tok) {
+    write_bytes(writer, tok.start, tok.len);
 }
 
-// Helper function to recursively format expressions
-char* expr_to_string(Expr* expr) {
-    if (!expr) return strdup("null");
+// Writes every statement of a block, each on its own line after indent
+static void write_block_body(Writer *writer, Stmt *block, const char *indent) {
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        write_str(writer, indent);
+        write_stmt(writer, block->block_stmt.statements[i]);
+    }
+}
 
-    char* buffer = s_malloc(512);
+/**
+ * Prints an expression in the format of the parser tests.
+ * Children are written as they are visited, so the cost is linear in the size of the tree.
+ */
+void write_expr(Writer *writer, Expr *expr) {
+    if (!expr) {
+        write_str(writer, "null");
+        return;
+    }
 
     switch (expr->type) {
-        case EXPR_BINARY: {
-            char* left_str = expr_to_string(expr->binary.left);
-            char* right_str = expr_to_string(expr->binary.right);
-            snprintf(buffer, 512, "BinaryExpr(%s %s %s)", left_str, expr->binary.op_token.val, right_str);
-            s_free(left_str);
-            s_free(right_str);
-            return buffer;
-        }
+        case EXPR_BINARY:
+            write_str(writer, "BinaryExpr(");
+            write_expr(writer, expr->binary.left);
+            write_char(writer, ' ');
+            write_tok(writer, expr->binary.op_token);
+            write_char(writer, ' ');
+            write_expr(writer, expr->binary.right);
+            write_char(writer, ')');
+            return;
         case EXPR_INCREMENT:
+            write_str(writer, "IncrementExpr(");
             if (expr->increment.is_prefix) {
-                snprintf(buffer, 512, "IncrementExpr(%s%s)", expr->increment.op_token.val, expr->increment.identifier.val);
+                write_tok(writer, expr->increment.op_token);
+                write_tok(writer, expr->increment.identifier);
             } else {
-                snprintf(buffer, 512, "IncrementExpr(%s%s)", expr->increment.identifier.val, expr->increment.op_token.val);
+                write_tok(writer, expr->increment.identifier);
+                write_tok(writer, expr->increment.op_token);
             }
-            return buffer;
-        case EXPR_UNARY: {
-            char* right_str = expr_to_string(expr->unary.right);
-            snprintf(buffer, 512, "UnaryExpr(%s %s)", expr->unary.op_token.val, right_str);
-            s_free(right_str);
-            return buffer;
-        }
+            write_char(writer, ')');
+            return;
+        case EXPR_UNARY:
+            write_str(writer, "UnaryExpr(");
+            write_tok(writer, expr->unary.op_token);
+            write_char(writer, ' ');
+            write_expr(writer, expr->unary.right);
+            write_char(writer, ')');
+            return;
         case EXPR_IDENTIFIER:
-            snprintf(buffer, 512, "IdentifierExpr(%s)", expr->identifier.tok.val);
-            return buffer;
+            write_str(writer, "IdentifierExpr(");
+            write_tok(writer, expr->identifier.tok);
+            write_char(writer, ')');
+            return;
         case EXPR_LITERAL_INT:
-            snprintf(buffer, 512, "IntLiteral(%s)", expr->int_literal.value);
-            return buffer;
+            write_str(writer, "IntLiteral(");
+            write_tok(writer, expr->int_literal.tok);
+            write_char(writer, ')');
+            return;
         case EXPR_LITERAL_STRING: {
-            char* esc = escape_c_string(expr->str_literal.value);
-            snprintf(buffer, 512, "StringLiteral(\"%s\")", esc);
-            s_free(esc);
-            return buffer;
+            char* value = unescape_string(expr->str_literal.tok.start, expr->str_literal.tok.len);
+            write_str(writer, "StringLiteral(\"");
+            write_escaped(writer, value, strlen(value));
+            write_str(writer, "\")");
+            s_free(value);
+            return;
         }
         case EXPR_LITERAL_BOOL:
-            snprintf(buffer, 512, "BoolLiteral(%s)", expr->bool_literal.value ? "true" : "false");
-            return buffer;
-        case EXPR_FUNC_CALL: {
-            char* args_buffer = s_malloc(256);
-            args_buffer[0] = '\0';
-            for (int i = 0; i < expr->func_call.arg_count; i++) {
-                char* arg_str = expr_to_string(expr->func_call.args[i]);
-                strcat(args_buffer, arg_str);
-                if (i < expr->func_call.arg_count - 1) {
-                    strcat(args_buffer, ", ");
+            write_str(writer, expr->bool_literal.value ? "BoolLiteral(true)" : "BoolLiteral(false)");
+            return;
+        case EXPR_FUNC_CALL:
+            write_str(writer, "FuncCallExpr(");
+            write_tok(writer, expr->func_call.tok_function);
+            if (expr->func_call.arg_count > 0) {
+                write_char(writer, '(');
+                for (int i = 0; i < expr->func_call.arg_count; i++) {
+                    if (i > 0) write_str(writer, ", ");
+                    write_expr(writer, expr->func_call.args[i]);
                 }
-                s_free(arg_str);
-            }
-            if (expr->func_call.arg_count == 0) {
-                snprintf(buffer, 512, "FuncCallExpr(%s)", expr->func_call.tok_function.val);
-            } else {
-                snprintf(buffer, 512, "FuncCallExpr(%s(%s))", expr->func_call.tok_function.val, args_buffer);
+                write_char(writer, ')');
             }
-            s_free(args_buffer);
-            return buffer;
-        }
+            write_char(writer, ')');
+            return;
         default:
-            s_free(buffer);
-            return strdup("Unknown Expression");
+            write_str(writer, "Unknown Expression");
+            return;
     }
 }
 
-// Helper function to recursively format statements
-char* stmt_to_string(Stmt* stmt) {
-    char* buffer = s_malloc(1024);
-
+// Prints a statement in the format of the parser tests, nested statements go on their own indented lines
+void write_stmt(Writer *writer, Stmt *stmt) {
     switch (stmt->type) {
-        case STMT_FUNC_DECL: {
-            char* params_buffer = s_malloc(256);
-            params_buffer[0] = '\0';
-            for (int i = 0; i < stmt->func_decl.parameter_count; i++) {
-                strcat(params_buffer, stmt->func_decl.parameter_names[i].val);
-                strcat(params_buffer, ": ");
-                strcat(params_buffer, stmt->func_decl.parameter_types[i].val);
-                if (i < stmt->func_decl.parameter_count - 1) {
-                    strcat(params_buffer, ", ");
+        case STMT_FUNC_DECL:
+            write_str(writer, "FuncDeclStmt(");
+            write_tok(writer, stmt->func_decl.tok_identifier);
+            if (stmt->func_decl.parameter_count > 0) {
+                write_str(writer, ", (");
+                for (int i = 0; i < stmt->func_decl.parameter_count; i++) {
+                    if (i > 0) write_str(writer, ", ");
+                    write_tok(writer, stmt->func_decl.parameter_names[i]);
+                    write_str(writer, ": ");
+                    write_tok(writer, stmt->func_decl.parameter_types[i]);
                 }
+                write_char(writer, ')');
             }
-            if (stmt->func_decl.parameter_count == 0) {
-                snprintf(buffer, 1024, "FuncDeclStmt(%s)", stmt->func_decl.tok_identifier.val);
-            } else {
-                snprintf(buffer, 1024, "FuncDeclStmt(%s, (%s))", stmt->func_decl.tok_identifier.val, params_buffer);
-            }
-            s_free(params_buffer);
-            for (int i = 0; i < stmt->func_decl.body->block_stmt.stmt_count; i++) {
-                char* body_stmt_str = stmt_to_string(stmt->func_decl.body->block_stmt.statements[i]);
-                strcat(buffer, "\n  ");
-                strcat(buffer, body_stmt_str);
-                s_free(body_stmt_str);
+            write_char(writer, ')');
+            // a body the parser skipped is not printed
+            if (stmt->func_decl.body) write_block_body(writer, stmt->func_decl.body, "\n  ");
+            return;
+        case STMT_VAR_DECL:
+        case STMT_GLOBAL_VAR_DECL:
+            // both kinds share the VarDeclStmt layout
+            write_str(writer, stmt->type == STMT_VAR_DECL ? "VarDeclStmt(" : "GlobalVarDeclStmt(");
+            write_tok(writer, stmt->var_decl.type);
+            write_char(writer, ' ');
+            write_tok(writer, stmt->var_decl.tok_identifier);
+            write_str(writer, " = ");
+            write_expr(writer, stmt->var_decl.value);
+            write_char(writer, ')');
+            return;
+        case STMT_VAR_ASSIGN:
+            write_str(writer, "VarAssignStmt(");
+            write_tok(writer, stmt->var_assign.tok_identifier);
+            write_char(writer, ' ');
+            write_tok(writer, stmt->var_assign.modifying_tok);
+            write_char(writer, ' ');
+            write_expr(writer, stmt->var_assign.new_value);
+            write_char(writer, ')');
+            return;
+        case STMT_RETURN:
+            write_str(writer, "ReturnStmt(");
+            if (stmt->return_stmt.value) write_expr(writer, stmt->return_stmt.value);
+            write_char(writer, ')');
+            return;
+        case STMT_EXPR:
+            write_str(writer, "ExprStmt(");
+            write_expr(writer, stmt->expression_stmt.value);
+            write_char(writer, ')');
+            return;
+        case STMT_IF:
+            write_str(writer, "IfStmt(");
+            write_expr(writer, stmt->if_stmt.condition);
+            write_char(writer, ')');
+            write_block_body(writer, stmt->if_stmt.then_branch, "\n    ");
+
+            for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
+                write_str(writer, "\n  ElseIf(");
+                write_expr(writer, stmt->if_stmt.else_if_conditions[i]);
+                write_char(writer, ')');
+                write_block_body(writer, stmt->if_stmt.else_if_branches[i], "\n    ");
             }
 
-            return buffer;
-        }
-        case STMT_VAR_DECL: {
-            char* expr_str = expr_to_string(stmt->var_decl.value);
-            snprintf(buffer, 1024, "VarDeclStmt(%s %s = %s)", stmt->var_decl.type.val, stmt->var_decl.tok_identifier.val, expr_str);
-            s_free(expr_str);
-            return buffer;
-        }
-        case STMT_GLOBAL_VAR_DECL: {
-            char* expr_str = expr_to_string(stmt->global_var_decl.value);
-            snprintf(buffer, 1024, "GlobalVarDeclStmt(%s %s = %s)", stmt->var_decl.type.val, stmt->global_var_decl.tok_identifier.val, expr_str);
-            s_free(expr_str);
-            return buffer;
-        }
-        case STMT_VAR_ASSIGN: {
-            char* expr_str = expr_to_string(stmt->var_assign.new_value);
-            snprintf(buffer, 1024, "VarAssignStmt(%s %s %s)", stmt->var_assign.tok_identifier.val, stmt->var_assign.modifying_tok.val, expr_str);
-            s_free(expr_str);
-            return buffer;
-        }
-        case STMT_RETURN: {
-            if (stmt->return_stmt.value) {
-                char* expr_str = expr_to_string(stmt->return_stmt.value);
-                snprintf(buffer, 1024, "ReturnStmt(%s)", expr_str);
-                s_free(expr_str);
-            } else {
-                snprintf(buffer, 1024, "ReturnStmt()");
-            }
-            return buffer;
-        }
-        case STMT_EXPR: {
-            Expr* expr = stmt->expression_stmt.value;
-            char* expr_str = expr_to_string(expr);
-            snprintf(buffer, 1024, "ExprStmt(%s)", expr_str);
-            s_free(expr_str);
-            return buffer;
-        }
-        case STMT_IF: {
-            Expr* condition = stmt->if_stmt.condition;
-            char* condition_str = expr_to_string(condition);
-            snprintf(buffer, 1024, "IfStmt(%s)", condition_str);
-            Stmt* then_branch = stmt->if_stmt.then_branch;
-            for (int i = 0; i < then_branch->block_stmt.stmt_count; i++) {
-                char* body_stmt_str = stmt_to_string(then_branch->block_stmt.statements[i]);
-                strcat(buffer, "\n    ");
-                strcat(buffer, body_stmt_str);
-                s_free(body_stmt_str);
-            }
-            s_free(condition_str);
-            
-            if (!stmt->if_stmt.else_branch && stmt->if_stmt.else_if_count == 0) {
-                return buffer;
+            if (stmt->if_stmt.else_branch) {
+                write_str(writer, "\n  Else");
+                write_block_body(writer, stmt->if_stmt.else_branch, "\n    ");
             }
+            return;
+        case STMT_WHILE:
+            write_str(writer, "WhileStmt(");
+            write_expr(writer, stmt->while_stmt.condition);
+            write_char(writer, ')');
+            write_block_body(writer, stmt->while_stmt.body, "\n    ");
+            return;
+        case STMT_BLOCK:
+            // only the AST passes leave a block inside a block, as a branch that declares variables
+            write_str(writer, "BlockStmt()");
+            write_block_body(writer, stmt, "\n    ");
+            return;
+        default:
+            write_str(writer, "Unknown Statement Type");
+            return;
+    }
+}
 
-            if (stmt->if_stmt.else_if_count > 0) {
-                for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
-                    strcat(buffer, "\n  ElseIf(");
-                    char* else_if_cond_str = expr_to_string(stmt->if_stmt.else_if_conditions[i]);
-                    strcat(buffer, else_if_cond_str);
-                    strcat(buffer, ")");
-                    s_free(else_if_cond_str);
-                    Stmt* else_if_branch = stmt->if_stmt.else_if_branches[i];
-                    for (int j = 0; j < else_if_branch->block_stmt.stmt_count; j++) {
-                        char* body_stmt_str = stmt_to_string(else_if_branch->block_stmt.statements[j]);
-                        strcat(buffer, "\n    ");
-                        strcat(buffer, body_stmt_str);
-                        s_free(body_stmt_str);
-                    }
-                }
-            }
+// Formats an expression into a heap string the caller frees
+char* expr_to_string(Expr* expr) {
+    Writer writer;
+    writer_init_buffer(&writer);
+    write_expr(&writer, expr);
+    return writer_take(&writer);
+}
 
-            if (!stmt->if_stmt.else_branch) {
-                return buffer;
-            }
+// Formats a statement into a heap string the caller frees
+char* stmt_to_string(Stmt* stmt) {
+    Writer writer;
+    writer_init_buffer(&writer);
+    write_stmt(&writer, stmt);
+    return writer_take(&writer);
+}
 
+// Every node and array of the program lives in its arena, so there is no tree to walk
+static size_t count_expr(Expr *expr) {
+    if (!expr) return 0;
 
-            strcat(buffer, "\n  Else");
-            Stmt* else_branch = stmt->if_stmt.else_branch;
-            for (int i = 0; i < else_branch->block_stmt.stmt_count; i++) {
-                char* body_stmt_str = stmt_to_string(else_branch->block_stmt.statements[i]);
-                strcat(buffer, "\n    ");
-                strcat(buffer, body_stmt_str);
-                s_free(body_stmt_str);
+    size_t count = 1;
+    switch (expr->type) {
+        case EXPR_BINARY:
+            count += count_expr(expr->binary.left) + count_expr(expr->binary.right);
+            break;
+        case EXPR_UNARY:
+            count += count_expr(expr->unary.right);
+            break;
+        case EXPR_FUNC_CALL:
+            for (int i = 0; i < expr->func_call.arg_count; i++) {
+                count += count_expr(expr->func_call.args[i]);
             }
+            break;
+        default:
+            break;
+    }
+    return count;
+}
 
-            return buffer;
-        }
-        case STMT_WHILE: {
-            Expr* condition = stmt->while_stmt.condition;
-            char* condition_str = expr_to_string(condition);
-            snprintf(buffer, 1024, "WhileStmt(%s)", condition_str);
-            Stmt* body = stmt->while_stmt.body;
-            for (int i = 0; i < body->block_stmt.stmt_count; i++) {
-                char* body_stmt_str = stmt_to_string(body->block_stmt.statements[i]);
-                strcat(buffer, "\n    ");
-                strcat(buffer, body_stmt_str);
-                s_free(body_stmt_str);
-            }
+static size_t count_stmt(Stmt *stmt) {
+    if (!stmt) return 0;
 
-            s_free(condition_str);
-            return buffer;
-        }
+    size_t count = 1;
+    switch (stmt->type) {
+        case STMT_VAR_DECL:
+            count += count_expr(stmt->var_decl.value);
+            break;
+        case STMT_VAR_ASSIGN:
+            count += count_expr(stmt->var_assign.new_value);
+            break;
+        case STMT_GLOBAL_VAR_DECL:
+            count += count_expr(stmt->global_var_decl.value);
+            break;
+        case STMT_FUNC_DECL:
+            count += count_stmt(stmt->func_decl.body);
+            break;
+        case STMT_RETURN:
+            count += count_expr(stmt->return_stmt.value);
+            break;
+        case STMT_EXPR:
+            count += count_expr(stmt->expression_stmt.value);
+            break;
         case STMT_BLOCK:
-            snprintf(buffer, 1024, "BlockStmt()");
-            return buffer;
+            for (int i = 0; i < stmt->block_stmt.stmt_count; i++) {
+                count += count_stmt(stmt->block_stmt.statements[i]);
+            }
+            break;
+        case STMT_IF:
+            count += count_expr(stmt->if_stmt.condition) + count_stmt(stmt->if_stmt.then_branch);
+            for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
+                count += count_expr(stmt->if_stmt.else_if_conditions[i]) + count_stmt(stmt->if_stmt.else_if_branches[i]);
+            }
+            count += count_stmt(stmt->if_stmt.else_branch);
+            break;
+        case STMT_WHILE:
+            count += count_expr(stmt->while_stmt.condition) + count_stmt(stmt->while_stmt.body);
+            break;
         default:
-            snprintf(buffer, 1024, "Unknown Statement Type");
-            return buffer;
+            break;
+    }
+    return count;
+}
+
+// Every Expr and Stmt of the program
+size_t program_node_count(Program *prog) {
+    size_t count = 0;
+    for (int i = 0; i < prog->stmt_count; i++) {
+        count += count_stmt(prog->statements[i]);
     }
+    return count;
 }
 
 void free_program(Program* prog) {
     if (!prog) return;
 
-    for (int i = 0; i < prog->stmt_count; i++) {
-        Stmt* stmt = prog->statements[i];
-        if (stmt->type == STMT_EXPR && stmt->expression_stmt.value) {
-            s_free(stmt->expression_stmt.value);
-        } else if (stmt->type == STMT_RETURN && stmt->return_stmt.value) {
-            s_free(stmt->return_stmt.value);
-        } else if (stmt->type == STMT_VAR_DECL && stmt->var_decl.value) {
-            s_free(stmt->var_decl.value);
-        } else if (stmt->type == STMT_FUNC_DECL && stmt->func_decl.body) {
-            free_program(create_program(stmt->func_decl.body->block_stmt.statements, stmt->func_decl.body->block_stmt.stmt_count));
-            s_free(stmt->func_decl.parameter_names);
-            s_free(stmt->func_decl.parameter_types);
-        } else if (stmt->type == STMT_BLOCK) {
-            free_program(create_program(stmt->block_stmt.statements, stmt->block_stmt.stmt_count));
-        }
-        s_free(stmt);
-    }
-    s_free(prog->statements);
+    arena_free(&prog->arena);
     s_free(prog);
 }
 
-// Helper: write a string with C-style escapes into a buffer (returns buffer pointer)
-static char* escape_c_string(const char* s) {
-    // Allocate a buffer large enough for worst case (every char is escaped)
-    size_t len = strlen(s);
-    char* buf = s_malloc(len * 4 + 1); // plenty of space
-    char* p = buf;
-    for (; *s; ++s) {
-        switch (*s) {
-            case '\n': *p++ = '\\'; *p++ = 'n'; break;
-            case '\t': *p++ = '\\'; *p++ = 't'; break;
-            case '\r': *p++ = '\\'; *p++ = 'r'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '"': *p++ = '\\'; *p++ = '"'; break;
-            default:
-                if ((unsigned char)*s < 32 || (unsigned char)*s == 127) {
-                    sprintf(p, "\\x%02x", (unsigned char)*s);
-                    p += 4;
-                } else {
-                    *p++ = *s;
-                }
-        }
-    }
-    *p = '\0';
-    return buf;
-}
\ No newline at end of file
+// Returns a heap copy of a string with C-style escapes
+char* escape_c_string(const char* s) {
+    Writer writer;
+    writer_init_buffer(&writer);
+    write_escaped(&writer, s, strlen(s));
+    return writer_take(&writer);
+}
@@ -0,0 +1,307 @@
+#include "ast_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+#define AST_CACHE_MAGIC "PHIA"
+
+// What a cache file starts with, the node, span and extra arrays follow in that order
+typedef struct {
+    char magic[4];
+    uint32_t format;
+    char version[16];
+    uint64_t build;
+    uint64_t key;
+    uint64_t source_len;
+    uint32_t node_count;
+    uint32_t span_count;
+    uint32_t extra_count;
+    uint32_t root;
+    uint64_t checksum; // of the arrays that follow
+} AstCacheHeader;
+
+// A file in the cache directory, for eviction
+typedef struct {
+    char *path;
+    size_t size;
+    struct timespec used;
+} CacheFile;
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len);
+static uint64_t build_identity(void);
+static struct timespec modified_time(const struct stat *st);
+static int miss(AstCache *cache, void *map, size_t len);
+static void fill_header(AstCache *cache, FlatAst *ast, AstCacheHeader *header);
+static int evict(AstCache *cache);
+static int compare_cache_files(const void *a, const void *b);
+
+/**
+ * Works out where the cache entry of a source lives, nothing is read or written yet.
+ * @param cache Filled in, release it with ast_cache_free.
+ * @param dir The cache directory, it is created on the first store.
+ * @param limit The most bytes the directory may hold, 0 uses AST_CACHE_DEFAULT_LIMIT.
+ * @param source The loaded source, it has to outlive the cache and every AST loaded from it.
+ */
+void ast_cache_init(AstCache *cache, const char *dir, size_t limit, Source *source) {
+    memset(cache, 0, sizeof(AstCache));
+    cache->dir = dir;
+    cache->limit = limit ? limit : AST_CACHE_DEFAULT_LIMIT;
+    cache->source = source;
+
+    cache->build = build_identity();
+    uint64_t key = hash_bytes(14695981039346656037ULL, PHI_VERSION, strlen(PHI_VERSION));
+    uint32_t format = AST_CACHE_FORMAT;
+    key = hash_bytes(key, &format, sizeof(format));
+    key = hash_bytes(key, &cache->build, sizeof(cache->build));
+    cache->key = hash_bytes(key, source->text, source->len);
+
+    size_t size = strlen(dir) + 32;
+    cache->path = (char *)s_malloc(size);
+    snprintf(cache->path, size, "%s/%016llx.ast", dir, (unsigned long long)cache->key);
+}
+
+/**
+ * Maps the cache entry of the source if there is a usable one.
+ * The arrays of ast point into the mapping, so it must not be passed to free_flat_ast
+ * and is only valid until ast_cache_free.
+ * An entry that is there but does not check out (written for something else, cut short or damaged) is a miss
+ * and is removed.
+ * @return 1 on a hit, 0 on a miss.
+ */
+int ast_cache_load(AstCache *cache, FlatAst *ast) {
+    int fd = open(cache->path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size < sizeof(AstCacheHeader)) {
+        close(fd);
+        return miss(cache, NULL, 0);
+    }
+
+    size_t len = (size_t)st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    // touching the entry makes it the most recently used one for eviction
+    if (map != MAP_FAILED) futimens(fd, NULL);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    // the header has to match exactly what a store of this source would write
+    AstCacheHeader expected;
+    FlatAst empty = {0};
+    fill_header(cache, &empty, &expected);
+
+    const AstCacheHeader *header = (const AstCacheHeader *)map;
+    size_t data_len = (size_t)header->node_count * sizeof(FlatNode) + (size_t)header->span_count * sizeof(FlatSpan) +
+                      (size_t)header->extra_count * sizeof(uint32_t);
+    if (memcmp(header, &expected, offsetof(AstCacheHeader, node_count)) != 0 || sizeof(AstCacheHeader) + data_len != len ||
+        header->root >= header->node_count) {
+        return miss(cache, map, len);
+    }
+
+    // damage that keeps every index in bounds, like a flipped operator, is caught here
+    const char *data = (const char *)map + sizeof(AstCacheHeader);
+    if (hash_bytes(14695981039346656037ULL, data, data_len) != header->checksum) {
+        return miss(cache, map, len);
+    }
+
+    memset(ast, 0, sizeof(FlatAst));
+    ast->source = cache->source->text;
+    ast->nodes = (FlatNode *)data;
+    ast->node_count = header->node_count;
+    ast->spans = (FlatSpan *)(data + header->node_count * sizeof(FlatNode));
+    ast->span_count = header->span_count;
+    ast->extra = (uint32_t *)(data + header->node_count * sizeof(FlatNode) + header->span_count * sizeof(FlatSpan));
+    ast->extra_count = header->extra_count;
+    ast->root = header->root;
+
+    // the entry is trusted no further than its header, every index in it is checked before anything follows one
+    if (!flat_ast_check(ast, cache->source->len)) {
+        memset(ast, 0, sizeof(FlatAst));
+        return miss(cache, map, len);
+    }
+
+    cache->map = map;
+    cache->map_len = len;
+    return 1;
+}
+
+/**
+ * Writes the flat AST of the source as its cache entry, then evicts the least recently used
+ * entries until the directory is under its limit again.
+ * The entry is written to a temporary file and renamed into place, so readers never see half of one.
+ * @return How many entries were evicted, or -1 if the entry could not be written (after printing why).
+ */
+int ast_cache_store(AstCache *cache, FlatAst *ast) {
+    if (mkdir(cache->dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Warning: could not create cache directory %s: %s\n", cache->dir, strerror(errno));
+        return -1;
+    }
+
+    size_t tmp_size = strlen(cache->path) + 32;
+    char *tmp_path = (char *)s_malloc(tmp_size);
+    snprintf(tmp_path, tmp_size, "%s.%ld.tmp", cache->path, (long)getpid());
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Warning: could not write cache entry %s: %s\n", tmp_path, strerror(errno));
+        s_free(tmp_path);
+        return -1;
+    }
+
+    AstCacheHeader header;
+    fill_header(cache, ast, &header);
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok &= fwrite(ast->nodes, sizeof(FlatNode), ast->node_count, file) == ast->node_count;
+    ok &= fwrite(ast->spans, sizeof(FlatSpan), ast->span_count, file) == ast->span_count;
+    ok &= fwrite(ast->extra, sizeof(uint32_t), ast->extra_count, file) == ast->extra_count;
+    ok &= fclose(file) == 0;
+
+    if (!ok || rename(tmp_path, cache->path) != 0) {
+        fprintf(stderr, "Warning: could not write cache entry %s: %s\n", cache->path, strerror(errno));
+        unlink(tmp_path);
+        s_free(tmp_path);
+        return -1;
+    }
+    s_free(tmp_path);
+
+    return evict(cache);
+}
+
+void ast_cache_free(AstCache *cache) {
+    if (cache->map) munmap(cache->map, cache->map_len);
+    s_free(cache->path);
+    memset(cache, 0, sizeof(AstCache));
+}
+
+// FNV-1a style hash that takes 8 bytes per step, start with the offset basis and feed every part of the key through it
+// Byte at a time FNV-1a was a noticeable part of a cache hit on large sources
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Drops an entry that cannot be used, the next store writes a good one in its place
+static int miss(AstCache *cache, void *map, size_t len) {
+    if (map) munmap(map, len);
+    unlink(cache->path);
+    return 0;
+}
+
+/**
+ * Identifies the build of the running compiler.
+ * This is PHI_BUILD_ID, which the Makefile derives from the sources the compiler was built from, mixed with the
+ * layout of the flat AST.
+ * @return A hash that is the same for every run of one build of the compiler.
+ */
+static uint64_t build_identity(void) {
+    uint32_t layout[] = {sizeof(AstCacheHeader), sizeof(FlatNode), sizeof(FlatSpan), sizeof(FlatRef)};
+    uint64_t hash = hash_bytes(14695981039346656037ULL, layout, sizeof(layout));
+    return hash_bytes(hash, PHI_BUILD_ID, strlen(PHI_BUILD_ID));
+}
+
+// The stat field is named differently on Darwin
+static struct timespec modified_time(const struct stat *st) {
+#ifdef __APPLE__
+    return st->st_mtimespec;
+#else
+    return st->st_mtim;
+#endif
+}
+
+static void fill_header(AstCache *cache, FlatAst *ast, AstCacheHeader *header) {
+    // zeroed first so the padding of version compares equal too
+    memset(header, 0, sizeof(AstCacheHeader));
+    memcpy(header->magic, AST_CACHE_MAGIC, sizeof(header->magic));
+    header->format = AST_CACHE_FORMAT;
+    strncpy(header->version, PHI_VERSION, sizeof(header->version) - 1);
+    header->build = cache->build;
+    header->key = cache->key;
+    header->source_len = cache->source->len;
+    header->node_count = ast->node_count;
+    header->span_count = ast->span_count;
+    header->extra_count = ast->extra_count;
+    header->root = ast->root;
+    // nodes and spans are whole 8 byte words, so this hashes the same as the arrays back to back in the file
+    uint64_t checksum = hash_bytes(14695981039346656037ULL, ast->nodes, ast->node_count * sizeof(FlatNode));
+    checksum = hash_bytes(checksum, ast->spans, ast->span_count * sizeof(FlatSpan));
+    header->checksum = hash_bytes(checksum, ast->extra, ast->extra_count * sizeof(uint32_t));
+}
+
+// Removes the least recently used entries until the directory fits in the limit, the newest one always stays
+static int evict(AstCache *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (!dir) return 0;
+
+    int count = 0;
+    int capacity = 16;
+    CacheFile *files = (CacheFile *)s_malloc(capacity * sizeof(CacheFile));
+    size_t total = 0;
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        size_t name_len = strlen(dirent->d_name);
+        if (name_len < 4 || strcmp(dirent->d_name + name_len - 4, ".ast") != 0) continue;
+
+        size_t path_size = strlen(cache->dir) + name_len + 2;
+        char *path = (char *)s_malloc(path_size);
+        snprintf(path, path_size, "%s/%s", cache->dir, dirent->d_name);
+
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            s_free(path);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            files = (CacheFile *)s_realloc(files, capacity * sizeof(CacheFile));
+        }
+        files[count++] = (CacheFile){.path = path, .size = (size_t)st.st_size, .used = modified_time(&st)};
+        total += (size_t)st.st_size;
+    }
+    closedir(dir);
+
+    // oldest first, a hit refreshes the modification time so this is least recently used order
+    qsort(files, count, sizeof(CacheFile), compare_cache_files);
+
+    int evicted = 0;
+    for (int i = 0; i < count; i++) {
+        if (total > cache->limit && strcmp(files[i].path, cache->path) != 0 && unlink(files[i].path) == 0) {
+            total -= files[i].size;
+            evicted++;
+        }
+        s_free(files[i].path);
+    }
+    s_free(files);
+    return evicted;
+}
+
+static int compare_cache_files(const void *a, const void *b) {
+    const struct timespec *x = &((const CacheFile *)a)->used;
+    const struct timespec *y = &((const CacheFile *)b)->used;
+    if (x->tv_sec != y->tv_sec) return (x->tv_sec > y->tv_sec) - (x->tv_sec < y->tv_sec);
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
@@ -0,0 +1,470 @@
+#include "ast_opt.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Called on every expression after its operands were rewritten, returns what should take its place
+typedef Expr *(*ExprRewrite)(Arena *arena, Expr *expr);
+
+// Statements of a block being rebuilt by a statement pass
+typedef struct {
+    Stmt **items;
+    int count;
+    int capacity;
+} StmtList;
+
+static void fold_constants(Program *prog);
+static void simplify_algebra(Program *prog);
+static void prune_branches(Program *prog);
+static void remove_unreachable(Program *prog);
+
+const AstPass ast_passes[] = {
+    {"constant-folding", fold_constants},
+    {"algebraic-simplification", simplify_algebra},
+    {"dead-branch-elimination", prune_branches},
+    {"unreachable-code", remove_unreachable},
+};
+const int ast_pass_count = sizeof(ast_passes) / sizeof(ast_passes[0]);
+
+static Expr *rewrite_expr(Arena *arena, Expr *expr, ExprRewrite rewrite);
+static void rewrite_stmt(Arena *arena, Stmt *stmt, ExprRewrite rewrite);
+static void rewrite_program(Program *prog, ExprRewrite rewrite);
+static Expr *fold_expr(Arena *arena, Expr *expr);
+static Expr *simplify_expr(Arena *arena, Expr *expr);
+static Expr *make_int(Arena *arena, int32_t value);
+static int is_int(Expr *expr, int32_t value);
+static int has_side_effects(Expr *expr);
+static int constant_condition(Expr *expr, int *value);
+
+static void push_stmt(Arena *arena, StmtList *list, Stmt *stmt);
+static void splice_block(Arena *arena, StmtList *list, Stmt *block);
+static void prune_block(Arena *arena, Stmt *block);
+static int has_constant_condition(Stmt *stmt);
+static void prune_nested(Arena *arena, Stmt *stmt);
+static void prune_stmt(Arena *arena, StmtList *list, Stmt *stmt);
+static int cut_after_return(Stmt *block);
+
+/**
+ * Runs every pass in ast_passes over the program once, in order.
+ * @param prog The program, it is changed in place.
+ * @param results If not NULL, gets ast_pass_count entries with what each pass removed.
+ * @return How many nodes were removed in total.
+ */
+size_t optimize_ast(Program *prog, AstPassResult *results) {
+    size_t total = 0;
+    size_t before = program_node_count(prog);
+    for (int i = 0; i < ast_pass_count; i++) {
+        ast_passes[i].run(prog);
+
+        size_t after = program_node_count(prog);
+        if (results) {
+            results[i].name = ast_passes[i].name;
+            results[i].removed = before - after;
+        }
+        total += before - after;
+        before = after;
+    }
+    return total;
+}
+
+// Expression passes
+
+// Replaces binary and unary expressions whose operands are literals with the literal they evaluate to
+static void fold_constants(Program *prog) { rewrite_program(prog, fold_expr); }
+
+// Drops operations that cannot change the value: x * 1, x / 1, x + 0, x - 0, and x * 0 when x has no side effects
+static void simplify_algebra(Program *prog) { rewrite_program(prog, simplify_expr); }
+
+// Rewrites every expression of the program bottom up
+static void rewrite_program(Program *prog, ExprRewrite rewrite) {
+    for (int i = 0; i < prog->stmt_count; i++) {
+        rewrite_stmt(&prog->arena, prog->statements[i], rewrite);
+    }
+}
+
+static Expr *rewrite_expr(Arena *arena, Expr *expr, ExprRewrite rewrite) {
+    if (!expr) return NULL;
+
+    switch (expr->type) {
+        case EXPR_BINARY:
+            expr->binary.left = rewrite_expr(arena, expr->binary.left, rewrite);
+            expr->binary.right = rewrite_expr(arena, expr->binary.right, rewrite);
+            break;
+        case EXPR_UNARY:
+            expr->unary.right = rewrite_expr(arena, expr->unary.right, rewrite);
+            break;
+        case EXPR_FUNC_CALL:
+            for (int i = 0; i < expr->func_call.arg_count; i++) {
+                expr->func_call.args[i] = rewrite_expr(arena, expr->func_call.args[i], rewrite);
+            }
+            break;
+        default:
+            break;
+    }
+    return rewrite(arena, expr);
+}
+
+static void rewrite_stmt(Arena *arena, Stmt *stmt, ExprRewrite rewrite) {
+    if (!stmt) return;
+
+    switch (stmt->type) {
+        case STMT_VAR_DECL:
+            stmt->var_decl.value = rewrite_expr(arena, stmt->var_decl.value, rewrite);
+            break;
+        case STMT_GLOBAL_VAR_DECL:
+            stmt->global_var_decl.value = rewrite_expr(arena, stmt->global_var_decl.value, rewrite);
+            break;
+        case STMT_VAR_ASSIGN:
+            stmt->var_assign.new_value = rewrite_expr(arena, stmt->var_assign.new_value, rewrite);
+            break;
+        case STMT_FUNC_DECL:
+            // a body skipped by lazy parsing is NULL and is left alone
+            rewrite_stmt(arena, stmt->func_decl.body, rewrite);
+            break;
+        case STMT_RETURN:
+            stmt->return_stmt.value = rewrite_expr(arena, stmt->return_stmt.value, rewrite);
+            break;
+        case STMT_EXPR:
+            stmt->expression_stmt.value = rewrite_expr(arena, stmt->expression_stmt.value, rewrite);
+            break;
+        case STMT_BLOCK:
+            for (int i = 0; i < stmt->block_stmt.stmt_count; i++) {
+                rewrite_stmt(arena, stmt->block_stmt.statements[i], rewrite);
+            }
+            break;
+        case STMT_IF:
+            stmt->if_stmt.condition = rewrite_expr(arena, stmt->if_stmt.condition, rewrite);
+            rewrite_stmt(arena, stmt->if_stmt.then_branch, rewrite);
+            for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
+                stmt->if_stmt.else_if_conditions[i] = rewrite_expr(arena, stmt->if_stmt.else_if_conditions[i], rewrite);
+                rewrite_stmt(arena, stmt->if_stmt.else_if_branches[i], rewrite);
+            }
+            rewrite_stmt(arena, stmt->if_stmt.else_branch, rewrite);
+            break;
+        case STMT_WHILE:
+            stmt->while_stmt.condition = rewrite_expr(arena, stmt->while_stmt.condition, rewrite);
+            rewrite_stmt(arena, stmt->while_stmt.body, rewrite);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Folds one expression whose operands are already folded.
+ * Integer arithmetic wraps around like the i32 instructions codegen would emit, and anything
+ * that would trap or is undefined at run time (division by zero, INT_MIN / -1) is left for codegen.
+ * Comparisons give bool literals, the same i1 type codegen gives them.
+ */
+static Expr *fold_expr(Arena *arena, Expr *expr) {
+    if (expr->type == EXPR_UNARY) {
+        Expr *operand = expr->unary.right;
+        if (expr->unary.op_token.type == tok_minus && operand->type == EXPR_LITERAL_INT) {
+            return make_int(arena, (int32_t)(0u - (uint32_t)operand->int_literal.tok.int_val));
+        }
+        if (expr->unary.op_token.type == tok_not && operand->type == EXPR_LITERAL_BOOL) {
+            return bool_literal(arena, !operand->bool_literal.value);
+        }
+        return expr;
+    }
+
+    if (expr->type != EXPR_BINARY) return expr;
+
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    Token op = expr->binary.op_token.type;
+
+    if (left->type == EXPR_LITERAL_BOOL && right->type == EXPR_LITERAL_BOOL) {
+        if (op == tok_equality) return bool_literal(arena, left->bool_literal.value == right->bool_literal.value);
+        if (op == tok_inequality) return bool_literal(arena, left->bool_literal.value != right->bool_literal.value);
+        return expr;
+    }
+
+    if (left->type != EXPR_LITERAL_INT || right->type != EXPR_LITERAL_INT) return expr;
+
+    int32_t a = left->int_literal.tok.int_val;
+    int32_t b = right->int_literal.tok.int_val;
+    switch (op) {
+        case tok_plus:
+            return make_int(arena, (int32_t)((uint32_t)a + (uint32_t)b));
+        case tok_minus:
+            return make_int(arena, (int32_t)((uint32_t)a - (uint32_t)b));
+        case tok_star:
+            return make_int(arena, (int32_t)((uint32_t)a * (uint32_t)b));
+        case tok_slash:
+            if (b == 0 || (a == INT32_MIN && b == -1)) return expr;
+            return make_int(arena, a / b);
+        case tok_mod:
+            if (b == 0 || (a == INT32_MIN && b == -1)) return expr;
+            return make_int(arena, a % b);
+        case tok_equality:
+            return bool_literal(arena, a == b);
+        case tok_inequality:
+            return bool_literal(arena, a != b);
+        case tok_lessthan:
+            return bool_literal(arena, a < b);
+        case tok_greaterthan:
+            return bool_literal(arena, a > b);
+        case tok_lessthan_equal:
+            return bool_literal(arena, a <= b);
+        case tok_greaterthan_equal:
+            return bool_literal(arena, a >= b);
+        default:
+            return expr;
+    }
+}
+
+static Expr *simplify_expr(Arena *arena, Expr *expr) {
+    if (expr->type != EXPR_BINARY) return expr;
+
+    Expr *left = expr->binary.left;
+    Expr *right = expr->binary.right;
+    switch (expr->binary.op_token.type) {
+        case tok_plus:
+            if (is_int(right, 0)) return left;
+            if (is_int(left, 0)) return right;
+            return expr;
+        case tok_minus:
+            if (is_int(right, 0)) return left;
+            return expr;
+        case tok_star:
+            if (is_int(right, 1)) return left;
+            if (is_int(left, 1)) return right;
+            // the other operand still has to run if it calls something or changes a variable
+            if ((is_int(right, 0) && !has_side_effects(left)) || (is_int(left, 0) && !has_side_effects(right))) {
+                return make_int(arena, 0);
+            }
+            return expr;
+        case tok_slash:
+            if (is_int(right, 1)) return left;
+            return expr;
+        default:
+            return expr;
+    }
+}
+
+// An int literal made up by a pass, its text is the decimal value so it prints like a parsed one
+static Expr *make_int(Arena *arena, int32_t value) {
+    char *text = (char *)arena_alloc(arena, 12);
+    int len = snprintf(text, 12, "%d", value);
+
+    TokenData tok = {
+        .type = tok_number,
+        .int_val = value,
+        .start = text,
+        .len = (size_t)len,
+    };
+    return int_literal(arena, tok);
+}
+
+static int is_int(Expr *expr, int32_t value) {
+    return expr->type == EXPR_LITERAL_INT && expr->int_literal.tok.int_val == value;
+}
+
+static int has_side_effects(Expr *expr) {
+    if (!expr) return 0;
+
+    switch (expr->type) {
+        case EXPR_FUNC_CALL:
+        case EXPR_INCREMENT:
+            return 1;
+        case EXPR_BINARY:
+            return has_side_effects(expr->binary.left) || has_side_effects(expr->binary.right);
+        case EXPR_UNARY:
+            return has_side_effects(expr->unary.right);
+        default:
+            return 0;
+    }
+}
+
+// Statement passes
+
+// Drops if arms and while loops whose condition is a constant false, and replaces an arm whose
+// condition is a constant true with its statements
+static void prune_branches(Program *prog) {
+    for (int i = 0; i < prog->stmt_count; i++) {
+        Stmt *stmt = prog->statements[i];
+        if (stmt->type == STMT_FUNC_DECL && stmt->func_decl.body) {
+            prune_block(&prog->arena, stmt->func_decl.body);
+        }
+    }
+}
+
+// Drops the statements of a block that follow a return, they can never run
+static void remove_unreachable(Program *prog) {
+    for (int i = 0; i < prog->stmt_count; i++) {
+        Stmt *stmt = prog->statements[i];
+        if (stmt->type == STMT_FUNC_DECL && stmt->func_decl.body) {
+            cut_after_return(stmt->func_decl.body);
+        }
+    }
+}
+
+// The value of a condition that is a literal, codegen treats any nonzero int as true
+static int constant_condition(Expr *expr, int *value) {
+    if (expr->type == EXPR_LITERAL_BOOL) {
+        *value = expr->bool_literal.value;
+        return 1;
+    }
+    if (expr->type == EXPR_LITERAL_INT) {
+        *value = expr->int_literal.tok.int_val != 0;
+        return 1;
+    }
+    return 0;
+}
+
+static void push_stmt(Arena *arena, StmtList *list, Stmt *stmt) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 8;
+        list->items = (Stmt **)arena_grow(arena, list->items, list->capacity * sizeof(Stmt *), capacity * sizeof(Stmt *));
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = stmt;
+}
+
+// The statements of a branch move into the enclosing block, unless the branch declares a variable
+// Codegen scopes variables by block, so such a branch stays a block of its own
+static void splice_block(Arena *arena, StmtList *list, Stmt *block) {
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        if (block->block_stmt.statements[i]->type == STMT_VAR_DECL) {
+            push_stmt(arena, list, block);
+            return;
+        }
+    }
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        push_stmt(arena, list, block->block_stmt.statements[i]);
+    }
+}
+
+static void prune_block(Arena *arena, Stmt *block) {
+    int prunable = 0;
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        prune_nested(arena, block->block_stmt.statements[i]);
+        prunable |= has_constant_condition(block->block_stmt.statements[i]);
+    }
+    // most blocks have nothing to prune, their statement array is left as it is
+    if (!prunable) return;
+
+    StmtList list = {0};
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        prune_stmt(arena, &list, block->block_stmt.statements[i]);
+    }
+    block->block_stmt.statements = list.items;
+    block->block_stmt.stmt_count = list.count;
+}
+
+// Whether prune_stmt would change the statement
+static int has_constant_condition(Stmt *stmt) {
+    int value;
+    if (stmt->type == STMT_WHILE) {
+        return constant_condition(stmt->while_stmt.condition, &value) && !value;
+    }
+    if (stmt->type != STMT_IF) return 0;
+
+    if (constant_condition(stmt->if_stmt.condition, &value)) return 1;
+    for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
+        if (constant_condition(stmt->if_stmt.else_if_conditions[i], &value)) return 1;
+    }
+    return 0;
+}
+
+// Prunes the blocks inside a statement
+static void prune_nested(Arena *arena, Stmt *stmt) {
+    switch (stmt->type) {
+        case STMT_IF:
+            prune_block(arena, stmt->if_stmt.then_branch);
+            for (int i = 0; i < stmt->if_stmt.else_if_count; i++) {
+                prune_block(arena, stmt->if_stmt.else_if_branches[i]);
+            }
+            if (stmt->if_stmt.else_branch) prune_block(arena, stmt->if_stmt.else_branch);
+            break;
+        case STMT_WHILE:
+            prune_block(arena, stmt->while_stmt.body);
+            break;
+        case STMT_BLOCK:
+            prune_block(arena, stmt);
+            break;
+        default:
+            break;
+    }
+}
+
+// Appends what stmt turns into to list: itself, the statements of the arm that always runs, or nothing
+static void prune_stmt(Arena *arena, StmtList *list, Stmt *stmt) {
+    int value;
+    if (stmt->type == STMT_WHILE) {
+        if (!constant_condition(stmt->while_stmt.condition, &value) || value) push_stmt(arena, list, stmt);
+        return;
+    }
+    if (stmt->type != STMT_IF) {
+        push_stmt(arena, list, stmt);
+        return;
+    }
+
+    // walk the arms in order, keeping the ones that might run, an arm that always runs ends the chain as the else
+    IfStmt *if_stmt = &stmt->if_stmt;
+    int arm_count = 0;
+    Expr *first_condition = NULL;
+    Stmt *first_branch = NULL;
+    Stmt *else_branch = if_stmt->else_branch;
+    for (int i = -1; i < if_stmt->else_if_count; i++) {
+        Expr *condition = i < 0 ? if_stmt->condition : if_stmt->else_if_conditions[i];
+        Stmt *branch = i < 0 ? if_stmt->then_branch : if_stmt->else_if_branches[i];
+
+        if (constant_condition(condition, &value)) {
+            if (!value) continue;
+            else_branch = branch;
+            break;
+        }
+
+        // kept arms are compacted to the front of the else-if arrays, behind the first one
+        if (arm_count == 0) {
+            first_condition = condition;
+            first_branch = branch;
+        } else {
+            if_stmt->else_if_conditions[arm_count - 1] = condition;
+            if_stmt->else_if_branches[arm_count - 1] = branch;
+        }
+        arm_count++;
+    }
+
+    if (arm_count == 0) {
+        if (else_branch) splice_block(arena, list, else_branch);
+        return;
+    }
+
+    if_stmt->condition = first_condition;
+    if_stmt->then_branch = first_branch;
+    if_stmt->else_if_count = arm_count - 1;
+    if_stmt->else_branch = else_branch;
+    push_stmt(arena, list, stmt);
+}
+
+// Returns whether the block always reaches a return
+static int cut_after_return(Stmt *block) {
+    for (int i = 0; i < block->block_stmt.stmt_count; i++) {
+        Stmt *stmt = block->block_stmt.statements[i];
+        // a nested block is a branch pruning kept, its return ends this block too
+        if (stmt->type == STMT_RETURN || (stmt->type == STMT_BLOCK && cut_after_return(stmt))) {
+            block->block_stmt.stmt_count = i + 1;
+            return 1;
+        }
+
+        switch (stmt->type) {
+            case STMT_IF:
+                cut_after_return(stmt->if_stmt.then_branch);
+                for (int j = 0; j < stmt->if_stmt.else_if_count; j++) {
+                    cut_after_return(stmt->if_stmt.else_if_branches[j]);
+                }
+                if (stmt->if_stmt.else_branch) cut_after_return(stmt->if_stmt.else_branch);
+                break;
+            case STMT_WHILE:
+                cut_after_return(stmt->while_stmt.body);
+                break;
+            default:
+                break;
+        }
+    }
+    return 0;
+}
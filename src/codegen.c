@@ -4,81 +4,218 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <llvm-c/BitReader.h>
+#include <llvm-c/Linker.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+#include "ast_opt.h"
 #include "memory.h"
+#include "parser.h"
 #include "std_lib.h"
 
-// helper: simple dynamic symbol table
-static void ensure_var_capacity(CodeGen* this) {
-    if (this->var_capacity == 0) {
-        this->var_capacity = 8;
-        this->var_names = s_malloc(sizeof(char*) * this->var_capacity);
-        this->var_allocas = s_malloc(sizeof(LLVMValueRef) * this->var_capacity);
-    } else if (this->var_count >= this->var_capacity) {
-        int newcap = this->var_capacity * 2;
-        this->var_names = s_realloc(this->var_names, sizeof(char*) * newcap);
-        this->var_allocas = s_realloc(this->var_allocas, sizeof(LLVMValueRef) * newcap);
-        this->var_capacity = newcap;
+// Tokens point into the source and are not null-terminated, LLVM wants C strings
+// The returned pointer is only valid until the next call
+static const char* token_cstr(CodeGen* this, TokenData tok) {
+    if (tok.len + 1 > this->name_buf_capacity) {
+        this->name_buf_capacity = tok.len + 1 < 64 ? 64 : tok.len + 1;
+        this->name_buf = s_realloc(this->name_buf, this->name_buf_capacity);
+    }
+    memcpy(this->name_buf, tok.start, tok.len);
+    this->name_buf[tok.len] = '\0';
+    return this->name_buf;
+}
+
+// Declare a local variable in the innermost scope, it holds value from the current block on
+static void codegen_set_var(CodeGen* this, TokenData name, LLVMValueRef value) {
+    LLVMTypeRef type = LLVMTypeOf(value);
+    int variable = ssa_add_variable(&this->ssa, type, name.start, name.len);
+    ssa_write(&this->ssa, variable, this->current_block, value);
+    symbol_define(&this->symbols, (Symbol){
+        .name = name.start,
+        .len = name.len,
+        .kind = SYMBOL_LOCAL,
+        .type = type,
+        .variable = variable,
+    });
+}
+
+// The current value of a variable, locals are SSA values and only globals live in memory
+static LLVMValueRef codegen_load_var(CodeGen* this, Symbol* var, const char* name) {
+    if (var->kind == SYMBOL_LOCAL) return ssa_read(&this->ssa, var->variable, this->current_block);
+    return LLVMBuildLoad2(this->builder, var->type, var->value, name);
+}
+
+static void codegen_store_var(CodeGen* this, Symbol* var, LLVMValueRef value) {
+    if (var->kind == SYMBOL_LOCAL) {
+        ssa_write(&this->ssa, var->variable, this->current_block, value);
+    } else {
+        LLVMBuildStore(this->builder, value, var->value);
     }
 }
 
-// Set variable in symbol table
-static void codegen_set_var(CodeGen* this, const char* name, LLVMValueRef alloc) {
-    ensure_var_capacity(this);
-    this->var_names[this->var_count] = strdup(name);
-    this->var_allocas[this->var_count] = alloc;
-    this->var_count++;
+// Continue generating code at the end of a block
+static void codegen_enter_block(CodeGen* this, int block) {
+    LLVMPositionBuilderAtEnd(this->builder, ssa_block(&this->ssa, block));
+    this->current_block = block;
 }
 
-// Get variable from symbol table
-static LLVMValueRef codegen_get_var(CodeGen* this, const char* name) {
-    for (int i = 0; i < this->var_count; ++i) {
-        if (!strcmp(this->var_names[i], name)) return this->var_allocas[i];
+// Branch from the current block to target, unless the block already ended with a return
+static void codegen_branch(CodeGen* this, int target) {
+    if (LLVMGetBasicBlockTerminator(ssa_block(&this->ssa, this->current_block))) return;
+    LLVMBuildBr(this->builder, ssa_block(&this->ssa, target));
+    ssa_add_predecessor(&this->ssa, target, this->current_block);
+}
+
+static void codegen_cond_branch(CodeGen* this, LLVMValueRef cond, int then_block, int else_block) {
+    LLVMBuildCondBr(this->builder, cond, ssa_block(&this->ssa, then_block), ssa_block(&this->ssa, else_block));
+    ssa_add_predecessor(&this->ssa, then_block, this->current_block);
+    ssa_add_predecessor(&this->ssa, else_block, this->current_block);
+}
+
+// Find a local or global variable, a global is cached the first time it is used
+// NULL if there is no such variable, the symbol is only valid until the next one is defined
+static Symbol* codegen_get_var(CodeGen* this, TokenData name) {
+    Symbol* symbol = symbol_lookup(&this->symbols, name.start, name.len, 0);
+    if (symbol) return symbol;
+
+    LLVMValueRef global_var = LLVMGetNamedGlobal(this->module, token_cstr(this, name));
+    if (!global_var) return NULL;
+    return symbol_define(&this->symbols, (Symbol){
+        .name = name.start,
+        .len = name.len,
+        .kind = SYMBOL_GLOBAL,
+        .value = global_var,
+        .type = LLVMGlobalGetValueType(global_var),
+    });
+}
+
+// Find a builtin or a function of the module, cached the first time it is called
+// Builtins come first, so a program cannot replace them
+static Symbol* codegen_get_function(CodeGen* this, TokenData name) {
+    Symbol* symbol = symbol_lookup(&this->symbols, name.start, name.len, 1);
+    if (symbol) return symbol;
+
+    for (int i = 0; stdlib_functions[i] != NULL; i++) {
+        if (token_equals(name, stdlib_functions[i])) {
+            return symbol_define(&this->symbols, (Symbol){
+                .name = name.start,
+                .len = name.len,
+                .kind = SYMBOL_BUILTIN,
+                .builtin = stdlib_functions[i],
+            });
+        }
     }
-    return NULL;
+
+    LLVMValueRef func = LLVMGetNamedFunction(this->module, token_cstr(this, name));
+    if (!func) return NULL;
+    return symbol_define(&this->symbols, (Symbol){
+        .name = name.start,
+        .len = name.len,
+        .kind = SYMBOL_FUNCTION,
+        .value = func,
+        .type = LLVMGlobalGetValueType(func),
+    });
 }
 
-CodeGen* init_codegen(const char* module_name) {
+// A target machine for the host, or for the CPU and features asked for
+// Exits if there is none, a target machine must only be used by one thread at a time
+LLVMTargetMachineRef create_target_machine(const TargetOptions* target) {
+    char* triple = LLVMGetDefaultTargetTriple();
+    LLVMTargetRef llvm_target;
+    char* error = NULL;
+    if (LLVMGetTargetFromTriple(triple, &llvm_target, &error) != 0) {
+        fprintf(stderr, "Failed to find a target for %s: %s\n", triple, error);
+        LLVMDisposeMessage(error);
+        exit(1);
+    }
+
+    // an explicit CPU brings its own features, the host's would claim what that CPU may not have
+    char* host_cpu = target->cpu ? NULL : LLVMGetHostCPUName();
+    char* host_features = target->cpu || target->features ? NULL : LLVMGetHostCPUFeatures();
+    const char* cpu = target->cpu ? target->cpu : host_cpu;
+    const char* features = target->features ? target->features : host_features ? host_features : "";
+
+    LLVMCodeGenOptLevel levels[] = {LLVMCodeGenLevelNone, LLVMCodeGenLevelLess, LLVMCodeGenLevelDefault,
+                                    LLVMCodeGenLevelAggressive};
+    int level = target->opt_level < 0 ? 0 : target->opt_level > 3 ? 3 : target->opt_level;
+    LLVMTargetMachineRef machine = LLVMCreateTargetMachine(llvm_target, triple, cpu, features, levels[level],
+                                                           LLVMRelocPIC, LLVMCodeModelDefault);
+
+    LLVMDisposeMessage(triple);
+    if (host_cpu) LLVMDisposeMessage(host_cpu);
+    if (host_features) LLVMDisposeMessage(host_features);
+    if (!machine) {
+        fprintf(stderr, "Failed to create a target machine for %s\n", cpu);
+        exit(1);
+    }
+    return machine;
+}
+
+/**
+ * Creates the context, module and builder code is generated with.
+ * @param target The CPU to generate code for, NULL for the host at the default level.
+ * The module gets the target's triple and data layout, and every function its CPU and features.
+ */
+CodeGen* init_codegen(const char* module_name, const TargetOptions* target) {
     CodeGen* codegen = s_malloc(sizeof(CodeGen));
 
     // Initialize symbol table fields
-    codegen->var_names = NULL;
-    codegen->var_allocas = NULL;
-    codegen->var_count = 0;
-    codegen->var_capacity = 0;
+    symbol_table_init(&codegen->symbols);
+    codegen->name_buf = NULL;
+    codegen->name_buf_capacity = 0;
+    codegen->lazy_funcs = NULL;
+    codegen->lazy_func_count = 0;
+    codegen->pending = NULL;
+    codegen->pending_count = 0;
 
     // Initialize LLVM
     LLVMInitializeNativeTarget();
     LLVMInitializeNativeAsmPrinter();
     LLVMInitializeNativeAsmParser();
 
+    TargetOptions host = {.opt_level = 2};
+    if (!target) target = &host;
+    codegen->target_machine = create_target_machine(target);
+    codegen->target = *target;
+
     // Create context, module, and builder
     codegen->context = LLVMContextCreate();
     codegen->module = LLVMModuleCreateWithNameInContext(module_name, codegen->context);
-    codegen->builder = LLVMCreateBuilderInContext(codegen->context);
 
-    // Create execution engine
-    char* error = NULL;
-    if (LLVMCreateExecutionEngineForModule(&codegen->engine, codegen->module, &error) != 0) {
-        fprintf(stderr, "Failed to create execution engine: %s\n", error);
-        LLVMDisposeMessage(error);
-        exit(1);
-    }
+    // Stamp the module with the target, so the optimizer knows type sizes and what the CPU can do
+    char* triple = LLVMGetTargetMachineTriple(codegen->target_machine);
+    LLVMSetTarget(codegen->module, triple);
+    LLVMDisposeMessage(triple);
+    LLVMTargetDataRef data_layout = LLVMCreateTargetDataLayout(codegen->target_machine);
+    LLVMSetModuleDataLayout(codegen->module, data_layout);
+    LLVMDisposeTargetData(data_layout);
+
+    char* cpu = LLVMGetTargetMachineCPU(codegen->target_machine);
+    char* features = LLVMGetTargetMachineFeatureString(codegen->target_machine);
+    codegen->target_cpu = LLVMCreateStringAttribute(codegen->context, "target-cpu", 10, cpu, strlen(cpu));
+    codegen->target_features = *features ? LLVMCreateStringAttribute(codegen->context, "target-features", 15,
+                                                                     features, strlen(features))
+                                         : NULL;
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(features);
+    codegen->builder = LLVMCreateBuilderInContext(codegen->context);
+    ssa_init(&codegen->ssa, codegen->context);
+    codegen->current_block = 0;
 
     return codegen;
 }
 
 void cleanup_codegen(CodeGen* this) {
     if (this) {
-        if (this->var_names) {
-            for (int i = 0; i < this->var_count; ++i) {
-                s_free(this->var_names[i]);
-            }
-            s_free(this->var_names);
-        }
-        if (this->var_allocas) s_free(this->var_allocas);
+        symbol_table_free(&this->symbols);
+        s_free(this->name_buf);
+        s_free(this->lazy_funcs);
+        s_free(this->pending);
 
+        ssa_free(&this->ssa);
         LLVMDisposeBuilder(this->builder);
-        LLVMDisposeExecutionEngine(this->engine);
+        LLVMDisposeTargetMachine(this->target_machine);
+        LLVMDisposeModule(this->module);
         LLVMContextDispose(this->context);
         s_free(this);
     }
@@ -92,11 +229,11 @@ LLVMTypeRef get_function_type(CodeGen* this, FuncDeclStmt* func_decl) {
 
     // TODO: handle other return types (how to handle user-defined types?)
     // if the return type is 'int' or if the function is 'main', return int
-    if ((return_type.val && strcmp(return_type.val, "int") == 0) || strcmp(func_decl->tok_identifier.val, "main") == 0) {
+    if (token_equals(return_type, "int") || token_equals(func_decl->tok_identifier, "main")) {
         ret_type = LLVMInt32TypeInContext(this->context);
-    } else if (return_type.val && strcmp(return_type.val, "bool") == 0) {
+    } else if (token_equals(return_type, "bool")) {
         ret_type = LLVMInt1TypeInContext(this->context);
-    } else if (return_type.val && strcmp(return_type.val, "string") == 0) {
+    } else if (token_equals(return_type, "string")) {
         ret_type = LLVMPointerType(LLVMInt8TypeInContext(this->context), 0);
     }
 
@@ -106,7 +243,7 @@ LLVMTypeRef get_function_type(CodeGen* this, FuncDeclStmt* func_decl) {
             // For simplicity, we only handle 'int' parameter types for now
             TokenData param_type = func_decl->parameter_types[j];
             // TODO: handle other parameter types
-            if (param_type.type == tok_type && strcmp(param_type.val, "int") == 0) {
+            if (param_type.type == tok_type && token_equals(param_type, "int")) {
                 param_types[j] = LLVMInt32TypeInContext(this->context);
             } else {
                 param_types[j] = LLVMInt32TypeInContext(this->context);  // default to int
@@ -120,46 +257,115 @@ LLVMTypeRef get_function_type(CodeGen* this, FuncDeclStmt* func_decl) {
     }
 }
 
+static int compare_lazy_functions(const void* a, const void* b) {
+    LLVMValueRef x = ((const LazyFunction*)a)->value;
+    LLVMValueRef y = ((const LazyFunction*)b)->value;
+    return (x > y) - (x < y);
+}
+
+// Queues a function of a program with skipped bodies the first time a call reaches it
+static void reach_function(CodeGen* this, LLVMValueRef func) {
+    LazyFunction key = {.value = func};
+    LazyFunction* entry = bsearch(&key, this->lazy_funcs, this->lazy_func_count, sizeof(LazyFunction), compare_lazy_functions);
+    if (!entry || entry->reached) return;
+
+    entry->reached = 1;
+    this->pending[this->pending_count++] = entry->decl;
+}
+
+/**
+ * Declares what a top level statement adds to the module, without generating any function body.
+ * Every declaration has to go through here before the bodies are generated, so calls can resolve.
+ * @param stmt A function (gets its prototype) or a global variable (gets defined with its initializer).
+ * @return The function's prototype, NULL for anything else.
+ */
+LLVMValueRef codegen_declare(CodeGen* this, Stmt* stmt) {
+    switch (stmt->type) {
+        case STMT_FUNC_DECL: {
+            FuncDeclStmt* func_decl = &stmt->func_decl;
+            LLVMTypeRef func_type = get_function_type(this, func_decl);
+
+            LLVMValueRef func = LLVMAddFunction(this->module, token_cstr(this, stmt->func_decl.tok_identifier), func_type);
+            // the backend picks its instructions per function, these hold even where another target machine compiles it
+            LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, this->target_cpu);
+            if (this->target_features) LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, this->target_features);
+            return func;
+        }
+        case STMT_GLOBAL_VAR_DECL: {
+            // Handle global variable declaration
+            GlobalVarDeclStmt *global_var_decl = &stmt->global_var_decl;
+
+            // For simplicity, we only handle 'int' type globals for now
+            LLVMTypeRef var_type = get_type(global_var_decl->type, this->context);
+            LLVMValueRef global_var = LLVMAddGlobal(this->module, var_type, token_cstr(this, global_var_decl->tok_identifier));
+            LLVMValueRef init_val = codegen_expr(this, global_var_decl->value);
+            LLVMSetInitializer(global_var, init_val);
+            // No need to add to symbol table since it's global
+            return NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// Runs the AST passes on a function whose body was just parsed, as a one-statement unit like --stream's
+// The unit allocates from the program's arena, which is handed back afterwards
+static void optimize_lazy_body(Program* program, Stmt* func) {
+    Program unit = {.statements = &func, .stmt_count = 1, .capacity = 1, .arena = program->arena};
+    optimize_ast(&unit, NULL);
+    program->arena = unit.arena;
+}
+
 LLVMValueRef codegen_program(CodeGen* this, Program* program) {
+    // a program parsed with lazy bodies only gets the functions main can reach
+    if (program->lazy_lexer) {
+        this->lazy_funcs = s_malloc(sizeof(LazyFunction) * (program->stmt_count + 1));
+        this->pending = s_malloc(sizeof(Stmt*) * (program->stmt_count + 1));
+    }
+
     // 1) Create prototypes for all functions so calls work correctly
     // and create global variables
     for (int i = 0; i < program->stmt_count; i++) {
         Stmt* stmt = program->statements[i];
-        switch (stmt->type) {
-            case STMT_FUNC_DECL: {
-                FuncDeclStmt* func_decl = &stmt->func_decl;
-                LLVMTypeRef func_type = get_function_type(this, func_decl);
-
-                LLVMAddFunction(this->module, stmt->func_decl.tok_identifier.val, func_type);
-                break;
-            }
-            case STMT_GLOBAL_VAR_DECL: {
-                // Handle global variable declaration
-                GlobalVarDeclStmt *global_var_decl = &stmt->global_var_decl;
-
-                // For simplicity, we only handle 'int' type globals for now
-                LLVMTypeRef var_type = get_type(global_var_decl->type, this->context);
-                LLVMValueRef global_var = LLVMAddGlobal(this->module, var_type, global_var_decl->tok_identifier.val);
-                LLVMValueRef init_val = codegen_expr(this, global_var_decl->value);
-                LLVMSetInitializer(global_var, init_val);
-                // No need to add to symbol table since it's global
-                break;
-            }
-            default:
-                break;
+        LLVMValueRef func = codegen_declare(this, stmt);
+        if (func && this->lazy_funcs) {
+            this->lazy_funcs[this->lazy_func_count++] = (LazyFunction){.value = func, .decl = stmt};
         }
     }
 
     // Add functions from standard library
     setup_stdlib(this);
 
-    // 2) Generate code for all statements
-    for (int i = 0; i < program->stmt_count; i++) {
-        Stmt* stmt = program->statements[i];
+    if (!this->lazy_funcs) {
+        // 2) Generate code for all statements
+        for (int i = 0; i < program->stmt_count; i++) {
+            Stmt* stmt = program->statements[i];
+            codegen_stmt(this, stmt);
+        }
+
+        return LLVMGetNamedFunction(this->module, "main");
+    }
+
+    // 2) Starting from main, parse and generate each function the first time a call reaches it
+    qsort(this->lazy_funcs, this->lazy_func_count, sizeof(LazyFunction), compare_lazy_functions);
+    LLVMValueRef main_func = LLVMGetNamedFunction(this->module, "main");
+    if (main_func) reach_function(this, main_func);
+
+    for (int next = 0; next < this->pending_count; next++) {
+        Stmt* stmt = this->pending[next];
+        if (!stmt->func_decl.body) {
+            parse_func_body(program, stmt);
+            if (program->lazy_ast_opt) optimize_lazy_body(program, stmt);
+        }
         codegen_stmt(this, stmt);
     }
 
-    return LLVMGetNamedFunction(this->module, "main");
+    // 3) Drop the prototypes of functions nothing called
+    for (int i = 0; i < this->lazy_func_count; i++) {
+        if (!this->lazy_funcs[i].reached) LLVMDeleteFunction(this->lazy_funcs[i].value);
+    }
+
+    return main_func;
 }
 
 LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
@@ -167,26 +373,18 @@ LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
         case EXPR_IDENTIFIER: {
             // Load variable value for use in an expression
 
-            // 1) See if the variable is in the symbol table
-            LLVMValueRef var_alloca = codegen_get_var(this, expr->identifier.tok.val);
-            if (var_alloca) {
-                LLVMTypeRef elemType = LLVMGetAllocatedType(var_alloca);
-                return LLVMBuildLoad2(this->builder, elemType, var_alloca, expr->identifier.tok.val);
+            // A local in scope, or else a global variable
+            Symbol* var = codegen_get_var(this, expr->identifier.tok);
+            if (var) {
+                return codegen_load_var(this, var, token_cstr(this, expr->identifier.tok));
             }
 
-            // 2) If not found, it might be a global variable
-            LLVMValueRef global_var = LLVMGetNamedGlobal(this->module, expr->identifier.tok.val);
-            if (global_var) {
-                LLVMTypeRef var_type = LLVMGlobalGetValueType(global_var);
-                return LLVMBuildLoad2(this->builder, var_type, global_var, expr->identifier.tok.val);
-            }
-            
-            fprintf(stderr, "Undefined variable: %s\n", expr->identifier.tok.val);
+            fprintf(stderr, "Undefined variable: %.*s\n", TOK_FMT(expr->identifier.tok));
             return NULL;
         }
         case EXPR_LITERAL_INT: {
-            // Parse integer literal
-            int value = atoi(expr->int_literal.value);
+            // The lexer already decoded the value
+            int value = expr->int_literal.tok.int_val;
             LLVMTypeRef int32_type = LLVMInt32TypeInContext(this->context);
             return LLVMConstInt(int32_type, value, 0);
         }
@@ -224,19 +422,14 @@ LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
             }
         }
         case EXPR_INCREMENT: {
-            LLVMValueRef var_alloca = codegen_get_var(this, expr->increment.identifier.val);
-            LLVMValueRef global_var = NULL;
-            if (!var_alloca) {
-                global_var = LLVMGetNamedGlobal(this->module, expr->increment.identifier.val);
-            }
-            if (!var_alloca && !global_var) {
-                fprintf(stderr, "Undefined variable in increment: %s\n", expr->increment.identifier.val);
+            Symbol* var = codegen_get_var(this, expr->increment.identifier);
+            if (!var) {
+                fprintf(stderr, "Undefined variable in increment: %.*s\n", TOK_FMT(expr->increment.identifier));
                 return NULL;
             }
 
-            LLVMTypeRef elemType = var_alloca ? LLVMGetAllocatedType(var_alloca) : LLVMGlobalGetValueType(global_var);
-            LLVMValueRef ptr = var_alloca ? var_alloca : global_var;
-            LLVMValueRef current_val = LLVMBuildLoad2(this->builder, elemType, ptr, "loadtmp");
+            LLVMTypeRef elemType = var->type;
+            LLVMValueRef current_val = codegen_load_var(this, var, "loadtmp");
             LLVMValueRef one = LLVMConstInt(elemType, 1, 0);
 
             LLVMValueRef new_val = NULL;
@@ -249,7 +442,7 @@ LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
                 return NULL;
             }
 
-            LLVMBuildStore(this->builder, new_val, ptr);
+            codegen_store_var(this, var, new_val);
 
             // Handle prefix vs postfix
             if (expr->increment.is_prefix) {
@@ -287,23 +480,29 @@ LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
             LLVMTypeRef bool_type = LLVMInt1TypeInContext(this->context);
             return LLVMConstInt(bool_type, expr->bool_literal.value, 0);
         }
-        case EXPR_LITERAL_STRING:
-            return LLVMBuildGlobalStringPtr(this->builder, expr->str_literal.value, "strtmp");
+        case EXPR_LITERAL_STRING: {
+            char* value = unescape_string(expr->str_literal.tok.start, expr->str_literal.tok.len);
+            LLVMValueRef str = LLVMBuildGlobalStringPtr(this->builder, value, "strtmp");
+            s_free(value);
+            return str;
+        }
         case EXPR_FUNC_CALL: {
-            // Check if it's a standard library function
-            for (int i = 0; stdlib_functions[i] != NULL; i++) {
-                if (strcmp(expr->func_call.tok_function.val, stdlib_functions[i]) == 0) {
-                    return handle_stdlib_call(this, expr->func_call.tok_function.val,
-                                              expr->func_call.args, expr->func_call.arg_count);
-                }
+            Symbol* func_symbol = codegen_get_function(this, expr->func_call.tok_function);
+            if (!func_symbol) {
+                fprintf(stderr, "Undefined function: %.*s\n", TOK_FMT(expr->func_call.tok_function));
+                return NULL;
             }
 
-            LLVMValueRef callee = LLVMGetNamedFunction(this->module, expr->func_call.tok_function.val);
-            if (!callee) {
-                fprintf(stderr, "Undefined function: %s\n", expr->func_call.tok_function.val);
-                return NULL;
+            // Check if it's a standard library function
+            if (func_symbol->kind == SYMBOL_BUILTIN) {
+                return handle_stdlib_call(this, func_symbol->builtin, expr->func_call.args, expr->func_call.arg_count);
             }
 
+            // copied out, generating the arguments can add symbols
+            LLVMValueRef callee = func_symbol->value;
+            LLVMTypeRef func_type = func_symbol->type;
+            if (this->lazy_funcs) reach_function(this, callee);
+
             // Generate code for arguments
             LLVMValueRef* args = NULL;
             if (expr->func_call.arg_count > 0) {
@@ -313,11 +512,10 @@ LLVMValueRef codegen_expr(CodeGen* this, Expr* expr) {
                 }
             }
 
-            // Get the function type (callee is a function pointer/value)
+            // The function type was cached with the callee (callee is a function pointer/value)
             // https://discourse.llvm.org/t/llvmbuildcall2-function-type/71093/3
             // time spent fixing this: 1 hour
-            LLVMTypeRef func_type = LLVMGlobalGetValueType(callee);
-            
+
             // Build the call instruction
             // Don't name the result for void-returning functions
             LLVMTypeRef return_type = LLVMGetReturnType(func_type);
@@ -337,43 +535,28 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
         case STMT_FUNC_DECL: {
             // To help with function calls, we only handle function declarations at the top level in codegen_program
             // So here we just generate the body of the function
-            LLVMValueRef func = LLVMGetNamedFunction(this->module, stmt->func_decl.tok_identifier.val);
+            LLVMValueRef func = LLVMGetNamedFunction(this->module, token_cstr(this, stmt->func_decl.tok_identifier));
             if (!func) {
-                fprintf(stderr, "Function not found: %s\n", stmt->func_decl.tok_identifier.val);
+                fprintf(stderr, "Function not found: %.*s\n", TOK_FMT(stmt->func_decl.tok_identifier));
                 return 0;
             }
 
-            // Create a new basic block for the function body
-            LLVMBasicBlockRef entry_block = LLVMAppendBasicBlockInContext(this->context, func, "entry");
+            // Create a new basic block for the function body, nothing branches back to it so it is sealed right away
+            ssa_begin_function(&this->ssa);
+            int entry_block = ssa_add_block(&this->ssa, func, "entry");
+            ssa_seal_block(&this->ssa, entry_block);
             // set builder to end of entry block (it just moves it after the "entry" label so instructions are "under" it)
-            LLVMPositionBuilderAtEnd(this->builder, entry_block); 
+            codegen_enter_block(this, entry_block);
 
+            // function-level scope for the parameters, popped when leaving this function
+            symbol_push_scope(&this->symbols);
 
-            // snapshot symbol the table so we can restore it when leaving this function (function-level scope)
-            // while keeping the same amount of global variables
-            int saved_var_count = this->var_count;
-
-            // Load parameters into allocas and register them in the symbol table
+            // Parameters are the first values of their variables
             for (int i = 0; i < stmt->func_decl.parameter_count; i++) {
                 LLVMValueRef param = LLVMGetParam(func, i);
-                const char* pname = stmt->func_decl.parameter_names[i].val;
-                LLVMSetValueName(param, pname);
-
-                // create an alloca in the entry block (use temp builder placed at start)
-                LLVMBuilderRef tmp_builder = LLVMCreateBuilderInContext(this->context);
-                LLVMValueRef first_instr = LLVMGetFirstInstruction(entry_block);
-                if (first_instr)
-                    LLVMPositionBuilderBefore(tmp_builder, first_instr);
-                else
-                    LLVMPositionBuilderAtEnd(tmp_builder, entry_block);
-
-                LLVMTypeRef arg_type = LLVMTypeOf(param);
-                LLVMValueRef alloca = LLVMBuildAlloca(tmp_builder, arg_type, pname);
-                LLVMDisposeBuilder(tmp_builder);
-
-                // store the incoming param into the alloca and register it
-                LLVMBuildStore(this->builder, param, alloca);
-                codegen_set_var(this, pname, alloca);
+                TokenData pname = stmt->func_decl.parameter_names[i];
+                LLVMSetValueName2(param, pname.start, pname.len);
+                codegen_set_var(this, pname, param);
             }
 
             // Generate code for the function body
@@ -384,22 +567,19 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
                 LLVMTypeRef ret_type = LLVMGetReturnType(LLVMGlobalGetValueType(func));
                 if (ret_type == LLVMVoidTypeInContext(this->context)) {
                     LLVMBuildRetVoid(this->builder);
-                } else if (!strcmp(stmt->func_decl.tok_identifier.val, "main")) {
+                } else if (token_equals(stmt->func_decl.tok_identifier, "main")) {
                     LLVMValueRef zero = LLVMConstInt(LLVMInt32TypeInContext(this->context), 0, 0);
                     LLVMBuildRet(this->builder, zero);
                 } else {
                     // error handling for non-void functions without return
-                    fprintf(stderr, "Error: Non-void function '%s' missing return statement\n",
-                            stmt->func_decl.tok_identifier.val);
-                    return 0;
+                    fprintf(stderr, "Error: Non-void function '%.*s' missing return statement\n",
+                            TOK_FMT(stmt->func_decl.tok_identifier));
                 }
             }
 
             // restore symbol table (pop function-scope parameters)
-            for (int i = saved_var_count; i < this->var_count; ++i) {
-                s_free(this->var_names[i]);
-            }
-            this->var_count = saved_var_count;
+            symbol_pop_scope(&this->symbols);
+            ssa_end_function(&this->ssa);
             return 0;
         }
 
@@ -418,13 +598,17 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
 
         case STMT_BLOCK: {
             // Generate code for all statements in the block
+            // Locals declared in it go out of scope at the end, this also scopes if and while bodies
+            symbol_push_scope(&this->symbols);
             int has_return = 0;
             for (int i = 0; i < stmt->block_stmt.stmt_count; i++) {
                 if (stmt->block_stmt.statements[i]->type == STMT_RETURN) {
                     has_return = 1;
                 }
-                codegen_stmt(this, stmt->block_stmt.statements[i]);
+                // a nested block (a branch the AST passes kept) reports its own return
+                if (codegen_stmt(this, stmt->block_stmt.statements[i])) has_return = 1;
             }
+            symbol_pop_scope(&this->symbols);
             // return up to the func_decl_stmt to know if a return was encountered
             return has_return;
         }
@@ -437,40 +621,15 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
 
             // If no initializer, use a typed zero/null
             if (!init_val) {
-                printf("Warning: Variable '%s' declared without initializer, defaulting to zero\n",
-                       stmt->var_decl.tok_identifier.val);
+                printf("Warning: Variable '%.*s' declared without initializer, defaulting to zero\n",
+                       TOK_FMT(stmt->var_decl.tok_identifier));
                 // here we assume var_decl has type info if needed; fallback to int32 zero
                 LLVMTypeRef t = LLVMInt32TypeInContext(this->context);
                 init_val = LLVMConstNull(t);
             }
 
-            // Create the alloca in the entry block of the current function
-            LLVMBasicBlockRef cur_bb = LLVMGetInsertBlock(this->builder);
-            LLVMValueRef cur_fn = LLVMGetBasicBlockParent(cur_bb);
-            LLVMBasicBlockRef entry_bb = LLVMGetFirstBasicBlock(cur_fn);
-
-            // temporary builder placed at start of entry block
-            LLVMBuilderRef tmp_builder = LLVMCreateBuilderInContext(this->context);
-            LLVMValueRef first_instr = LLVMGetFirstInstruction(entry_bb);
-            if (first_instr) {
-                LLVMPositionBuilderBefore(tmp_builder, first_instr);
-            } else {
-                LLVMPositionBuilderAtEnd(tmp_builder, entry_bb);
-            }
-
-            LLVMTypeRef var_type = LLVMTypeOf(init_val);
-            // printf("Variable \"%s\" has type: %s\n", stmt->var_decl.tok_identifier.val, LLVMPrintTypeToString(var_type));
-            LLVMValueRef alloca = LLVMBuildAlloca(tmp_builder, var_type, stmt->var_decl.tok_identifier.val);
-            
-            LLVMDisposeBuilder(tmp_builder);
-            
-            // store initializer into the alloca using current builder (current insertion point)
-            LLVMBuildStore(this->builder, init_val, alloca);
-            
-            // register in symbol table
-            codegen_set_var(this, stmt->var_decl.tok_identifier.val, alloca);
-            
-            
+            // register in symbol table, the initializer is the variable's first value
+            codegen_set_var(this, stmt->var_decl.tok_identifier, init_val);
             break;
         }
         case STMT_GLOBAL_VAR_DECL:
@@ -478,72 +637,46 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
             // This is a placeholder to avoid errors
             break;
         case STMT_VAR_ASSIGN: {
-            // Get the variable's alloca from the symbol table
-            LLVMValueRef local_var_alloca = codegen_get_var(this, stmt->var_assign.tok_identifier.val);
-            LLVMValueRef global_value = NULL;
-            
-            // If not found in symbol table, it might be a global variable
-            if (!local_var_alloca) {
-                global_value = LLVMGetNamedGlobal(this->module, stmt->var_assign.tok_identifier.val);
-            }
-
-            if (!local_var_alloca && !global_value) {
-                fprintf(stderr, "Undefined variable in assignment: %s\n", stmt->var_assign.tok_identifier.val);
+            // Get the variable (local or global) from the symbol table
+            Symbol* found = codegen_get_var(this, stmt->var_assign.tok_identifier);
+            if (!found) {
+                fprintf(stderr, "Undefined variable in assignment: %.*s\n", TOK_FMT(stmt->var_assign.tok_identifier));
                 return 0;
             }
 
+            // copied out, generating the value can add symbols
+            Symbol var = *found;
+
             // Generate code for the value to assign
             LLVMValueRef value = codegen_expr(this, stmt->var_assign.new_value);
 
             // Simple assignment
             if (stmt->var_assign.modifying_tok.type == tok_equal) {
-                if (local_var_alloca) {
-                    LLVMBuildStore(this->builder, value, local_var_alloca);
-                } else if (global_value) {
-                    LLVMBuildStore(this->builder, value, global_value);
-                }
+                codegen_store_var(this, &var, value);
                 break;
             }
-            LLVMTypeRef elemType = NULL;
-            LLVMValueRef current_val = NULL;
-            
-            if (local_var_alloca) {
-                elemType = LLVMGetAllocatedType(local_var_alloca);
-                current_val = LLVMBuildLoad2(this->builder, elemType, local_var_alloca, "loadtmp");
-            } else if (global_value) {
-                elemType = LLVMGlobalGetValueType(global_value);
-                current_val = LLVMBuildLoad2(this->builder, elemType, global_value, "loadtmp");
-            }
-
+            LLVMValueRef current_val = codegen_load_var(this, &var, "loadtmp");
 
-            LLVMValueRef value_to_use = local_var_alloca ? local_var_alloca : global_value;            
-
-            // Otherwise store the value into the variable's alloca based on the modifying token
+            // Otherwise combine it with the variable's current value based on the modifying token
+            LLVMValueRef new_val = NULL;
             switch (stmt->var_assign.modifying_tok.type) {
-                case tok_plus_equal: {
-                    LLVMValueRef new_val = LLVMBuildAdd(this->builder, current_val, value, "addtmp");
-                    LLVMBuildStore(this->builder, new_val, value_to_use);
+                case tok_plus_equal:
+                    new_val = LLVMBuildAdd(this->builder, current_val, value, "addtmp");
                     break;
-                }
-                case tok_minus_equal: {
-                    LLVMValueRef new_val = LLVMBuildSub(this->builder, current_val, value, "subtmp");
-                    LLVMBuildStore(this->builder, new_val, value_to_use);
+                case tok_minus_equal:
+                    new_val = LLVMBuildSub(this->builder, current_val, value, "subtmp");
                     break;
-                }
-                case tok_star_equal: {
-                    LLVMValueRef new_val = LLVMBuildMul(this->builder, current_val, value, "multmp");
-                    LLVMBuildStore(this->builder, new_val, value_to_use);
+                case tok_star_equal:
+                    new_val = LLVMBuildMul(this->builder, current_val, value, "multmp");
                     break;
-                }
-                case tok_slash_equal: {
-                    LLVMValueRef new_val = LLVMBuildSDiv(this->builder, current_val, value, "divtmp");
-                    LLVMBuildStore(this->builder, new_val, value_to_use);
+                case tok_slash_equal:
+                    new_val = LLVMBuildSDiv(this->builder, current_val, value, "divtmp");
                     break;
-                }
                 default:
                     fprintf(stderr, "Unknown assignment operator\n");
                     return 0;
             }
+            codegen_store_var(this, &var, new_val);
             break;
         }
 
@@ -561,77 +694,72 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
             }
 
             // Prepare blocks
+            // A block is sealed as soon as every branch into it exists, reads in it can then resolve their phis
             int n_elseif = stmt->if_stmt.else_if_count;
-            LLVMBasicBlockRef* elseif_blocks = NULL;
-            LLVMBasicBlockRef* elseif_body_blocks = NULL;
+            int* elseif_blocks = NULL;
+            int* elseif_body_blocks = NULL;
             if (n_elseif > 0) {
-                elseif_blocks = s_malloc(sizeof(LLVMBasicBlockRef) * n_elseif);
-                elseif_body_blocks = s_malloc(sizeof(LLVMBasicBlockRef) * n_elseif);
+                elseif_blocks = s_malloc(sizeof(int) * n_elseif);
+                elseif_body_blocks = s_malloc(sizeof(int) * n_elseif);
             }
-            LLVMBasicBlockRef then_bb = LLVMAppendBasicBlockInContext(this->context, func, "then");
-            LLVMBasicBlockRef else_bb = NULL;
-            LLVMBasicBlockRef after_bb = LLVMAppendBasicBlockInContext(this->context, func, "ifend");
+            int then_bb = ssa_add_block(&this->ssa, func, "then");
+            int else_bb = -1;
+            int after_bb = ssa_add_block(&this->ssa, func, "ifend");
 
             // Create else-if and else blocks if needed
             for (int i = 0; i < n_elseif; ++i) {
-                elseif_blocks[i] = LLVMAppendBasicBlockInContext(this->context, func, "elseif");
-                elseif_body_blocks[i] = LLVMAppendBasicBlockInContext(this->context, func, "elseif_body");
+                elseif_blocks[i] = ssa_add_block(&this->ssa, func, "elseif");
+                elseif_body_blocks[i] = ssa_add_block(&this->ssa, func, "elseif_body");
             }
             if (stmt->if_stmt.else_branch) {
-                else_bb = LLVMAppendBasicBlockInContext(this->context, func, "else");
+                else_bb = ssa_add_block(&this->ssa, func, "else");
             } else {
                 else_bb = after_bb;
             }
 
             // Branch on main condition
-            if (n_elseif > 0) {
-                LLVMBuildCondBr(this->builder, cond_val, then_bb, elseif_blocks[0]);
-            } else {
-                LLVMBuildCondBr(this->builder, cond_val, then_bb, else_bb);
-            }
+            int next_bb = n_elseif > 0 ? elseif_blocks[0] : else_bb;
+            codegen_cond_branch(this, cond_val, then_bb, next_bb);
+            ssa_seal_block(&this->ssa, then_bb);
+            if (next_bb != after_bb) ssa_seal_block(&this->ssa, next_bb);
 
             // Emit then block
-
-            LLVMPositionBuilderAtEnd(this->builder, then_bb);
+            // the branch can end in a different block than it started in, codegen_branch goes from wherever it ended
+            codegen_enter_block(this, then_bb);
             codegen_stmt(this, stmt->if_stmt.then_branch);
-            if (!LLVMGetBasicBlockTerminator(then_bb)) {
-                LLVMBuildBr(this->builder, after_bb);
-            }
+            codegen_branch(this, after_bb);
 
             // Emit else-if blocks
 
             for (int i = 0; i < n_elseif; ++i) {
-                LLVMPositionBuilderAtEnd(this->builder, elseif_blocks[i]);
+                codegen_enter_block(this, elseif_blocks[i]);
                 LLVMValueRef elseif_cond = codegen_expr(this, stmt->if_stmt.else_if_conditions[i]);
                 LLVMTypeRef elseif_type = LLVMTypeOf(elseif_cond);
                 if (LLVMGetTypeKind(elseif_type) != LLVMIntegerTypeKind || LLVMGetIntTypeWidth(elseif_type) != 1) {
                     elseif_cond = LLVMBuildICmp(this->builder, LLVMIntNE, elseif_cond, LLVMConstInt(elseif_type, 0, 0), "elseifcond");
                 }
-                if (i < n_elseif - 1) {
-                    LLVMBuildCondBr(this->builder, elseif_cond, elseif_body_blocks[i], elseif_blocks[i+1]);
-                } else {
-                    LLVMBuildCondBr(this->builder, elseif_cond, elseif_body_blocks[i], else_bb);
-                }
+                next_bb = i < n_elseif - 1 ? elseif_blocks[i + 1] : else_bb;
+                codegen_cond_branch(this, elseif_cond, elseif_body_blocks[i], next_bb);
+                ssa_seal_block(&this->ssa, elseif_body_blocks[i]);
+                if (next_bb != after_bb) ssa_seal_block(&this->ssa, next_bb);
+
                 // Emit elseif body
-                LLVMPositionBuilderAtEnd(this->builder, elseif_body_blocks[i]);
+                codegen_enter_block(this, elseif_body_blocks[i]);
                 codegen_stmt(this, stmt->if_stmt.else_if_branches[i]);
-                if (!LLVMGetBasicBlockTerminator(elseif_body_blocks[i])) {
-                    LLVMBuildBr(this->builder, after_bb);
-                }
+                codegen_branch(this, after_bb);
             }
 
             // Emit else block if present
 
             if (stmt->if_stmt.else_branch) {
-                LLVMPositionBuilderAtEnd(this->builder, else_bb);
+                codegen_enter_block(this, else_bb);
                 codegen_stmt(this, stmt->if_stmt.else_branch);
-                if (!LLVMGetBasicBlockTerminator(else_bb)) {
-                    LLVMBuildBr(this->builder, after_bb);
-                }
+                codegen_branch(this, after_bb);
             }
 
-            // Continue after if
-            LLVMPositionBuilderAtEnd(this->builder, after_bb);
+            // Continue after if, every branch into it is there now
+            ssa_seal_block(&this->ssa, after_bb);
+            codegen_enter_block(this, after_bb);
 
             if (elseif_blocks) s_free(elseif_blocks);
             if (elseif_body_blocks) s_free(elseif_body_blocks);
@@ -642,15 +770,16 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
             LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(this->builder));
 
             // Create blocks for loop condition, body, and after loop
-            LLVMBasicBlockRef cond_bb = LLVMAppendBasicBlockInContext(this->context, func, "loopcond");
-            LLVMBasicBlockRef body_bb = LLVMAppendBasicBlockInContext(this->context, func, "loopbody");
-            LLVMBasicBlockRef after_bb = LLVMAppendBasicBlockInContext(this->context, func, "loopafter");
+            int cond_bb = ssa_add_block(&this->ssa, func, "loopcond");
+            int body_bb = ssa_add_block(&this->ssa, func, "loopbody");
+            int after_bb = ssa_add_block(&this->ssa, func, "loopafter");
 
             // Branch to condition block
-            LLVMBuildBr(this->builder, cond_bb);
+            codegen_branch(this, cond_bb);
 
             // Emit condition block
-            LLVMPositionBuilderAtEnd(this->builder, cond_bb);
+            // it stays unsealed until the body's back edge exists, variables read in the loop get phis here
+            codegen_enter_block(this, cond_bb);
             LLVMValueRef cond_val = codegen_expr(this, stmt->while_stmt.condition);
             if (!cond_val) {
                 fprintf(stderr, "Failed to generate code for while condition.\n");
@@ -664,16 +793,19 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
             }
 
             // Build conditional branch to body or after loop
-            LLVMBuildCondBr(this->builder, cond_val, body_bb, after_bb);
+            codegen_cond_branch(this, cond_val, body_bb, after_bb);
+            ssa_seal_block(&this->ssa, body_bb);
+            ssa_seal_block(&this->ssa, after_bb);
 
             // Emit body block
-            LLVMPositionBuilderAtEnd(this->builder, body_bb);
+            codegen_enter_block(this, body_bb);
             codegen_stmt(this, stmt->while_stmt.body);
             // After body, branch back to condition
-            LLVMBuildBr(this->builder, cond_bb);
+            codegen_branch(this, cond_bb);
+            ssa_seal_block(&this->ssa, cond_bb);
 
             // Continue at after loop block
-            LLVMPositionBuilderAtEnd(this->builder, after_bb);
+            codegen_enter_block(this, after_bb);
             break;
         }
         default:
@@ -684,43 +816,138 @@ int codegen_stmt(CodeGen* this, Stmt* stmt) {
     return 0;
 }
 
+// Runs a new pass manager pipeline, the target machine gives the vectorizers and cost models the CPU's registers
+// and instructions
+static int run_pipeline(LLVMModuleRef module, const char *pipeline, LLVMTargetMachineRef target_machine,
+                        int verify_each) {
+    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
+    LLVMPassBuilderOptionsSetVerifyEach(opts, verify_each);
+    LLVMPassBuilderOptionsSetDebugLogging(opts, 0);
+
+    LLVMErrorRef err = LLVMRunPasses(
+        module,
+        pipeline,
+        target_machine,
+        opts
+    );
+
+    LLVMDisposePassBuilderOptions(opts);
+    if (err) {
+        char *msg = LLVMGetErrorMessage(err);
+        fprintf(stderr, "LLVM optimization error in pipeline \"%s\": %s\n", pipeline, msg);
+        LLVMDisposeErrorMessage(msg);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Runs a new pass manager pipeline over the whole module, like opt -passes="default<O2>".
+ * @param options The level picks the default<O0..3>, default<Os> or default<Oz> pipeline unless options->passes names one.
+ * @return 0 on success, 1 if the pipeline could not be parsed or failed (after saying so).
+ */
+int optimize_module(CodeGen* this, const OptOptions* options) {
+    char default_pipeline[16];
+    const char* pipeline = options->passes;
+    if (!pipeline) {
+        if (options->size_level) {
+            snprintf(default_pipeline, sizeof(default_pipeline), "default<O%c>", options->size_level == 1 ? 's' : 'z');
+        } else {
+            snprintf(default_pipeline, sizeof(default_pipeline), "default<O%d>", options->level);
+        }
+        pipeline = default_pipeline;
+    }
+    return run_pipeline(this->module, pipeline, this->target_machine, options->verify_each);
+}
+
+/**
+ * Runs FUNCTION_PIPELINE (instcombine, reassociate, GVN, CFG simplification) on every function the module defines.
+ * The C API only runs new pass manager pipelines over a whole module, so callers that want functions cleaned up
+ * one at a time hand over a module holding just those, or run this once for a batch of them.
+ * @return 1 if the pipeline failed (after printing why), 0 otherwise.
+ */
+int run_function_passes(LLVMModuleRef module, LLVMTargetMachineRef target_machine) {
+    return run_pipeline(module, FUNCTION_PIPELINE, target_machine, 0);
+}
+
 void dump_ir(CodeGen* this) {
     char* ir = LLVMPrintModuleToString(this->module);
     printf("%s\n", ir);
     LLVMDisposeMessage(ir);
 }
 
-void write_ir(CodeGen* this, const char* filename) {
+int write_ir(CodeGen* this, const char* filename) {
     // Write the LLVM IR (human-readable .ll file)
     char* error = NULL;
     if (LLVMPrintModuleToFile(this->module, filename, &error) != 0) {
         fprintf(stderr, "Error writing LLVM IR to file %s: %s\n", filename, error);
         LLVMDisposeMessage(error);
+        return 1;
+    }
+    return 0;
+}
+
+int write_bitcode(CodeGen* this, const char* filename) {
+    if (LLVMWriteBitcodeToFile(this->module, filename) != 0) {
+        fprintf(stderr, "Error writing bitcode to file %s\n", filename);
+        return 1;
     }
+    return 0;
 }
 
-int run_jit(CodeGen* this) {
-    // Verify the module
+/**
+ * Links a bitcode module into the module code is generated into. Called before any phi code is generated,
+ * so the phi program can call its functions and use its globals like its own.
+ * @param filename A .bc file, from --emit=bc or any other LLVM tool.
+ * @return 0 on success, 1 if the file could not be read, parsed or linked (after saying so).
+ */
+int link_bitcode(CodeGen* this, const char* filename) {
+    LLVMMemoryBufferRef buffer;
     char* error = NULL;
-    if (LLVMVerifyModule(this->module, LLVMAbortProcessAction, &error) != 0) {
-        fprintf(stderr, "Module verification failed: %s\n", error);
+    if (LLVMCreateMemoryBufferWithContentsOfFile(filename, &buffer, &error) != 0) {
+        fprintf(stderr, "Error reading bitcode file %s: %s\n", filename, error);
         LLVMDisposeMessage(error);
-        return -1;
+        return 1;
     }
 
-    // Find and run the main function
-    LLVMValueRef main_func = LLVMGetNamedFunction(this->module, "main");
-    if (!main_func) {
-        fprintf(stderr, "Main function not found\n");
-        return -1;
+    // the module is fully read, it does not keep pointing into the buffer
+    LLVMModuleRef module;
+    LLVMBool failed = LLVMParseBitcodeInContext2(this->context, buffer, &module);
+    LLVMDisposeMemoryBuffer(buffer);
+    if (failed) {
+        fprintf(stderr, "Error parsing bitcode file %s\n", filename);
+        return 1;
     }
 
-    // Execute the function
-    LLVMGenericValueRef result = LLVMRunFunction(this->engine, main_func, 0, NULL);
-    int return_value = LLVMGenericValueToInt(result, 0);
+    // module is destroyed by linking, whether it worked or not
+    if (LLVMLinkModules2(this->module, module)) {
+        fprintf(stderr, "Error linking bitcode file %s\n", filename);
+        return 1;
+    }
+    return 0;
+}
 
-    LLVMDisposeGenericValue(result);
-    return return_value;
+/**
+ * Writes the module as machine code for the target machine, in this process rather than through clang.
+ * The backend runs its own passes over the module on the way, so it should not be run or emitted again after this.
+ * @param type LLVMObjectFile for an object file, LLVMAssemblyFile for assembly.
+ * @return 0 on success, 1 if the module is broken or the file could not be written (after saying so).
+ */
+int emit_file(CodeGen* this, const char* filename, LLVMCodeGenFileType type) {
+    char* error = NULL;
+    if (LLVMVerifyModule(this->module, LLVMReturnStatusAction, &error) != 0) {
+        fprintf(stderr, "Module verification failed: %s\n", error);
+        LLVMDisposeMessage(error);
+        return 1;
+    }
+    LLVMDisposeMessage(error);
+
+    if (LLVMTargetMachineEmitToFile(this->target_machine, this->module, (char*)filename, type, &error) != 0) {
+        fprintf(stderr, "Error writing %s: %s\n", filename, error);
+        LLVMDisposeMessage(error);
+        return 1;
+    }
+    return 0;
 }
 
 void setup_stdlib(CodeGen* this) {
@@ -741,14 +968,14 @@ LLVMValueRef handle_stdlib_call(CodeGen* this, const char* func_name, Expr** arg
 }
 
 LLVMTypeRef get_type(TokenData tok_type, LLVMContextRef context) {
-    if (strcmp(tok_type.val, "int") == 0) {
+    if (token_equals(tok_type, "int")) {
         return LLVMInt32TypeInContext(context);
-    } else if (strcmp(tok_type.val, "bool") == 0) {
+    } else if (token_equals(tok_type, "bool")) {
         return LLVMInt1TypeInContext(context);
-    } else if (strcmp(tok_type.val, "string") == 0) {
+    } else if (token_equals(tok_type, "string")) {
         return LLVMPointerTypeInContext(context, 0); // char*
     } else {
-        fprintf(stderr, "Unknown type: %s\n", tok_type.val);
+        fprintf(stderr, "Unknown type: %.*s\n", TOK_FMT(tok_type));
         return NULL;
     }
 }
\ No newline at end of file
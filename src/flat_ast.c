@@ -0,0 +1,736 @@
+#include "flat_ast.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+
+static FlatRef add_node(FlatAst *ast, FlatKind kind);
+static uint32_t add_span(FlatAst *ast, TokenData tok);
+static uint32_t reserve_extra(FlatAst *ast, uint32_t count);
+static FlatRef flatten_expr(FlatAst *ast, Expr *expr);
+static FlatRef flatten_stmt(FlatAst *ast, Stmt *stmt);
+static FlatRef flatten_block(FlatAst *ast, Stmt **statements, int stmt_count);
+static TokenData span_token(FlatAst *ast, uint32_t span, Token type);
+static Expr *expand_expr(FlatAst *ast, Arena *arena, FlatRef ref);
+static Stmt *expand_stmt(FlatAst *ast, Arena *arena, FlatRef ref);
+static Stmt *expand_block(FlatAst *ast, Arena *arena, FlatRef ref);
+
+// What a child reference of a node may point to
+typedef enum {
+    CHILD_EXPR,
+    CHILD_STMT,
+    CHILD_BLOCK,
+} ChildKind;
+
+static int check_node(FlatAst *ast, uint8_t *has_parent, FlatRef ref);
+static int check_child(FlatAst *ast, uint8_t *has_parent, FlatRef parent, FlatRef child, ChildKind kind, int optional);
+static int check_list(FlatAst *ast, uint32_t list, uint32_t count_at, uint32_t stride, uint32_t trailing, uint32_t *count);
+
+static void write_span(Writer *writer, FlatAst *ast, uint32_t span);
+static void write_flat_expr(Writer *writer, FlatAst *ast, FlatRef ref);
+static void write_flat_block_body(Writer *writer, FlatAst *ast, FlatRef block, const char *indent);
+
+/**
+ * Builds the flat encoding of a parsed program.
+ * Nodes are laid out in pre-order, so walking the tree visits the node array front to back.
+ * @param prog The program to encode, it is not modified.
+ * @param source The text the program's tokens point into, spans are stored relative to it.
+ * @param ast Filled in, release it with free_flat_ast.
+ */
+void flatten_program(Program *prog, const char *source, FlatAst *ast) {
+    memset(ast, 0, sizeof(FlatAst));
+    ast->source = source;
+    ast->root = flatten_block(ast, prog->statements, prog->stmt_count);
+}
+
+/**
+ * Builds the pointer tree back from a flat AST, e.g. one loaded from the AST cache.
+ * Token types the spans do not keep are restored from the node kind, which is all codegen looks at.
+ * @param ast The flat AST, its source has to be the text it was flattened from. One read from outside has to pass
+ * flat_ast_check first, nothing is bounds checked here.
+ * @return A program owning its nodes, same as parse() would give.
+ */
+Program *unflatten_program(FlatAst *ast) {
+    Program *prog = (Program *)s_malloc(sizeof(Program));
+    // the node count is known up front, so the whole tree can usually go into a single chunk
+    size_t chunk_size = (size_t)ast->node_count * sizeof(Expr) + sizeof(Stmt *) * ast->extra_count;
+    arena_init(&prog->arena, chunk_size > ARENA_DEFAULT_CHUNK_SIZE ? chunk_size : 0);
+    prog->lazy_lexer = NULL;
+
+    uint32_t count = flat_block_count(ast, ast->root);
+    prog->capacity = count > 0 ? (int)count : 1;
+    prog->statements = (Stmt **)arena_alloc(&prog->arena, prog->capacity * sizeof(Stmt *));
+    prog->stmt_count = (int)count;
+    for (uint32_t i = 0; i < count; i++) {
+        prog->statements[i] = expand_stmt(ast, &prog->arena, flat_block_child(ast, ast->root, i));
+    }
+    return prog;
+}
+
+/**
+ * Checks that a flat AST read from outside, like an AST cache entry, is one unflatten_program can walk safely.
+ * Every span has to lie within the source, every child, span and list index within its array, and the nodes have
+ * to form a tree in pre-order: a child comes after its parent, has the kind its slot expects and no other parent.
+ * @param source_len Length of the text the spans point into.
+ * @return 1 if the AST is well formed, 0 otherwise.
+ */
+int flat_ast_check(FlatAst *ast, size_t source_len) {
+    for (uint32_t i = 0; i < ast->span_count; i++) {
+        if ((uint64_t)ast->spans[i].offset + ast->spans[i].len > source_len) return 0;
+    }
+    if (ast->root >= ast->node_count || ast->nodes[ast->root].kind != FLAT_BLOCK) return 0;
+
+    uint8_t *has_parent = (uint8_t *)s_calloc(ast->node_count, sizeof(uint8_t));
+    has_parent[ast->root] = 1;
+    int ok = 1;
+    for (FlatRef ref = 0; ok && ref < ast->node_count; ref++) {
+        ok = check_node(ast, has_parent, ref);
+    }
+    s_free(has_parent);
+    return ok;
+}
+
+void free_flat_ast(FlatAst *ast) {
+    s_free(ast->nodes);
+    s_free(ast->spans);
+    s_free(ast->extra);
+    memset(ast, 0, sizeof(FlatAst));
+}
+
+size_t flat_ast_bytes(FlatAst *ast) {
+    return ast->node_count * sizeof(FlatNode) + ast->span_count * sizeof(FlatSpan) + ast->extra_count * sizeof(uint32_t);
+}
+
+// Turns a span back into a token (type and value are not kept, only the text)
+TokenData flat_span_token(FlatAst *ast, uint32_t span) {
+    TokenData tok = {
+        .start = ast->source + ast->spans[span].offset,
+        .len = ast->spans[span].len,
+    };
+    return tok;
+}
+
+uint32_t flat_block_count(FlatAst *ast, FlatRef block) {
+    return ast->extra[ast->nodes[block].a];
+}
+
+FlatRef flat_block_child(FlatAst *ast, FlatRef block, uint32_t i) {
+    return ast->extra[ast->nodes[block].a + 1 + i];
+}
+
+/**
+ * Formats a statement of the flat AST.
+ * The output is the same as stmt_to_string gives for the statement it was built from.
+ * @return A heap string the caller frees.
+ */
+char *flat_stmt_to_string(FlatAst *ast, FlatRef stmt) {
+    Writer writer;
+    writer_init_buffer(&writer);
+    write_flat_stmt(&writer, ast, stmt);
+    return writer_take(&writer);
+}
+
+// Appends an empty node and returns its index, the caller fills it in
+// No pointer to a node is kept across calls since the array may move
+static FlatRef add_node(FlatAst *ast, FlatKind kind) {
+    if (ast->node_count == ast->node_capacity) {
+        ast->node_capacity = ast->node_capacity ? ast->node_capacity * 2 : 64;
+        ast->nodes = (FlatNode *)s_realloc(ast->nodes, ast->node_capacity * sizeof(FlatNode));
+    }
+
+    FlatNode *node = &ast->nodes[ast->node_count];
+    memset(node, 0, sizeof(FlatNode));
+    node->kind = (uint8_t)kind;
+    return ast->node_count++;
+}
+
+static uint32_t add_span(FlatAst *ast, TokenData tok) {
+    if (ast->span_count == ast->span_capacity) {
+        ast->span_capacity = ast->span_capacity ? ast->span_capacity * 2 : 64;
+        ast->spans = (FlatSpan *)s_realloc(ast->spans, ast->span_capacity * sizeof(FlatSpan));
+    }
+
+    // tokens the parser made up (like a missing return type) have no text
+    ast->spans[ast->span_count].offset = tok.start ? (uint32_t)(tok.start - ast->source) : 0;
+    ast->spans[ast->span_count].len = (uint32_t)tok.len;
+    return ast->span_count++;
+}
+
+// Makes room for count entries in the extra array and returns the index of the first
+static uint32_t reserve_extra(FlatAst *ast, uint32_t count) {
+    while (ast->extra_count + count > ast->extra_capacity) {
+        ast->extra_capacity = ast->extra_capacity ? ast->extra_capacity * 2 : 64;
+        ast->extra = (uint32_t *)s_realloc(ast->extra, ast->extra_capacity * sizeof(uint32_t));
+    }
+
+    uint32_t index = ast->extra_count;
+    ast->extra_count += count;
+    return index;
+}
+
+static FlatRef flatten_expr(FlatAst *ast, Expr *expr) {
+    if (!expr) return FLAT_NONE;
+
+    FlatRef ref;
+    switch (expr->type) {
+        case EXPR_BINARY: {
+            ref = add_node(ast, FLAT_BINARY);
+            FlatRef left = flatten_expr(ast, expr->binary.left);
+            FlatRef right = flatten_expr(ast, expr->binary.right);
+            ast->nodes[ref].op = (uint8_t)expr->binary.op_token.type;
+            ast->nodes[ref].a = left;
+            ast->nodes[ref].b = right;
+            ast->nodes[ref].c = add_span(ast, expr->binary.op_token);
+            return ref;
+        }
+        case EXPR_UNARY: {
+            ref = add_node(ast, FLAT_UNARY);
+            FlatRef right = flatten_expr(ast, expr->unary.right);
+            ast->nodes[ref].op = (uint8_t)expr->unary.op_token.type;
+            ast->nodes[ref].a = right;
+            ast->nodes[ref].c = add_span(ast, expr->unary.op_token);
+            return ref;
+        }
+        case EXPR_INCREMENT:
+            ref = add_node(ast, FLAT_INCREMENT);
+            ast->nodes[ref].op = (uint8_t)expr->increment.op_token.type;
+            ast->nodes[ref].flags = expr->increment.is_prefix ? FLAT_PREFIX : 0;
+            ast->nodes[ref].a = add_span(ast, expr->increment.identifier);
+            ast->nodes[ref].b = add_span(ast, expr->increment.op_token);
+            return ref;
+        case EXPR_IDENTIFIER:
+            ref = add_node(ast, FLAT_IDENTIFIER);
+            ast->nodes[ref].a = add_span(ast, expr->identifier.tok);
+            return ref;
+        case EXPR_LITERAL_INT:
+            ref = add_node(ast, FLAT_INT);
+            ast->nodes[ref].a = (uint32_t)expr->int_literal.tok.int_val;
+            ast->nodes[ref].b = add_span(ast, expr->int_literal.tok);
+            return ref;
+        case EXPR_LITERAL_STRING:
+            ref = add_node(ast, FLAT_STRING);
+            ast->nodes[ref].a = add_span(ast, expr->str_literal.tok);
+            return ref;
+        case EXPR_LITERAL_BOOL:
+            ref = add_node(ast, FLAT_BOOL);
+            ast->nodes[ref].a = (uint32_t)expr->bool_literal.value;
+            return ref;
+        case EXPR_FUNC_CALL: {
+            ref = add_node(ast, FLAT_CALL);
+            int arg_count = expr->func_call.arg_count;
+            uint32_t list = reserve_extra(ast, arg_count + 1);
+            ast->extra[list] = arg_count;
+            for (int i = 0; i < arg_count; i++) {
+                FlatRef arg = flatten_expr(ast, expr->func_call.args[i]);
+                ast->extra[list + 1 + i] = arg;
+            }
+            ast->nodes[ref].a = add_span(ast, expr->func_call.tok_function);
+            ast->nodes[ref].b = list;
+            return ref;
+        }
+    }
+    return FLAT_NONE;
+}
+
+static FlatRef flatten_stmt(FlatAst *ast, Stmt *stmt) {
+    if (!stmt) return FLAT_NONE;
+
+    FlatRef ref;
+    switch (stmt->type) {
+        case STMT_VAR_DECL:
+        case STMT_GLOBAL_VAR_DECL: {
+            // both kinds share the VarDeclStmt layout
+            ref = add_node(ast, stmt->type == STMT_VAR_DECL ? FLAT_VAR_DECL : FLAT_GLOBAL_VAR_DECL);
+            FlatRef value = flatten_expr(ast, stmt->var_decl.value);
+            ast->nodes[ref].a = add_span(ast, stmt->var_decl.type);
+            ast->nodes[ref].b = add_span(ast, stmt->var_decl.tok_identifier);
+            ast->nodes[ref].c = value;
+            return ref;
+        }
+        case STMT_VAR_ASSIGN: {
+            ref = add_node(ast, FLAT_VAR_ASSIGN);
+            FlatRef value = flatten_expr(ast, stmt->var_assign.new_value);
+            ast->nodes[ref].op = (uint8_t)stmt->var_assign.modifying_tok.type;
+            ast->nodes[ref].a = add_span(ast, stmt->var_assign.tok_identifier);
+            ast->nodes[ref].b = add_span(ast, stmt->var_assign.modifying_tok);
+            ast->nodes[ref].c = value;
+            return ref;
+        }
+        case STMT_FUNC_DECL: {
+            FuncDeclStmt *func = &stmt->func_decl;
+            ref = add_node(ast, FLAT_FUNC_DECL);
+
+            uint32_t list = reserve_extra(ast, 2 + 2 * func->parameter_count);
+            ast->extra[list] = add_span(ast, func->tok_return_type);
+            ast->extra[list + 1] = func->parameter_count;
+            for (int i = 0; i < func->parameter_count; i++) {
+                ast->extra[list + 2 + 2 * i] = add_span(ast, func->parameter_names[i]);
+                ast->extra[list + 3 + 2 * i] = add_span(ast, func->parameter_types[i]);
+            }
+
+            ast->nodes[ref].a = add_span(ast, func->tok_identifier);
+            FlatRef body = flatten_stmt(ast, func->body);
+            ast->nodes[ref].b = body;
+            ast->nodes[ref].c = list;
+            return ref;
+        }
+        case STMT_RETURN: {
+            ref = add_node(ast, FLAT_RETURN);
+            FlatRef value = flatten_expr(ast, stmt->return_stmt.value);
+            ast->nodes[ref].a = value;
+            return ref;
+        }
+        case STMT_EXPR: {
+            ref = add_node(ast, FLAT_EXPR_STMT);
+            FlatRef value = flatten_expr(ast, stmt->expression_stmt.value);
+            ast->nodes[ref].a = value;
+            return ref;
+        }
+        case STMT_BLOCK:
+            return flatten_block(ast, stmt->block_stmt.statements, stmt->block_stmt.stmt_count);
+        case STMT_IF: {
+            IfStmt *if_stmt = &stmt->if_stmt;
+            ref = add_node(ast, FLAT_IF);
+            FlatRef condition = flatten_expr(ast, if_stmt->condition);
+            FlatRef then_branch = flatten_stmt(ast, if_stmt->then_branch);
+
+            uint32_t list = reserve_extra(ast, 2 + 2 * if_stmt->else_if_count);
+            ast->extra[list] = if_stmt->else_if_count;
+            for (int i = 0; i < if_stmt->else_if_count; i++) {
+                FlatRef else_if_condition = flatten_expr(ast, if_stmt->else_if_conditions[i]);
+                ast->extra[list + 1 + 2 * i] = else_if_condition;
+                FlatRef else_if_branch = flatten_stmt(ast, if_stmt->else_if_branches[i]);
+                ast->extra[list + 2 + 2 * i] = else_if_branch;
+            }
+            FlatRef else_branch = flatten_stmt(ast, if_stmt->else_branch);
+            ast->extra[list + 1 + 2 * if_stmt->else_if_count] = else_branch;
+
+            ast->nodes[ref].a = condition;
+            ast->nodes[ref].b = then_branch;
+            ast->nodes[ref].c = list;
+            return ref;
+        }
+        case STMT_WHILE: {
+            ref = add_node(ast, FLAT_WHILE);
+            FlatRef condition = flatten_expr(ast, stmt->while_stmt.condition);
+            FlatRef body = flatten_stmt(ast, stmt->while_stmt.body);
+            ast->nodes[ref].a = condition;
+            ast->nodes[ref].b = body;
+            return ref;
+        }
+        default:
+            fprintf(stderr, "Cannot flatten statement type %d\n", stmt->type);
+            return FLAT_NONE;
+    }
+}
+
+static FlatRef flatten_block(FlatAst *ast, Stmt **statements, int stmt_count) {
+    FlatRef ref = add_node(ast, FLAT_BLOCK);
+    uint32_t list = reserve_extra(ast, stmt_count + 1);
+    ast->extra[list] = stmt_count;
+    for (int i = 0; i < stmt_count; i++) {
+        FlatRef child = flatten_stmt(ast, statements[i]);
+        ast->extra[list + 1 + i] = child;
+    }
+    ast->nodes[ref].a = list;
+    return ref;
+}
+
+// Like flat_span_token but with a type
+static TokenData span_token(FlatAst *ast, uint32_t span, Token type) {
+    TokenData tok = flat_span_token(ast, span);
+    tok.type = type;
+    return tok;
+}
+
+static Expr *expand_expr(FlatAst *ast, Arena *arena, FlatRef ref) {
+    if (ref == FLAT_NONE) return NULL;
+
+    FlatNode *node = &ast->nodes[ref];
+    switch (node->kind) {
+        case FLAT_BINARY: {
+            Expr *left = expand_expr(ast, arena, node->a);
+            Expr *right = expand_expr(ast, arena, node->b);
+            return binary_expr(arena, left, span_token(ast, node->c, (Token)node->op), right);
+        }
+        case FLAT_UNARY:
+            return unary_expr(arena, span_token(ast, node->c, (Token)node->op), expand_expr(ast, arena, node->a));
+        case FLAT_INCREMENT:
+            return increment_expr(arena, span_token(ast, node->b, (Token)node->op), span_token(ast, node->a, tok_identifier),
+                                  node->flags & FLAT_PREFIX);
+        case FLAT_IDENTIFIER:
+            return identifier_expr(arena, span_token(ast, node->a, tok_identifier));
+        case FLAT_INT: {
+            TokenData tok = span_token(ast, node->b, tok_number);
+            tok.int_val = (int)node->a;
+            return int_literal(arena, tok);
+        }
+        case FLAT_STRING:
+            return string_literal(arena, span_token(ast, node->a, tok_string));
+        case FLAT_BOOL:
+            return bool_literal(arena, (int)node->a);
+        case FLAT_CALL: {
+            uint32_t *list = &ast->extra[node->b];
+            int arg_count = (int)list[0];
+            Expr **args = arg_count > 0 ? (Expr **)arena_alloc(arena, arg_count * sizeof(Expr *)) : NULL;
+            for (int i = 0; i < arg_count; i++) {
+                args[i] = expand_expr(ast, arena, list[1 + i]);
+            }
+            return func_call(arena, span_token(ast, node->a, tok_identifier), args, arg_count);
+        }
+        default:
+            fprintf(stderr, "Cannot expand flat node kind %d\n", node->kind);
+            return NULL;
+    }
+}
+
+static Stmt *expand_stmt(FlatAst *ast, Arena *arena, FlatRef ref) {
+    if (ref == FLAT_NONE) return NULL;
+
+    FlatNode *node = &ast->nodes[ref];
+    switch (node->kind) {
+        case FLAT_VAR_DECL:
+            return var_decl_stmt(arena, span_token(ast, node->a, tok_type), span_token(ast, node->b, tok_identifier),
+                                 expand_expr(ast, arena, node->c));
+        case FLAT_GLOBAL_VAR_DECL:
+            return global_var_decl_stmt(arena, span_token(ast, node->a, tok_type), span_token(ast, node->b, tok_identifier),
+                                        expand_expr(ast, arena, node->c));
+        case FLAT_VAR_ASSIGN:
+            return var_assign_stmt(arena, span_token(ast, node->a, tok_identifier), span_token(ast, node->b, (Token)node->op),
+                                   expand_expr(ast, arena, node->c));
+        case FLAT_FUNC_DECL: {
+            uint32_t *list = &ast->extra[node->c];
+            int parameter_count = (int)list[1];
+            TokenData *parameter_names = NULL;
+            TokenData *parameter_types = NULL;
+            if (parameter_count > 0) {
+                parameter_names = (TokenData *)arena_alloc(arena, parameter_count * sizeof(TokenData));
+                parameter_types = (TokenData *)arena_alloc(arena, parameter_count * sizeof(TokenData));
+            }
+            for (int i = 0; i < parameter_count; i++) {
+                parameter_names[i] = span_token(ast, list[2 + 2 * i], tok_identifier);
+                parameter_types[i] = span_token(ast, list[3 + 2 * i], tok_type);
+            }
+            // a function without a return type has the zeroed token the parser left there
+            TokenData return_type = ast->spans[list[0]].len ? span_token(ast, list[0], tok_type) : (TokenData){0};
+            return func_decl_stmt(arena, span_token(ast, node->a, tok_identifier), expand_block(ast, arena, node->b),
+                                  return_type, parameter_names, parameter_types, parameter_count);
+        }
+        case FLAT_RETURN:
+            return return_stmt(arena, expand_expr(ast, arena, node->a));
+        case FLAT_EXPR_STMT:
+            return expression_stmt(arena, expand_expr(ast, arena, node->a));
+        case FLAT_BLOCK:
+            return expand_block(ast, arena, ref);
+        case FLAT_IF: {
+            Expr *condition = expand_expr(ast, arena, node->a);
+            Stmt *then_branch = expand_block(ast, arena, node->b);
+
+            uint32_t list = node->c;
+            int else_if_count = (int)ast->extra[list];
+            Expr **else_if_conditions = NULL;
+            Stmt **else_if_branches = NULL;
+            if (else_if_count > 0) {
+                else_if_conditions = (Expr **)arena_alloc(arena, else_if_count * sizeof(Expr *));
+                else_if_branches = (Stmt **)arena_alloc(arena, else_if_count * sizeof(Stmt *));
+            }
+            for (int i = 0; i < else_if_count; i++) {
+                else_if_conditions[i] = expand_expr(ast, arena, ast->extra[list + 1 + 2 * i]);
+                else_if_branches[i] = expand_block(ast, arena, ast->extra[list + 2 + 2 * i]);
+            }
+            Stmt *else_branch = expand_block(ast, arena, ast->extra[list + 1 + 2 * else_if_count]);
+            return if_stmt(arena, condition, then_branch, else_if_count, else_if_conditions, else_if_branches, else_branch);
+        }
+        case FLAT_WHILE: {
+            Expr *condition = expand_expr(ast, arena, node->a);
+            return while_stmt(arena, condition, expand_block(ast, arena, node->b));
+        }
+        default:
+            fprintf(stderr, "Cannot expand flat node kind %d\n", node->kind);
+            return NULL;
+    }
+}
+
+static Stmt *expand_block(FlatAst *ast, Arena *arena, FlatRef ref) {
+    if (ref == FLAT_NONE) return NULL;
+
+    uint32_t count = flat_block_count(ast, ref);
+    Stmt **statements = count > 0 ? (Stmt **)arena_alloc(arena, count * sizeof(Stmt *)) : NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        statements[i] = expand_stmt(ast, arena, flat_block_child(ast, ref, i));
+    }
+    return block_stmt(arena, statements, (int)count);
+}
+
+// Checks the indices one node holds, following the layout documented on FlatKind
+static int check_node(FlatAst *ast, uint8_t *has_parent, FlatRef ref) {
+    FlatNode *node = &ast->nodes[ref];
+    // tok_while is the last Token
+    if (node->op > tok_while) return 0;
+
+    uint32_t count;
+    switch (node->kind) {
+        case FLAT_BINARY:
+            return check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 0) &&
+                   check_child(ast, has_parent, ref, node->b, CHILD_EXPR, 0) && node->c < ast->span_count;
+        case FLAT_UNARY:
+            return check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 0) && node->c < ast->span_count;
+        case FLAT_INCREMENT:
+        case FLAT_VAR_ASSIGN:
+            if (node->a >= ast->span_count || node->b >= ast->span_count) return 0;
+            return node->kind == FLAT_INCREMENT || check_child(ast, has_parent, ref, node->c, CHILD_EXPR, 0);
+        case FLAT_IDENTIFIER:
+        case FLAT_STRING:
+            return node->a < ast->span_count;
+        case FLAT_INT:
+            return node->b < ast->span_count;
+        case FLAT_BOOL:
+            return 1;
+        case FLAT_CALL:
+            if (node->a >= ast->span_count || !check_list(ast, node->b, 0, 1, 0, &count)) return 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (!check_child(ast, has_parent, ref, ast->extra[node->b + 1 + i], CHILD_EXPR, 0)) return 0;
+            }
+            return 1;
+        case FLAT_VAR_DECL:
+        case FLAT_GLOBAL_VAR_DECL:
+            return node->a < ast->span_count && node->b < ast->span_count &&
+                   check_child(ast, has_parent, ref, node->c, CHILD_EXPR, 0);
+        case FLAT_FUNC_DECL:
+            if (node->a >= ast->span_count || !check_child(ast, has_parent, ref, node->b, CHILD_BLOCK, 0)) return 0;
+            if (!check_list(ast, node->c, 1, 2, 0, &count) || ast->extra[node->c] >= ast->span_count) return 0;
+            for (uint32_t i = 0; i < 2 * count; i++) {
+                if (ast->extra[node->c + 2 + i] >= ast->span_count) return 0;
+            }
+            return 1;
+        case FLAT_RETURN:
+            return check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 1);
+        case FLAT_EXPR_STMT:
+            return check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 0);
+        case FLAT_BLOCK:
+            if (!check_list(ast, node->a, 0, 1, 0, &count)) return 0;
+            for (uint32_t i = 0; i < count; i++) {
+                if (!check_child(ast, has_parent, ref, ast->extra[node->a + 1 + i], CHILD_STMT, 0)) return 0;
+            }
+            return 1;
+        case FLAT_IF:
+            if (!check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 0) ||
+                !check_child(ast, has_parent, ref, node->b, CHILD_BLOCK, 0) || !check_list(ast, node->c, 0, 2, 1, &count)) {
+                return 0;
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                if (!check_child(ast, has_parent, ref, ast->extra[node->c + 1 + 2 * i], CHILD_EXPR, 0) ||
+                    !check_child(ast, has_parent, ref, ast->extra[node->c + 2 + 2 * i], CHILD_BLOCK, 0)) {
+                    return 0;
+                }
+            }
+            return check_child(ast, has_parent, ref, ast->extra[node->c + 1 + 2 * count], CHILD_BLOCK, 1);
+        case FLAT_WHILE:
+            return check_child(ast, has_parent, ref, node->a, CHILD_EXPR, 0) &&
+                   check_child(ast, has_parent, ref, node->b, CHILD_BLOCK, 0);
+        default:
+            return 0;
+    }
+}
+
+// A child comes after its parent and has no other one, so walking the tree can neither loop nor visit a node twice
+static int check_child(FlatAst *ast, uint8_t *has_parent, FlatRef parent, FlatRef child, ChildKind kind, int optional) {
+    if (child == FLAT_NONE) return optional;
+    if (child <= parent || child >= ast->node_count || has_parent[child]) return 0;
+    has_parent[child] = 1;
+
+    uint8_t child_kind = ast->nodes[child].kind;
+    switch (kind) {
+        case CHILD_EXPR:
+            return child_kind <= FLAT_CALL;
+        case CHILD_STMT:
+            return child_kind >= FLAT_VAR_DECL && child_kind <= FLAT_WHILE;
+        case CHILD_BLOCK:
+            return child_kind == FLAT_BLOCK;
+    }
+    return 0;
+}
+
+// A list in the extra array holds its count count_at entries in, then count * stride entries and trailing more
+static int check_list(FlatAst *ast, uint32_t list, uint32_t count_at, uint32_t stride, uint32_t trailing, uint32_t *count) {
+    if ((uint64_t)list + count_at >= ast->extra_count) return 0;
+    *count = ast->extra[list + count_at];
+    return (uint64_t)list + count_at + 1 + (uint64_t)*count * stride + trailing <= ast->extra_count;
+}
+
+static void write_span(Writer *writer, FlatAst *ast, uint32_t span) {
+    write_bytes(writer, ast->source + ast->spans[span].offset, ast->spans[span].len);
+}
+
+static void write_flat_expr(Writer *writer, FlatAst *ast, FlatRef ref) {
+    if (ref == FLAT_NONE) {
+        write_str(writer, "null");
+        return;
+    }
+
+    FlatNode *node = &ast->nodes[ref];
+    switch (node->kind) {
+        case FLAT_BINARY:
+            write_str(writer, "BinaryExpr(");
+            write_flat_expr(writer, ast, node->a);
+            write_str(writer, " ");
+            write_span(writer, ast, node->c);
+            write_str(writer, " ");
+            write_flat_expr(writer, ast, node->b);
+            write_str(writer, ")");
+            return;
+        case FLAT_INCREMENT:
+            write_str(writer, "IncrementExpr(");
+            write_span(writer, ast, node->flags & FLAT_PREFIX ? node->b : node->a);
+            write_span(writer, ast, node->flags & FLAT_PREFIX ? node->a : node->b);
+            write_str(writer, ")");
+            return;
+        case FLAT_UNARY:
+            write_str(writer, "UnaryExpr(");
+            write_span(writer, ast, node->c);
+            write_str(writer, " ");
+            write_flat_expr(writer, ast, node->a);
+            write_str(writer, ")");
+            return;
+        case FLAT_IDENTIFIER:
+            write_str(writer, "IdentifierExpr(");
+            write_span(writer, ast, node->a);
+            write_str(writer, ")");
+            return;
+        case FLAT_INT:
+            write_str(writer, "IntLiteral(");
+            write_span(writer, ast, node->b);
+            write_str(writer, ")");
+            return;
+        case FLAT_STRING: {
+            FlatSpan span = ast->spans[node->a];
+            char *value = unescape_string(ast->source + span.offset, span.len);
+            write_str(writer, "StringLiteral(\"");
+            write_escaped(writer, value, strlen(value));
+            write_str(writer, "\")");
+            s_free(value);
+            return;
+        }
+        case FLAT_BOOL:
+            write_str(writer, node->a ? "BoolLiteral(true)" : "BoolLiteral(false)");
+            return;
+        case FLAT_CALL: {
+            uint32_t *args = &ast->extra[node->b];
+            write_str(writer, "FuncCallExpr(");
+            write_span(writer, ast, node->a);
+            if (args[0] > 0) {
+                write_str(writer, "(");
+                for (uint32_t i = 0; i < args[0]; i++) {
+                    if (i > 0) write_str(writer, ", ");
+                    write_flat_expr(writer, ast, args[1 + i]);
+                }
+                write_str(writer, ")");
+            }
+            write_str(writer, ")");
+            return;
+        }
+        default:
+            write_str(writer, "Unknown Expression");
+            return;
+    }
+}
+
+// Prints a statement of the flat AST exactly like write_stmt prints the statement it was built from
+void write_flat_stmt(Writer *writer, FlatAst *ast, FlatRef ref) {
+    FlatNode *node = &ast->nodes[ref];
+    switch (node->kind) {
+        case FLAT_FUNC_DECL: {
+            uint32_t *list = &ast->extra[node->c];
+            uint32_t parameter_count = list[1];
+            write_str(writer, "FuncDeclStmt(");
+            write_span(writer, ast, node->a);
+            if (parameter_count > 0) {
+                write_str(writer, ", (");
+                for (uint32_t i = 0; i < parameter_count; i++) {
+                    if (i > 0) write_str(writer, ", ");
+                    write_span(writer, ast, list[2 + 2 * i]);
+                    write_str(writer, ": ");
+                    write_span(writer, ast, list[3 + 2 * i]);
+                }
+                write_str(writer, ")");
+            }
+            write_str(writer, ")");
+            write_flat_block_body(writer, ast, node->b, "\n  ");
+            return;
+        }
+        case FLAT_VAR_DECL:
+        case FLAT_GLOBAL_VAR_DECL:
+            write_str(writer, node->kind == FLAT_VAR_DECL ? "VarDeclStmt(" : "GlobalVarDeclStmt(");
+            write_span(writer, ast, node->a);
+            write_str(writer, " ");
+            write_span(writer, ast, node->b);
+            write_str(writer, " = ");
+            write_flat_expr(writer, ast, node->c);
+            write_str(writer, ")");
+            return;
+        case FLAT_VAR_ASSIGN:
+            write_str(writer, "VarAssignStmt(");
+            write_span(writer, ast, node->a);
+            write_str(writer, " ");
+            write_span(writer, ast, node->b);
+            write_str(writer, " ");
+            write_flat_expr(writer, ast, node->c);
+            write_str(writer, ")");
+            return;
+        case FLAT_RETURN:
+            write_str(writer, "ReturnStmt(");
+            if (node->a != FLAT_NONE) write_flat_expr(writer, ast, node->a);
+            write_str(writer, ")");
+            return;
+        case FLAT_EXPR_STMT:
+            write_str(writer, "ExprStmt(");
+            write_flat_expr(writer, ast, node->a);
+            write_str(writer, ")");
+            return;
+        case FLAT_IF: {
+            write_str(writer, "IfStmt(");
+            write_flat_expr(writer, ast, node->a);
+            write_str(writer, ")");
+            write_flat_block_body(writer, ast, node->b, "\n    ");
+
+            uint32_t list = node->c;
+            uint32_t else_if_count = ast->extra[list];
+            for (uint32_t i = 0; i < else_if_count; i++) {
+                write_str(writer, "\n  ElseIf(");
+                write_flat_expr(writer, ast, ast->extra[list + 1 + 2 * i]);
+                write_str(writer, ")");
+                write_flat_block_body(writer, ast, ast->extra[list + 2 + 2 * i], "\n    ");
+            }
+
+            FlatRef else_branch = ast->extra[list + 1 + 2 * else_if_count];
+            if (else_branch != FLAT_NONE) {
+                write_str(writer, "\n  Else");
+                write_flat_block_body(writer, ast, else_branch, "\n    ");
+            }
+            return;
+        }
+        case FLAT_WHILE:
+            write_str(writer, "WhileStmt(");
+            write_flat_expr(writer, ast, node->a);
+            write_str(writer, ")");
+            write_flat_block_body(writer, ast, node->b, "\n    ");
+            return;
+        case FLAT_BLOCK:
+            write_str(writer, "BlockStmt()");
+            write_flat_block_body(writer, ast, ref, "\n    ");
+            return;
+        default:
+            write_str(writer, "Unknown Statement Type");
+            return;
+    }
+}
+
+// Prints every statement of a block, each on its own line after indent
+static void write_flat_block_body(Writer *writer, FlatAst *ast, FlatRef block, const char *indent) {
+    uint32_t count = flat_block_count(ast, block);
+    for (uint32_t i = 0; i < count; i++) {
+        write_str(writer, indent);
+        write_flat_stmt(writer, ast, flat_block_child(ast, block, i));
+    }
+}
@@ -0,0 +1,528 @@
+#include "jit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <llvm-c/BitReader.h>
+#include <llvm-c/BitWriter.h>
+#include <llvm-c/Comdat.h>
+#include <llvm-c/Error.h>
+#include <llvm-c/LLJIT.h>
+#include <llvm-c/Orc.h>
+
+#include "memory.h"
+#include "workers.h"
+
+// A share of the module's functions, compiled to an object file on its own thread
+// Every share gets its own copy of the module, context and target machine, none of them may be used by two threads
+typedef struct {
+    const char *bitcode; // the whole module, shared by every partition
+    size_t bitcode_len;
+    const TargetOptions *target;
+    int first; // functions of the module with an index in [first, last) are defined by this partition
+    int last;
+    int defines_globals;
+    LLVMMemoryBufferRef object; // NULL if it could not be compiled
+    char *error;
+} JitPartition;
+
+// What the functions compiled on their first call share, kept until the JIT is gone
+// Nothing here is used by two threads, LLJIT compiles a body on the thread that first calls its stub
+typedef struct LazyJit LazyJit;
+
+// A function of the module that is compiled when its stub is first called
+typedef struct {
+    LazyJit *jit;
+    int index; // of the function in the module
+} LazyBody;
+
+struct LazyJit {
+    LLVMMemoryBufferRef bitcode; // the whole module, every body is read from it on its own
+    LLVMTargetMachineRef target_machine;
+    LLVMOrcObjectLayerRef object_layer;
+    LLVMOrcIndirectStubsManagerRef stubs;
+    LLVMOrcLazyCallThroughManagerRef call_through;
+    LazyBody *bodies; // indexed like the module's functions, only the ones with a stub are set
+    int optimize_functions;
+};
+
+static int add_compiled(LLVMOrcLLJITRef jit, LLVMOrcJITDylibRef dylib, CodeGen *codegen, int compile_threads);
+static int add_lazy(LLVMOrcLLJITRef jit, LLVMOrcJITDylibRef dylib, CodeGen *codegen, LazyJit *lazy);
+static void free_lazy(LazyJit *lazy);
+static LLVMMemoryBufferRef compile_lazy(LazyJit *lazy, int index, char **error);
+static void materialize_function(void *ctx, LLVMOrcMaterializationResponsibilityRef responsibility);
+static void discard_function(void *ctx, LLVMOrcJITDylibRef dylib, LLVMOrcSymbolStringPoolEntryRef symbol);
+static void destroy_function(void *ctx);
+static void lazy_compile_failed(void);
+static void delete_unused_locals(LLVMModuleRef module);
+static char *body_name(const char *name, size_t len);
+static int split_functions(LLVMModuleRef module, int compile_threads, JitPartition *partitions);
+static void *compile_partition(void *arg);
+static void keep_partition(LLVMModuleRef module, JitPartition *partition);
+static void make_globals_external(LLVMModuleRef module);
+static void declare_only(LLVMModuleRef module, LLVMValueRef func);
+static size_t count_instructions(LLVMValueRef func);
+static int is_local(LLVMValueRef global);
+static int report_error(LLVMErrorRef err, const char *what);
+
+/**
+ * Runs the program's main with ORC LLJIT.
+ * Compiled objects are handed to LLJIT, which links them and resolves main, calls between them and into the
+ * C library. main is then called directly through a function pointer.
+ * @param options Either the whole module is compiled up front, on up to compile_threads threads, or every function
+ * is put behind a stub and compiled when it is first called.
+ * @return main's return value, or -1 if the module could not be compiled or has no main.
+ */
+int run_jit(CodeGen *codegen, const JitOptions *options) {
+    // Verify the module
+    char *error = NULL;
+    if (LLVMVerifyModule(codegen->module, LLVMAbortProcessAction, &error) != 0) {
+        fprintf(stderr, "Module verification failed: %s\n", error);
+        LLVMDisposeMessage(error);
+        return -1;
+    }
+    LLVMDisposeMessage(error);
+
+    LLVMOrcLLJITRef jit = NULL;
+    int failed = report_error(LLVMOrcCreateLLJIT(&jit, NULL), "Failed to create the JIT");
+
+    LLVMOrcJITDylibRef dylib = failed ? NULL : LLVMOrcLLJITGetMainJITDylib(jit);
+    if (!failed) {
+        // printf and the rest of the C library come from this process
+        LLVMOrcDefinitionGeneratorRef process_symbols;
+        failed = report_error(LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+                                  &process_symbols, LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL),
+                              "Failed to look up the process's symbols");
+        if (!failed) LLVMOrcJITDylibAddGenerator(dylib, process_symbols);
+    }
+
+    // the stubs and what the bodies are compiled from have to outlive the JIT
+    LazyJit lazy = {0};
+    if (!failed && options->lazy) {
+        lazy.optimize_functions = options->optimize_functions;
+        failed = add_lazy(jit, dylib, codegen, &lazy);
+    } else if (!failed) {
+        failed = add_compiled(jit, dylib, codegen, options->compile_threads);
+    }
+
+    // Find and run the main function, looking it up links the objects
+    int return_value = -1;
+    LLVMOrcExecutorAddress main_address = 0;
+    if (!failed && !report_error(LLVMOrcLLJITLookup(jit, &main_address, "main"), "Main function not found")) {
+        int (*main_func)(void) = (int (*)(void))(uintptr_t)main_address;
+        return_value = main_func();
+    }
+
+    if (jit) report_error(LLVMOrcDisposeLLJIT(jit), "Failed to tear down the JIT");
+    free_lazy(&lazy);
+    return return_value;
+}
+
+/**
+ * Compiles the whole module and adds it to the JIT.
+ * The LLVM C API can only give LLJIT a single target machine, which two threads cannot compile with at once,
+ * so the threads compile with their own ones and LLJIT gets finished objects.
+ * @param compile_threads At most this many threads compile, fewer for a module below JIT_MIN_PARTITION_INSTRUCTIONS
+ * per thread. One thread compiles the module as it is, without a copy.
+ * @return 1 if any part of the module could not be compiled or added, 0 otherwise.
+ */
+static int add_compiled(LLVMOrcLLJITRef jit, LLVMOrcJITDylibRef dylib, CodeGen *codegen, int compile_threads) {
+    if (compile_threads < 1) compile_threads = 1;
+    JitPartition *partitions = s_calloc(compile_threads, sizeof(JitPartition));
+    int partition_count = split_functions(codegen->module, compile_threads, partitions);
+
+    if (partition_count == 1) {
+        partitions[0].target = &codegen->target;
+        if (LLVMTargetMachineEmitToMemoryBuffer(codegen->target_machine, codegen->module, LLVMObjectFile,
+                                                &partitions[0].error, &partitions[0].object)) {
+            partitions[0].object = NULL;
+        }
+    } else {
+        // each thread reads its own copy of the module from this
+        LLVMMemoryBufferRef bitcode = LLVMWriteBitcodeToMemoryBuffer(codegen->module);
+        for (int i = 0; i < partition_count; i++) {
+            partitions[i].bitcode = LLVMGetBufferStart(bitcode);
+            partitions[i].bitcode_len = LLVMGetBufferSize(bitcode);
+            partitions[i].target = &codegen->target;
+        }
+        run_workers(partitions, sizeof(JitPartition), partition_count, compile_partition);
+        LLVMDisposeMemoryBuffer(bitcode);
+    }
+
+    // LLJIT owns every object it was handed, the rest are disposed of here
+    int failed = 0;
+    for (int i = 0; i < partition_count; i++) {
+        JitPartition *partition = &partitions[i];
+        if (!partition->object) {
+            fprintf(stderr, "Failed to compile the module: %s\n", partition->error ? partition->error : "unknown error");
+            failed = 1;
+        } else if (failed) {
+            LLVMDisposeMemoryBuffer(partition->object);
+        } else {
+            failed = report_error(LLVMOrcLLJITAddObjectFile(jit, dylib, partition->object),
+                                  "Failed to add the compiled module to the JIT");
+        }
+        if (partition->error) LLVMDisposeMessage(partition->error);
+    }
+    s_free(partitions);
+    return failed;
+}
+
+/**
+ * Splits the functions the module defines into contiguous runs of about the same number of instructions.
+ * @param partitions Room for compile_threads partitions, their ranges of function indices are filled in.
+ * @return How many partitions there are, 1 for a module too small to be worth splitting.
+ */
+static int split_functions(LLVMModuleRef module, int compile_threads, JitPartition *partitions) {
+    size_t total = 0;
+    int function_count = 0;
+    for (LLVMValueRef func = LLVMGetFirstFunction(module); func; func = LLVMGetNextFunction(func)) {
+        function_count++;
+        if (LLVMIsDeclaration(func) || is_local(func)) continue;
+        total += count_instructions(func);
+    }
+
+    int partition_count = compile_threads;
+    if ((size_t)partition_count > total / JIT_MIN_PARTITION_INSTRUCTIONS) {
+        partition_count = (int)(total / JIT_MIN_PARTITION_INSTRUCTIONS);
+    }
+    if (partition_count < 1) partition_count = 1;
+
+    partitions[0].defines_globals = 1;
+    if (partition_count == 1) {
+        partitions[0].last = function_count;
+        return 1;
+    }
+
+    // a partition ends once it has its share of what is left
+    int index = 0;
+    int current = 0;
+    size_t in_partition = 0;
+    size_t share = total / partition_count;
+    for (LLVMValueRef func = LLVMGetFirstFunction(module); func; func = LLVMGetNextFunction(func), index++) {
+        if (LLVMIsDeclaration(func) || is_local(func)) continue;
+        in_partition += count_instructions(func);
+        if (in_partition >= share && current < partition_count - 1) {
+            partitions[current].last = index + 1;
+            partitions[++current].first = index + 1;
+            total -= in_partition;
+            in_partition = 0;
+            share = total / (partition_count - current);
+        }
+    }
+    partitions[current].last = function_count;
+    return current + 1;
+}
+
+// Reads a copy of the module into a context of its own and compiles this partition's part of it
+static void *compile_partition(void *arg) {
+    JitPartition *partition = (JitPartition *)arg;
+
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMMemoryBufferRef buffer =
+        LLVMCreateMemoryBufferWithMemoryRange(partition->bitcode, partition->bitcode_len, "phi_module", 0);
+    LLVMModuleRef module;
+    LLVMBool failed = LLVMParseBitcodeInContext2(context, buffer, &module);
+    LLVMDisposeMemoryBuffer(buffer);
+
+    if (!failed) {
+        keep_partition(module, partition);
+        LLVMTargetMachineRef machine = create_target_machine(partition->target);
+        if (LLVMTargetMachineEmitToMemoryBuffer(machine, module, LLVMObjectFile, &partition->error,
+                                                &partition->object)) {
+            partition->object = NULL;
+        }
+        LLVMDisposeTargetMachine(machine);
+        LLVMDisposeModule(module);
+    }
+    LLVMContextDispose(context);
+    return NULL;
+}
+
+// Functions other partitions define are replaced by declarations, so their bodies are neither compiled nor kept here
+// Their globals become available_externally
+// Internal functions and private globals like string literals stay, each partition gets its own copies
+static void keep_partition(LLVMModuleRef module, JitPartition *partition) {
+    int function_count = 0;
+    for (LLVMValueRef func = LLVMGetFirstFunction(module); func; func = LLVMGetNextFunction(func)) function_count++;
+
+    // the declarations are added at the end, past the functions looked at
+    LLVMValueRef func = LLVMGetFirstFunction(module);
+    for (int index = 0; index < function_count; index++) {
+        LLVMValueRef next = LLVMGetNextFunction(func);
+        if (!LLVMIsDeclaration(func) && !is_local(func) && (index < partition->first || index >= partition->last)) {
+            declare_only(module, func);
+        }
+        func = next;
+    }
+
+    if (!partition->defines_globals) make_globals_external(module);
+}
+
+// Globals another object defines are still there to refer to but not emitted
+static void make_globals_external(LLVMModuleRef module) {
+    for (LLVMValueRef global = LLVMGetFirstGlobal(module); global; global = LLVMGetNextGlobal(global)) {
+        if (LLVMIsDeclaration(global) || is_local(global)) continue;
+        LLVMSetComdat(global, NULL);
+        LLVMSetLinkage(global, LLVMAvailableExternallyLinkage);
+    }
+}
+
+/**
+ * Puts every function the module defines behind a lazy stub, and adds the module's globals compiled.
+ * A stub has the function's name, so calls from main or from other bodies all go through one. The first call
+ * compiles the function's body, which is defined under the name with JIT_LAZY_BODY_SUFFIX, and later calls jump
+ * straight to it. Bodies are read from bitcode of the module one at a time, so a function that is never called is
+ * never read, optimized or compiled.
+ * @return 1 if the stubs or the globals could not be set up, 0 otherwise.
+ */
+static int add_lazy(LLVMOrcLLJITRef jit, LLVMOrcJITDylibRef dylib, CodeGen *codegen, LazyJit *lazy) {
+    const char *triple = LLVMOrcLLJITGetTripleString(jit);
+    lazy->stubs = LLVMOrcCreateLocalIndirectStubsManager(triple);
+    if (report_error(LLVMOrcCreateLocalLazyCallThroughManager(triple, LLVMOrcLLJITGetExecutionSession(jit),
+                                                              (LLVMOrcJITTargetAddress)(uintptr_t)lazy_compile_failed,
+                                                              &lazy->call_through),
+                     "Failed to set up lazy compilation")) {
+        return 1;
+    }
+    lazy->bitcode = LLVMWriteBitcodeToMemoryBuffer(codegen->module);
+    lazy->target_machine = create_target_machine(&codegen->target);
+    lazy->object_layer = LLVMOrcLLJITGetObjLinkingLayer(jit);
+
+    // The globals are compiled now, every body refers to them
+    char *error = NULL;
+    LLVMMemoryBufferRef globals = compile_lazy(lazy, -1, &error);
+    if (!globals) {
+        fprintf(stderr, "Failed to compile the module's globals: %s\n", error ? error : "unknown error");
+        if (error) LLVMDisposeMessage(error);
+        return 1;
+    }
+    if (report_error(LLVMOrcLLJITAddObjectFile(jit, dylib, globals), "Failed to add the module's globals to the JIT")) {
+        return 1;
+    }
+
+    int function_count = 0;
+    for (LLVMValueRef func = LLVMGetFirstFunction(codegen->module); func; func = LLVMGetNextFunction(func)) {
+        function_count++;
+    }
+    lazy->bodies = s_calloc(function_count, sizeof(LazyBody));
+    LLVMOrcCSymbolAliasMapPair *stubs = s_malloc(function_count * sizeof(LLVMOrcCSymbolAliasMapPair));
+    int stub_count = 0;
+
+    int failed = 0;
+    int index = 0;
+    LLVMJITSymbolFlags flags = {LLVMJITSymbolGenericFlagsExported | LLVMJITSymbolGenericFlagsCallable, 0};
+    for (LLVMValueRef func = LLVMGetFirstFunction(codegen->module); func && !failed;
+         func = LLVMGetNextFunction(func), index++) {
+        // internal functions have no symbol to put a stub on, every body that calls one gets its own copy
+        if (LLVMIsDeclaration(func) || is_local(func)) continue;
+        size_t len;
+        const char *name = LLVMGetValueName2(func, &len);
+        char *body = body_name(name, len);
+
+        LazyBody *function = &lazy->bodies[index];
+        function->jit = lazy;
+        function->index = index;
+        // the symbol pool entries given to ORC are retained for it, it releases them
+        LLVMOrcCSymbolFlagsMapPair symbol = {LLVMOrcLLJITMangleAndIntern(jit, body), flags};
+        LLVMOrcMaterializationUnitRef unit = LLVMOrcCreateCustomMaterializationUnit(
+            body, function, &symbol, 1, NULL, materialize_function, discard_function, destroy_function);
+        failed = report_error(LLVMOrcJITDylibDefine(dylib, unit), "Failed to add a function to the JIT");
+
+        stubs[stub_count].Name = LLVMOrcLLJITMangleAndIntern(jit, name);
+        stubs[stub_count].Entry.Name = LLVMOrcLLJITMangleAndIntern(jit, body);
+        stubs[stub_count].Entry.Flags = flags;
+        stub_count++;
+        s_free(body);
+    }
+
+    if (!failed) {
+        LLVMOrcMaterializationUnitRef reexports =
+            LLVMOrcLazyReexports(lazy->call_through, lazy->stubs, dylib, stubs, stub_count);
+        failed = report_error(LLVMOrcJITDylibDefine(dylib, reexports), "Failed to add the function stubs to the JIT");
+    } else {
+        for (int i = 0; i < stub_count; i++) {
+            LLVMOrcReleaseSymbolStringPoolEntry(stubs[i].Name);
+            LLVMOrcReleaseSymbolStringPoolEntry(stubs[i].Entry.Name);
+        }
+    }
+    s_free(stubs);
+    return failed;
+}
+
+// Disposes of what add_lazy set up, once the JIT that called through the stubs is gone
+static void free_lazy(LazyJit *lazy) {
+    if (lazy->call_through) LLVMOrcDisposeLazyCallThroughManager(lazy->call_through);
+    if (lazy->stubs) LLVMOrcDisposeIndirectStubsManager(lazy->stubs);
+    if (lazy->target_machine) LLVMDisposeTargetMachine(lazy->target_machine);
+    if (lazy->bitcode) LLVMDisposeMemoryBuffer(lazy->bitcode);
+    s_free(lazy->bodies);
+}
+
+/**
+ * Reads the module's bitcode into a context of its own and compiles one function of it.
+ * Only the function's body and those of internal functions are read. The other functions are dropped or declared,
+ * the globals become available_externally and unused string literals go, so the object holds just the function.
+ * @param index The function to compile, it is renamed to its body's name. -1 compiles the globals and no function.
+ * @param error Set to what went wrong if the object could not be emitted, disposed of with LLVMDisposeMessage.
+ * @return The object, or NULL if it could not be compiled.
+ */
+static LLVMMemoryBufferRef compile_lazy(LazyJit *lazy, int index, char **error) {
+    LLVMContextRef context = LLVMContextCreate();
+    LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRange(
+        LLVMGetBufferStart(lazy->bitcode), LLVMGetBufferSize(lazy->bitcode), "phi_module", 0);
+    LLVMModuleRef module;
+    // on success the module owns the buffer and reads bodies from it as they are needed
+    if (LLVMGetBitcodeModuleInContext2(context, buffer, &module)) {
+        LLVMDisposeMemoryBuffer(buffer);
+        LLVMContextDispose(context);
+        return NULL;
+    }
+
+    // Bodies have to be read before any function is deleted, the reader refers to functions by what it first saw
+    // A function pass manager reads a body before it runs, an empty one does nothing else
+    LLVMPassManagerRef reader = LLVMCreateFunctionPassManagerForModule(module);
+    LLVMValueRef compiled = NULL;
+    int current = 0;
+    for (LLVMValueRef func = LLVMGetFirstFunction(module); func; func = LLVMGetNextFunction(func), current++) {
+        if (current == index) compiled = func;
+        if (current == index || is_local(func)) LLVMRunFunctionPassManager(reader, func);
+    }
+    LLVMDisposePassManager(reader);
+
+    // The other functions are declared if what was read calls them and dropped otherwise
+    // Declarations are added at the end, where the loop skips them
+    LLVMValueRef func = LLVMGetFirstFunction(module);
+    while (func) {
+        LLVMValueRef next = LLVMGetNextFunction(func);
+        if (func != compiled && !LLVMIsDeclaration(func) && !is_local(func)) {
+            if (LLVMGetFirstUse(func)) {
+                declare_only(module, func);
+            } else {
+                LLVMDeleteFunction(func);
+            }
+        }
+        func = next;
+    }
+    if (compiled) make_globals_external(module);
+    delete_unused_locals(module);
+
+    if (compiled) {
+        size_t len;
+        const char *name = LLVMGetValueName2(compiled, &len);
+        char *body = body_name(name, len);
+        LLVMSetValueName2(compiled, body, strlen(body));
+        s_free(body);
+    }
+
+    // the module holds just this function and its internal helpers by now
+    if (lazy->optimize_functions && run_function_passes(module, lazy->target_machine)) {
+        LLVMDisposeModule(module);
+        LLVMContextDispose(context);
+        return NULL;
+    }
+
+    LLVMMemoryBufferRef object = NULL;
+    if (LLVMTargetMachineEmitToMemoryBuffer(lazy->target_machine, module, LLVMObjectFile, error, &object)) {
+        object = NULL;
+    }
+    LLVMDisposeModule(module);
+    LLVMContextDispose(context);
+    return object;
+}
+
+// Called by LLJIT on the first call to a function's stub, the compiled body is handed to the object layer to link
+static void materialize_function(void *ctx, LLVMOrcMaterializationResponsibilityRef responsibility) {
+    LazyBody *function = (LazyBody *)ctx;
+    char *error = NULL;
+    LLVMMemoryBufferRef object = compile_lazy(function->jit, function->index, &error);
+    if (!object) {
+        fprintf(stderr, "Failed to compile a function: %s\n", error ? error : "unknown error");
+        if (error) LLVMDisposeMessage(error);
+        LLVMOrcMaterializationResponsibilityFailMaterialization(responsibility);
+        LLVMOrcDisposeMaterializationResponsibility(responsibility);
+        return;
+    }
+    // takes both the responsibility and the object
+    LLVMOrcObjectLayerEmit(function->jit->object_layer, responsibility, object);
+}
+
+// Bodies are only ever defined once, nothing overrides them
+static void discard_function(void *ctx, LLVMOrcJITDylibRef dylib, LLVMOrcSymbolStringPoolEntryRef symbol) {
+    (void)ctx;
+    (void)dylib;
+    (void)symbol;
+}
+
+// The LazyBody belongs to the LazyJit and goes with it
+static void destroy_function(void *ctx) { (void)ctx; }
+
+// Where a stub goes if the body it called could not be compiled, the call cannot return anything
+static void lazy_compile_failed(void) {
+    fprintf(stderr, "Failed to compile a function on its first call\n");
+    exit(1);
+}
+
+// Drops internal functions and private globals like string literals that only the deleted bodies used
+static void delete_unused_locals(LLVMModuleRef module) {
+    LLVMValueRef func = LLVMGetFirstFunction(module);
+    while (func) {
+        LLVMValueRef next = LLVMGetNextFunction(func);
+        if (is_local(func) && !LLVMGetFirstUse(func)) LLVMDeleteFunction(func);
+        func = next;
+    }
+    LLVMValueRef global = LLVMGetFirstGlobal(module);
+    while (global) {
+        LLVMValueRef next = LLVMGetNextGlobal(global);
+        if (is_local(global) && !LLVMGetFirstUse(global)) LLVMDeleteGlobal(global);
+        global = next;
+    }
+}
+
+// The name a function's body is compiled under, name is not null-terminated
+static char *body_name(const char *name, size_t len) {
+    size_t suffix_len = strlen(JIT_LAZY_BODY_SUFFIX);
+    char *body = s_malloc(len + suffix_len + 1);
+    memcpy(body, name, len);
+    memcpy(body + len, JIT_LAZY_BODY_SUFFIX, suffix_len + 1);
+    return body;
+}
+
+// Swaps a function for a declaration with the same name and type, the function and its body are deleted
+static void declare_only(LLVMModuleRef module, LLVMValueRef func) {
+    size_t len;
+    const char *name = LLVMGetValueName2(func, &len);
+    char *saved_name = s_malloc(len + 1);
+    memcpy(saved_name, name, len);
+    saved_name[len] = '\0';
+
+    // the name has to be free before the declaration can take it
+    LLVMSetValueName2(func, "", 0);
+    LLVMValueRef declaration = LLVMAddFunction(module, saved_name, LLVMGlobalGetValueType(func));
+    LLVMReplaceAllUsesWith(func, declaration);
+    LLVMDeleteFunction(func);
+    s_free(saved_name);
+}
+
+static size_t count_instructions(LLVMValueRef func) {
+    size_t count = 0;
+    for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block; block = LLVMGetNextBasicBlock(block)) {
+        for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst; inst = LLVMGetNextInstruction(inst)) count++;
+    }
+    return count;
+}
+
+static int is_local(LLVMValueRef global) {
+    LLVMLinkage linkage = LLVMGetLinkage(global);
+    return linkage == LLVMInternalLinkage || linkage == LLVMPrivateLinkage;
+}
+
+// Prints and consumes an ORC error, returns 1 if there was one
+static int report_error(LLVMErrorRef err, const char *what) {
+    if (!err) return 0;
+    char *msg = LLVMGetErrorMessage(err);
+    fprintf(stderr, "%s: %s\n", what, msg);
+    LLVMDisposeErrorMessage(msg);
+    return 1;
+}
@@ -7,242 +7,365 @@
 
 #include "memory.h"
 
-static void add_token(Lexer *lexer, Token type, char *val);
-static void handle_identifier(Lexer *lexer);
+static void add_token(Lexer *lexer, TokenData tok);
+static void set_token(TokenData *tok, Token type, const char *start, size_t len);
+static void set_symbol(Lexer *lexer, TokenData *tok, Token type, size_t len);
+static int decode_number(const char *str, size_t len);
+static Location offset_location(Lexer *lexer, size_t offset);
+static void handle_identifier(Lexer *lexer, TokenData *tok);
+static Token keyword_type(const char *str, size_t len);
 static char next_char(Lexer *lexer);
-static char *unescape_string(const char *str, size_t len);
 
+// Lexes the whole source into lexer->tokens (ending with tok_eof)
 int lex(Lexer *lexer) {
-    while (*lexer->cur_tok != '\0') {
+    return lex_until(lexer, NULL);
+}
+
+// Lexes the tokens that start before end, the last one may run past it (a string spanning lines)
+// A NULL end lexes to the end of the source, including the closing tok_eof
+int lex_until(Lexer *lexer, const char *end) {
+    TokenData tok;
+    for (;;) {
+        if (next_token(lexer, &tok)) return 1;
+        if (end && (tok.type == tok_eof || tok.start >= end)) return 0;
+
+        add_token(lexer, tok);
+        if (tok.type == tok_eof) return 0;
+    }
+}
+
+// Reads the next token from the source into *tok, skipping blanks and comments
+// Once the end is reached every call returns tok_eof
+// Returns 1 on a lexing error
+int next_token(Lexer *lexer, TokenData *tok) {
+    if (!lexer->scanner) lexer->scanner = get_scanner();
+    const Scanner *scanner = lexer->scanner;
+
+    for (;;) {
         switch (*lexer->cur_tok) {
+            case '\0':
+                set_token(tok, tok_eof, lexer->cur_tok, 0);
+                return 0;
             case ' ':
-                // do nothing
-                break;
             case '\n':
-                lexer->line_number++;
-                lexer->line_start = lexer->cur_tok + 1;
-                break;
+                // skip the whole run of blanks at once
+                // lines are not tracked here, token_location works them out only when they are needed
+                lexer->cur_tok = scanner->whitespace(lexer->cur_tok);
+                continue;
             case '(':
-                add_token(lexer, tok_lparen, "(");
+                set_symbol(lexer, tok, tok_lparen, 1);
                 break;
             case ')':
-                add_token(lexer, tok_rparen, ")");
+                set_symbol(lexer, tok, tok_rparen, 1);
                 break;
             case '{':
-                add_token(lexer, tok_lbrace, "{");
+                set_symbol(lexer, tok, tok_lbrace, 1);
                 break;
             case '}':
-                add_token(lexer, tok_rbrace, "}");
+                set_symbol(lexer, tok, tok_rbrace, 1);
                 break;
             case ',':
-                add_token(lexer, tok_comma, ",");
+                set_symbol(lexer, tok, tok_comma, 1);
                 break;
             case '+':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_plus_equal, "+=");
+                    set_symbol(lexer, tok, tok_plus_equal, 2);
                 } else if (next_char(lexer) == '+') {
                     lexer->cur_tok++; // skip the next '+'
-                    add_token(lexer, tok_increment, "++");
+                    set_symbol(lexer, tok, tok_increment, 2);
                 } else {
-                    add_token(lexer, tok_plus, "+");
+                    set_symbol(lexer, tok, tok_plus, 1);
                 }
                 break;
             case '-':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_minus_equal, "-=");
+                    set_symbol(lexer, tok, tok_minus_equal, 2);
                 } else if (next_char(lexer) == '-') {
                     lexer->cur_tok++; // skip the next '-'
-                    add_token(lexer, tok_decrement, "--");
+                    set_symbol(lexer, tok, tok_decrement, 2);
                 } else {
-                    add_token(lexer, tok_minus, "-");
+                    set_symbol(lexer, tok, tok_minus, 1);
                 }
                 break;
             case '*':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_star_equal, "*=");
+                    set_symbol(lexer, tok, tok_star_equal, 2);
                 } else {
-                    add_token(lexer, tok_star, "*");
+                    set_symbol(lexer, tok, tok_star, 1);
                 }
                 break;
             case '/':
                 if (next_char(lexer) == '/') {
                     // skip the comment (and don't go out of bounds)
-                    while (*lexer->cur_tok != '\n' && *lexer->cur_tok != '\0') lexer->cur_tok++;
+                    lexer->cur_tok = scanner->line_end(lexer->cur_tok);
                     continue;
                 } else if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_slash_equal, "/=");
+                    set_symbol(lexer, tok, tok_slash_equal, 2);
                 } else {
-                    add_token(lexer, tok_slash, "/");
+                    set_symbol(lexer, tok, tok_slash, 1);
                 }
                 break;
             case '=':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_equality, "==");
+                    set_symbol(lexer, tok, tok_equality, 2);
                 } else if (next_char(lexer) == '>') {
                     lexer->cur_tok++; // skip the next '>'
-                    add_token(lexer, tok_arrow, "=>");
+                    set_symbol(lexer, tok, tok_arrow, 2);
                 } else {
-                    add_token(lexer, tok_equal, "=");
+                    set_symbol(lexer, tok, tok_equal, 1);
                 }
                 break;
             case '<':
 
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_lessthan_equal, "<=");
+                    set_symbol(lexer, tok, tok_lessthan_equal, 2);
                 } else {
-                    add_token(lexer, tok_lessthan, "<");
+                    set_symbol(lexer, tok, tok_lessthan, 1);
                 }
 
                 break;
             case '>':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_greaterthan_equal, ">=");
+                    set_symbol(lexer, tok, tok_greaterthan_equal, 2);
                 } else {
-                    add_token(lexer, tok_greaterthan, ">");
+                    set_symbol(lexer, tok, tok_greaterthan, 1);
                 }
                 break;
             case '.':
-                add_token(lexer, tok_period, ".");
+                set_symbol(lexer, tok, tok_period, 1);
                 break;
             case ';':
-                add_token(lexer, tok_semi, ";");    
+                set_symbol(lexer, tok, tok_semi, 1);    
                 break;
             case '&':
-                add_token(lexer, tok_and, "&");
+                set_symbol(lexer, tok, tok_and, 1);
                 break;
             case ':':
-                add_token(lexer, tok_colon, ":");
+                set_symbol(lexer, tok, tok_colon, 1);
                 break;
             case '|':
-                add_token(lexer, tok_or, "|");
+                set_symbol(lexer, tok, tok_or, 1);
                 break;
             case '!':
                 if (next_char(lexer) == '=') {
                     lexer->cur_tok++; // skip the next '='
-                    add_token(lexer, tok_inequality, "!=");
+                    set_symbol(lexer, tok, tok_inequality, 2);
                 } else {
                     // If it's just '!', we treat it as a logical NOT
-                    add_token(lexer, tok_not, "!");
+                    set_symbol(lexer, tok, tok_not, 1);
                 }
                 break;
             case '^':
-                add_token(lexer, tok_xor, "^");
+                set_symbol(lexer, tok, tok_xor, 1);
                 break;
             case '%':
-                add_token(lexer, tok_mod, "%");
+                set_symbol(lexer, tok, tok_mod, 1);
                 break;
             default:
                 if (*lexer->cur_tok == '"') {
                     lexer->cur_tok++;
-                    char *str_start = lexer->cur_tok;
+                    const char *str_start = lexer->cur_tok;
 
-                    while (*lexer->cur_tok != '"' && *lexer->cur_tok != '\0') lexer->cur_tok++;
+                    lexer->cur_tok = scanner->string_end(lexer->cur_tok);
                     
                     // Inform user of missing string closing
                     if (*lexer->cur_tok == '\0') {
-                        fprintf(stderr, "%zu: Missing string closing\n", lexer->line_number);
+                        if (lexer->quiet) return 1;
+                        Location loc = offset_location(lexer, str_start - 1 - lexer->start_tok);
+                        fprintf(stderr, "%zu: Missing string closing\n", loc.line);
                         return 1;
                     }
                     
-                    int str_len = lexer->cur_tok - str_start;
-                    char *string = unescape_string(str_start, str_len);
-
-                    add_token(lexer, tok_string, string);
+                    // the token keeps the raw text, escapes are resolved by whoever needs the value
+                    set_token(tok, tok_string, str_start, lexer->cur_tok - str_start);
                     // we don't continue here so we can skip the closing quote
                 } else if (isdigit(*lexer->cur_tok)) {  // If the token is a number
-                    char *str_start = lexer->cur_tok;
-
-                    while (isdigit(*lexer->cur_tok)) lexer->cur_tok++;
+                    const char *str_start = lexer->cur_tok;
 
-                    int str_len = lexer->cur_tok - str_start;
-                    char *number = (char *)s_malloc(str_len + 1);
+                    // decode the value here so codegen never has to re-parse the text
+                    lexer->cur_tok = scanner->digits_end(str_start);
+                    set_token(tok, tok_number, str_start, lexer->cur_tok - str_start);
+                    tok->int_val = decode_number(str_start, tok->len);
 
-                    strncpy(number, str_start, str_len);
-                    number[str_len] = '\0';
-
-                    add_token(lexer, tok_number, number);
-
-                    // we continue here because we are already at the next token 
-                    // which is the result of the while loop
-                    continue;
+                    // we return here because we are already at the next token
+                    // which is the result of the scan
+                    return 0;
                 } else if (isalpha(*lexer->cur_tok)) {
-                    handle_identifier(lexer);
-                    // we continue here because we are already at the next token 
-                    // which is the result of the while loop
-                    continue;
+                    handle_identifier(lexer, tok);
+                    // we return here because we are already at the next token
+                    // which is the result of the scan
+                    return 0;
                 } else {
+                    if (lexer->quiet) return 1;
                     fprintf(stderr, "Unknown token: %c\n", *lexer->cur_tok);
                     return 1;
                 }
                 break;
         }
 
-        // advance token
+        // advance past the last character of the token
         lexer->cur_tok++;
+        return 0;
     }
-
-    add_token(lexer, tok_eof, NULL);
-    return 0;
 }
 
-static void add_token(Lexer *lexer, Token type, char *val) {
+static void add_token(Lexer *lexer, TokenData tok) {
     if (lexer->token_count == (int) lexer->capacity) {
         size_t new_capacity = lexer->capacity == 0 ? 8 : lexer->capacity * 2;
-        lexer->tokens = (TokenData *)s_realloc(lexer->tokens, new_capacity * sizeof(TokenData));
-        if (!lexer->tokens) {
-            perror("Error reallocating memory");
-            exit(1);
-        }
+        lexer->kinds = (uint8_t *)s_realloc(lexer->kinds, new_capacity * sizeof(uint8_t));
+        lexer->offsets = (uint32_t *)s_realloc(lexer->offsets, new_capacity * sizeof(uint32_t));
+        lexer->lengths = (uint32_t *)s_realloc(lexer->lengths, new_capacity * sizeof(uint32_t));
 
         lexer->capacity = new_capacity;
     }
 
-    lexer->tokens[lexer->token_count].type = type;
-    lexer->tokens[lexer->token_count].val = val;
-
-    // setting the location
-    lexer->tokens[lexer->token_count].loc.line = lexer->line_number;
-    lexer->tokens[lexer->token_count].loc.col = lexer->cur_tok - lexer->line_start;
+    size_t offset = tok.start - lexer->start_tok;
+    if (offset + tok.len > UINT32_MAX) {
+        fprintf(stderr, "Source is too large to lex (4 GiB max)\n");
+        exit(1);
+    }
 
+    lexer->kinds[lexer->token_count] = (uint8_t)tok.type;
+    lexer->offsets[lexer->token_count] = (uint32_t)offset;
+    lexer->lengths[lexer->token_count] = (uint32_t)tok.len;
     lexer->token_count++;
 }
 
-static void handle_identifier(Lexer *lexer) {
-    char *str_start = lexer->cur_tok;
+// Turns entry index of the token arrays back into a TokenData
+TokenData token_at(Lexer *lexer, int index) {
+    TokenData tok = {
+        .type = (Token)lexer->kinds[index],
+        .start = lexer->start_tok + lexer->offsets[index],
+        .len = lexer->lengths[index],
+    };
+
+    // number values are not stored, the digits are right there in the source
+    if (tok.type == tok_number) {
+        tok.int_val = decode_number(tok.start, tok.len);
+    }
+
+    return tok;
+}
+
+static void set_token(TokenData *tok, Token type, const char *start, size_t len) {
+    tok->type = type;
+    tok->int_val = 0;
+    tok->start = start;
+    tok->len = len;
+}
+
+// Decodes a run of digits, wrapping like the 32-bit int it ends up as
+static int decode_number(const char *str, size_t len) {
+    unsigned int value = 0;
+    for (size_t i = 0; i < len; i++) {
+        value = value * 10 + (unsigned int)(str[i] - '0');
+    }
+    return (int)value;
+}
+
+// Records where every line starts, done once and only if a location is ever asked for
+static void build_line_index(Lexer *lexer) {
+    int capacity = 64;
+    lexer->line_starts = (uint32_t *)s_malloc(capacity * sizeof(uint32_t));
+    lexer->line_starts[0] = 0;
+    lexer->line_count = 1;
+
+    for (const char *p = lexer->start_tok; (p = strchr(p, '\n')) != NULL; p++) {
+        if (lexer->line_count == capacity) {
+            capacity *= 2;
+            lexer->line_starts = (uint32_t *)s_realloc(lexer->line_starts, capacity * sizeof(uint32_t));
+        }
+        lexer->line_starts[lexer->line_count++] = (uint32_t)(p + 1 - lexer->start_tok);
+    }
+}
+
+static Location offset_location(Lexer *lexer, size_t offset) {
+    if (!lexer->line_starts) build_line_index(lexer);
+
+    // find the last line that starts at or before offset
+    int low = 0;
+    int high = lexer->line_count - 1;
+    while (low < high) {
+        int mid = low + (high - low + 1) / 2;
+        if (lexer->line_starts[mid] <= offset) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    Location loc = {
+        .line = (size_t)low,
+        .col = offset - lexer->line_starts[low],
+    };
+    return loc;
+}
+
+// Works out the (0-based) line and column of the first character of a token
+Location token_location(Lexer *lexer, TokenData tok) {
+    return offset_location(lexer, tok.start - lexer->start_tok);
+}
+
+// Sets an operator/punctuation token of len characters that ends at the current character
+static void set_symbol(Lexer *lexer, TokenData *tok, Token type, size_t len) {
+    set_token(tok, type, lexer->cur_tok + 1 - len, len);
+}
+
+static void handle_identifier(Lexer *lexer, TokenData *tok) {
+    const char *str_start = lexer->cur_tok;
 
     // everything except the first character can be a number
-    while (isalnum(*lexer->cur_tok) || *lexer->cur_tok == '_') lexer->cur_tok++;
-
-    int str_len = lexer->cur_tok - str_start;
-    char *identifier = (char *)s_malloc(str_len + 1);
-
-    strncpy(identifier, str_start, str_len);
-    identifier[str_len] = '\0';
-
-    if (!strcmp(identifier, "func")) {
-        add_token(lexer, tok_func, identifier);
-    } else if (!strcmp(identifier, "int") || !strcmp(identifier, "string") || !strcmp(identifier, "bool")) {
-        add_token(lexer, tok_type, identifier);
-    } else if (!strcmp(identifier, "return")) {
-        add_token(lexer, tok_return, identifier);
-    } else if (!strcmp(identifier, "if")) {
-        add_token(lexer, tok_if, identifier);
-    } else if (!strcmp(identifier, "else")) {
-        add_token(lexer, tok_else, identifier);
-    } else if (!strcmp(identifier, "while")) {
-        add_token(lexer, tok_while, identifier);
-    } else {
-        add_token(lexer, tok_identifier, identifier);
+    lexer->cur_tok = lexer->scanner->identifier_end(str_start);
+
+    size_t str_len = lexer->cur_tok - str_start;
+    set_token(tok, keyword_type(str_start, str_len), str_start, str_len);
+}
+
+// Matches the identifier against a keyword, the lengths are compile-time constants
+// so each check is a length compare plus an inlined memcmp
+#define KEYWORD(kw, tok) \
+    if (len == sizeof(kw) - 1 && !memcmp(str, kw, sizeof(kw) - 1)) return tok
+
+// Classifies an identifier as a keyword (or plain identifier)
+// Switching on the first character means each identifier is compared against at most two keywords
+// New keywords only need a KEYWORD line under their first letter
+static Token keyword_type(const char *str, size_t len) {
+    switch (str[0]) {
+        case 'b':
+            KEYWORD("bool", tok_type);
+            break;
+        case 'e':
+            KEYWORD("else", tok_else);
+            break;
+        case 'f':
+            KEYWORD("func", tok_func);
+            break;
+        case 'i':
+            KEYWORD("if", tok_if);
+            KEYWORD("int", tok_type);
+            break;
+        case 'r':
+            KEYWORD("return", tok_return);
+            break;
+        case 's':
+            KEYWORD("string", tok_type);
+            break;
+        case 'w':
+            KEYWORD("while", tok_while);
+            break;
     }
+    return tok_identifier;
 }
 
+#undef KEYWORD
+
 static char next_char(Lexer *lexer) {
     if (*(lexer->cur_tok + 1) == '\0') {
         return '\0'; // end of string
@@ -251,15 +374,17 @@ static char next_char(Lexer *lexer) {
 }
 
 // Free the memory allocated for the lexer
+// Token text lives in the source buffer so only the token arrays themselves are owned here
 void free_lexer(Lexer *lexer) {
-    for (int i = 0; i < lexer->token_count; i++) {
-        if (lexer->tokens[i].type == tok_identifier || lexer->tokens[i].type == tok_string ||
-            lexer->tokens[i].type == tok_number || lexer->tokens[i].type == tok_type || 
-            lexer->tokens[i].type == tok_return || lexer->tokens[i].type == tok_func) {
-            s_free(lexer->tokens[i].val);
-        }
-    }
-    s_free(lexer->tokens);
+    s_free(lexer->kinds);
+    s_free(lexer->offsets);
+    s_free(lexer->lengths);
+    s_free(lexer->line_starts);
+}
+
+// Compare the text of a token against a null-terminated string
+int token_equals(TokenData tok, const char *str) {
+    return tok.start && strlen(str) == tok.len && !memcmp(tok.start, str, tok.len);
 }
 
 char *token_to_string(Token token) {
@@ -309,7 +434,8 @@ char *token_to_string(Token token) {
     }
 }
 
-static char* unescape_string(const char *str, size_t len) {
+// Returns a newly allocated, null-terminated copy of a string literal with its escapes resolved
+char *unescape_string(const char *str, size_t len) {
     char *result = (char *)s_malloc(len + 1); // worst case, no escapes
     size_t res_i = 0;
 
@@ -1,135 +1,212 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <llvm-c/Transforms/PassBuilder.h>
 #include <llvm-c/Core.h>
 #include <llvm-c/Analysis.h>
+#include <spawn.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "ast_cache.h"
+#include "ast_opt.h"
 #include "codegen.h"
+#include "flat_ast.h"
+#include "jit.h"
 #include "lexer.h"
 #include "memory.h"
 #include "parser.h"
+#include "pipeline.h"
+#include "source.h"
 
-void optimize_module(CodeGen *this) {
-    // Create pass builder options
-    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
+// How the whole program is brought up to the point where codegen takes over
+typedef struct {
+    int threads;
+    int lazy;
+    const char *cache_dir;
+    size_t cache_limit;
+    int ast_opt;
+    int ast_stats;
+} FrontEndOptions;
 
-    // Set debug options if you want (optional)
-    LLVMPassBuilderOptionsSetVerifyEach(opts, 0);
-    LLVMPassBuilderOptionsSetDebugLogging(opts, 0);
+// What the compiled program turns into, it is run with the JIT unless it is written out
+typedef enum {
+    EMIT_NONE,
+    EMIT_EXECUTABLE, // an object file in a temporary file, linked by the system linker
+    EMIT_OBJECT,
+    EMIT_ASSEMBLY,
+    EMIT_LLVM_IR,
+    EMIT_BITCODE,
+} EmitKind;
 
-    // Use the "default<O2>" pipeline, just like: opt -passes="default<O2>"
-    const char *pipeline = "default<O2>";
+extern char **environ;
 
-    // If you don't have a target machine, pass NULL
-    LLVMTargetMachineRef tm = NULL;
-
-    LLVMErrorRef err = LLVMRunPasses(
-        this->module,
-        pipeline,
-        tm,
-        opts
-    );
-
-    if (err) {
-        char *msg = LLVMGetErrorMessage(err);
-        fprintf(stderr, "LLVM optimization error: %s\n", msg);
-        LLVMDisposeErrorMessage(msg);
-    }
-
-    LLVMDisposePassBuilderOptions(opts);
-}
+static Program *parse_program(Source *source, Lexer *lexer, FrontEndOptions *options);
+static int parse_opt_level(const char *level, OptOptions *opt);
+static const char *default_output_name(const char *source_name, EmitKind emit, char *buf, size_t size);
+static int write_output(CodeGen *codegen, EmitKind emit, const char *output_file);
+static int link_executable(const char *object_file, const char *output_file);
+static int has_extension(const char *name, const char *extension);
+static int link_inputs(CodeGen *codegen, const char **inputs, int count);
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("Usage: %s <source> [-o <output>] [--optimize | -O] [--print-ir | -p]\n", argv[0]);
+        printf("Usage: %s <source | -> [-o <output>] [-c] [--emit=obj|asm|ll|bc] [<module.bc> ...] [--optimize | -O | -O<0-3|s|z>] [--passes=<pipeline>] [--verify-each] [--mcpu=<cpu>] [--mattr=<features>] [--print-ir | -p] [--threads | -j <n>] [--lazy] [--lazy-jit] [--cache-dir <dir>] [--cache-limit <MiB>] [--no-ast-opt] [--ast-stats] [--stream]\n", argv[0]);
         return 1;
     }
 
     const char *output_file = NULL;
-    int emit_binary = 0;
-    int optimize = 0;
+    char default_output[4096];
+    EmitKind emit = EMIT_NONE;
+    OptOptions opt = {0};
+    TargetOptions target = {0};
     int print_ir = 0;
+    int stream = 0;
+    int lazy_jit = 0;
+    // prebuilt modules linked in before codegen, the program can call what they define
+    const char *bitcode_inputs[argc];
+    int bitcode_count = 0;
+    FrontEndOptions front_end = {
+        .threads = 1,
+        .cache_limit = AST_CACHE_DEFAULT_LIMIT,
+        .ast_opt = 1,
+    };
 
     for (int i = 2; i < argc; ++i) {
         if (!strcmp(argv[i], "-o") && i + 1 < argc) {
             output_file = argv[++i];
-            emit_binary = 1;
+        } else if (!strcmp(argv[i], "-c")) {
+            emit = EMIT_OBJECT;
+        } else if (!strncmp(argv[i], "--emit=", 7)) {
+            const char *kind = argv[i] + 7;
+            if (!strcmp(kind, "obj")) {
+                emit = EMIT_OBJECT;
+            } else if (!strcmp(kind, "asm")) {
+                emit = EMIT_ASSEMBLY;
+            } else if (!strcmp(kind, "ll")) {
+                emit = EMIT_LLVM_IR;
+            } else if (!strcmp(kind, "bc")) {
+                emit = EMIT_BITCODE;
+            } else {
+                fprintf(stderr, "Unknown output kind: %s (expected obj, asm, ll or bc)\n", kind);
+                return 1;
+            }
         } else if (!strcmp(argv[i], "--optimize") || !strcmp(argv[i], "-O")) {
-            optimize = 1;
+            opt.level = 2;
+            opt.size_level = 0;
+        } else if (!strncmp(argv[i], "-O", 2)) {
+            if (parse_opt_level(argv[i] + 2, &opt)) {
+                fprintf(stderr, "Unknown optimization level: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (!strncmp(argv[i], "--passes=", 9)) {
+            opt.passes = argv[i] + 9;
+        } else if (!strcmp(argv[i], "--verify-each")) {
+            opt.verify_each = 1;
+        } else if (!strncmp(argv[i], "--mcpu=", 7)) {
+            target.cpu = argv[i] + 7;
+        } else if (!strncmp(argv[i], "--mattr=", 8)) {
+            target.features = argv[i] + 8;
         } else if (!strcmp(argv[i], "--print-ir") || !strcmp(argv[i], "-p")) {
             print_ir = 1;
+        } else if ((!strcmp(argv[i], "--threads") || !strcmp(argv[i], "-j")) && i + 1 < argc) {
+            // 0 means one thread per core
+            front_end.threads = atoi(argv[++i]);
+            if (front_end.threads <= 0) front_end.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        } else if (!strcmp(argv[i], "--lazy")) {
+            front_end.lazy = 1;
+        } else if (!strcmp(argv[i], "--lazy-jit")) {
+            lazy_jit = 1;
+        } else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) {
+            front_end.cache_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--cache-limit") && i + 1 < argc) {
+            front_end.cache_limit = (size_t)atol(argv[++i]) * 1024 * 1024;
+        } else if (!strcmp(argv[i], "--no-ast-opt")) {
+            front_end.ast_opt = 0;
+        } else if (!strcmp(argv[i], "--ast-stats")) {
+            front_end.ast_stats = 1;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream = 1;
+        } else if (has_extension(argv[i], ".bc")) {
+            bitcode_inputs[bitcode_count++] = argv[i];
         }
     }
-    
-    // Open the file
-    FILE *file = fopen(argv[1], "r");
-    if (!file) {
-        perror("Error opening file");
-        return 1;
+    // -o alone asks for an executable, the other kinds are named after the source if there is no -o
+    if (emit == EMIT_NONE && output_file) emit = EMIT_EXECUTABLE;
+    if (emit != EMIT_NONE && !output_file) {
+        output_file = default_output_name(argv[1], emit, default_output, sizeof(default_output));
     }
-    
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-
-    // Allocate buffer
-    char *buffer = (char *)s_malloc(file_size + 1);
-    if (!buffer) {
-        perror("Error allocating memory");
-        fclose(file);
+
+    // the backend works as hard as the optimizer
+    target.opt_level = opt.level;
+
+    // Map the file (or read stdin for "-")
+    Source source;
+    if (load_source(argv[1], &source)) {
         return 1;
     }
 
-    // read the file into the buffer
-    fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';  // Null-terminate the string
-    fclose(file);
-
     Lexer lexer = {
-        .start_tok = buffer,
-        .cur_tok = buffer,
-        .line_start = buffer,
+        .start_tok = source.text,
+        .cur_tok = source.text,
     };
+    Program *prog = NULL;
+    CodeGen *codegen;
+    LLVMValueRef main_func;
 
-    // Call the lex function (to be implemented)
-    int result = lex(&lexer);
-
-    if (result == 1) {
-        printf("Lexing failed\n");
-        s_free(buffer);
-        free_lexer(&lexer);
-        return 1;
-    }
-
-    printf("✅ Lexing successful\n");
+    if (stream) {
+        // One declaration at a time from parsing to IR, the whole program's AST and token arrays are never built
+        // Threads, lazy bodies and the AST cache all work on the whole program, so they do not apply here
+        codegen = init_codegen("phi_module", &target);
+        if (link_inputs(codegen, bitcode_inputs, bitcode_count)) {
+            cleanup_codegen(codegen);
+            free_source(&source);
+            free_lexer(&lexer);
+            return 1;
+        }
 
-    // Initialize parser
-    Parser parser = init_parser(&lexer);
+        AstPassResult results[ast_pass_count];
+        StreamOptions options = {
+            .ast_opt = front_end.ast_opt,
+            // a custom pipeline gets the functions exactly as they were generated
+            .optimize_functions = opt.level > 0 && !opt.passes,
+            .ast_results = results,
+        };
+        StreamStats stats;
+        main_func = compile_streaming(codegen, &source, &options, &stats);
+        printf("✅ Streamed %d functions and %d globals, largest AST %zu bytes (%zu for the whole program)\n",
+               stats.function_count, stats.global_count, stats.peak_ast_bytes, stats.total_ast_bytes);
+        for (int i = 0; front_end.ast_opt && front_end.ast_stats && i < ast_pass_count; i++) {
+            printf("AST pass %-26s removed %zu nodes\n", results[i].name, results[i].removed);
+        }
+    } else {
+        prog = parse_program(&source, &lexer, &front_end);
+        if (!prog) {
+            free_source(&source);
+            free_lexer(&lexer);
+            return 1;
+        }
 
-    // Parse the program
-    Program *prog = parse(&parser);
+        // Initialize code generator
+        codegen = init_codegen("phi_module", &target);
+        if (link_inputs(codegen, bitcode_inputs, bitcode_count)) {
+            cleanup_codegen(codegen);
+            free_program(prog);
+            free_source(&source);
+            free_lexer(&lexer);
+            return 1;
+        }
 
-    if (!prog) {
-        printf("Parsing failed\n");
-        s_free(buffer);
-        free_lexer(&lexer);
-        return 1;
+        // Generate LLVM IR
+        main_func = codegen_program(codegen, prog);
     }
-    printf("✅ Parsing successful\n");
-
-    // Initialize code generator
-    CodeGen *codegen = init_codegen("phi_module");
 
-    // Generate LLVM IR
-    LLVMValueRef main_func = codegen_program(codegen, prog);
-
-    if (!main_func) {
+    // a module written out for later linking does not need a main
+    int needs_main = emit == EMIT_NONE || emit == EMIT_EXECUTABLE;
+    if (!main_func && needs_main) {
         printf("Code generation failed\n");
         cleanup_codegen(codegen);
         free_program(prog);
-        s_free(buffer);
+        free_source(&source);
         free_lexer(&lexer);
         return 1;
     }
@@ -141,9 +218,17 @@ int main(int argc, char *argv[]) {
         dump_ir(codegen);
     }
 
-    if (optimize) {
-        // Optimize the module
-        optimize_module(codegen);
+    // -O0 leaves the module alone unless a pipeline was asked for
+    // The lazy JIT optimizes each function when it is compiled, the module is left as it is until then
+    int lazy = lazy_jit && emit == EMIT_NONE;
+    if ((opt.level > 0 && !lazy) || opt.passes) {
+        if (optimize_module(codegen, &opt)) {
+            cleanup_codegen(codegen);
+            free_program(prog);
+            free_source(&source);
+            free_lexer(&lexer);
+            return 1;
+        }
         if (print_ir) {
             printf("\nOptimized LLVM IR:\n");
             dump_ir(codegen);
@@ -151,32 +236,215 @@ int main(int argc, char *argv[]) {
     }
 
 
-    // Optionally run the code using JIT
-    if (emit_binary) {
-        write_ir(codegen, "out.ll");
-        printf("Wrote LLVM IR to out.ll\n");
-
-        // Call clang to compile the bitcode to a binary
-        char command[512];
-        snprintf(command, sizeof(command), "clang -Wno-override-module out.ll -o %s", output_file);
-        int ret = system(command);
-        if (ret != 0) {
-            printf("Failed to compile bitcode to binary\n");
-        } else {
-            printf("✅ Compiled to binary: %s\n", output_file);
-        }
-
+    // Run the code using JIT, unless it is written out
+    int failed = 0;
+    if (emit != EMIT_NONE) {
+        failed = write_output(codegen, emit, output_file);
     } else {
         printf("\nExecuting code...\n");
-        int exit_code = run_jit(codegen);
+        JitOptions jit = {
+            .compile_threads = front_end.threads,
+            .lazy = lazy,
+            // a custom pipeline has run on the module already
+            .optimize_functions = opt.level > 0 && !opt.passes,
+        };
+        int exit_code = run_jit(codegen, &jit);
         printf("Program exited with code: %d\n", exit_code);
     }
 
     // Clean up
     cleanup_codegen(codegen);
     free_program(prog);
-    // Free the buffer
-    s_free(buffer);
+    // Release the source
+    free_source(&source);
     free_lexer(&lexer);
+    return failed;
+}
+
+/**
+ * Lexes and parses the whole program (or loads it from the AST cache) and runs the AST passes on it.
+ * @param lexer A fresh lexer over the source, the program's tokens may live in it.
+ * @return The program, or NULL if it could not be parsed (after saying so).
+ */
+static Program *parse_program(Source *source, Lexer *lexer, FrontEndOptions *options) {
+    Program *prog = NULL;
+
+    // With a cache directory a hit skips lexing and parsing, the program is rebuilt straight from the mapped entry
+    // A lazily parsed program is missing bodies, so --lazy leaves the cache alone
+    AstCache cache = {0};
+    int use_cache = options->cache_dir && !options->lazy;
+    if (use_cache) {
+        ast_cache_init(&cache, options->cache_dir, options->cache_limit, source);
+        FlatAst cached;
+        if (ast_cache_load(&cache, &cached)) {
+            prog = unflatten_program(&cached);
+            printf("AST cache hit: %s\n", cache.path);
+        } else {
+            printf("AST cache miss: %s\n", cache.path);
+        }
+    }
+
+    if (!prog) {
+        // With more than one thread or lazy bodies the whole source is lexed up front and the parser reads the token arrays,
+        // otherwise the parser pulls tokens from the lexer as it goes so the token arrays are never built
+        if ((options->threads > 1 || options->lazy) && lex_parallel(lexer, options->threads, LEX_PARALLEL_MIN_CHUNK)) {
+            printf("Lexing failed\n");
+            ast_cache_free(&cache);
+            return NULL;
+        }
+
+        // Initialize parser
+        Parser parser = init_parser(lexer);
+        // Function bodies are only brace-matched now, codegen parses the ones main can reach
+        parser.lazy_bodies = options->lazy;
+
+        // Parse the program, the top level declarations are split between the threads when the tokens are already there
+        prog = parse_parallel(&parser, options->threads, PARSE_PARALLEL_MIN_TOKENS);
+
+        if (!prog) {
+            printf("Parsing failed\n");
+            ast_cache_free(&cache);
+            return NULL;
+        }
+        printf("✅ Lexing and parsing successful\n");
+
+        if (use_cache) {
+            FlatAst flat;
+            flatten_program(prog, source->text, &flat);
+            int evicted = ast_cache_store(&cache, &flat);
+            if (evicted > 0) printf("AST cache evicted %d old entries\n", evicted);
+            free_flat_ast(&flat);
+        }
+    }
+    // the program does not point into the cache entry, only into the source
+    ast_cache_free(&cache);
+
+    // Fold constants and drop dead branches before codegen ever sees them
+    // This runs after the cache was written, so a cache entry is always the program as parsed
+    // Bodies --lazy skipped get the same passes when codegen parses them
+    if (options->ast_opt) {
+        prog->lazy_ast_opt = 1;
+        AstPassResult results[ast_pass_count];
+        optimize_ast(prog, results);
+        if (options->ast_stats) {
+            for (int i = 0; i < ast_pass_count; i++) {
+                printf("AST pass %-26s removed %zu nodes\n", results[i].name, results[i].removed);
+            }
+        }
+    }
+
+    return prog;
+}
+
+// The part of -O<level> after the O: 0 to 3, s or z
+// @return 0 if the level was understood, 1 otherwise
+static int parse_opt_level(const char *level, OptOptions *opt) {
+    if (strlen(level) != 1) return 1;
+    if (level[0] >= '0' && level[0] <= '3') {
+        opt->level = level[0] - '0';
+        opt->size_level = 0;
+    } else if (level[0] == 's' || level[0] == 'z') {
+        // the size levels build on -O2
+        opt->level = 2;
+        opt->size_level = level[0] == 's' ? 1 : 2;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+// The source's name with the extension of what is emitted, in the current directory like cc -c does
+static const char *default_output_name(const char *source_name, EmitKind emit, char *buf, size_t size) {
+    const char *extensions[] = {
+        [EMIT_OBJECT] = ".o",
+        [EMIT_ASSEMBLY] = ".s",
+        [EMIT_LLVM_IR] = ".ll",
+        [EMIT_BITCODE] = ".bc",
+    };
+    if (!strcmp(source_name, "-")) source_name = "out";
+
+    const char *base = strrchr(source_name, '/');
+    base = base ? base + 1 : source_name;
+    const char *dot = strrchr(base, '.');
+    int len = dot && dot != base ? (int)(dot - base) : (int)strlen(base);
+    snprintf(buf, size, "%.*s%s", len, base, extensions[emit]);
+    return buf;
+}
+
+/**
+ * Writes the module out as asked for, machine code is generated in this process.
+ * @return 0 on success, 1 if anything could not be written (after saying so).
+ */
+static int write_output(CodeGen *codegen, EmitKind emit, const char *output_file) {
+    switch (emit) {
+        case EMIT_LLVM_IR:
+            if (write_ir(codegen, output_file)) return 1;
+            printf("✅ Wrote LLVM IR: %s\n", output_file);
+            return 0;
+        case EMIT_BITCODE:
+            if (write_bitcode(codegen, output_file)) return 1;
+            printf("✅ Wrote bitcode: %s\n", output_file);
+            return 0;
+        case EMIT_ASSEMBLY:
+            if (emit_file(codegen, output_file, LLVMAssemblyFile)) return 1;
+            printf("✅ Wrote assembly: %s\n", output_file);
+            return 0;
+        case EMIT_OBJECT:
+            if (emit_file(codegen, output_file, LLVMObjectFile)) return 1;
+            printf("✅ Wrote object file: %s\n", output_file);
+            return 0;
+        case EMIT_EXECUTABLE: {
+            // A file of our own, so compilers running side by side in one directory do not overwrite each other's
+            const char *tmp_dir = getenv("TMPDIR");
+            char object_file[4096];
+            snprintf(object_file, sizeof(object_file), "%s/phi-XXXXXX.o", tmp_dir && *tmp_dir ? tmp_dir : "/tmp");
+            int fd = mkstemps(object_file, 2);
+            if (fd < 0) {
+                perror("Failed to create a temporary object file");
+                return 1;
+            }
+            close(fd);
+
+            int failed = emit_file(codegen, object_file, LLVMObjectFile) || link_executable(object_file, output_file);
+            unlink(object_file);
+            if (failed) return 1;
+            printf("✅ Compiled to binary: %s\n", output_file);
+            return 0;
+        }
+        default:
+            return 0;
+    }
+}
+
+// Links one object file against the C library with the system's compiler driver, which knows where crt1.o and libc are
+static int link_executable(const char *object_file, const char *output_file) {
+    char *args[] = {"clang", (char *)object_file, "-o", (char *)output_file, NULL};
+    pid_t pid;
+    int err = posix_spawnp(&pid, args[0], NULL, NULL, args, environ);
+    if (err != 0) {
+        fprintf(stderr, "Failed to run %s: %s\n", args[0], strerror(err));
+        return 1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Failed to link %s\n", output_file);
+        return 1;
+    }
+    return 0;
+}
+
+static int has_extension(const char *name, const char *extension) {
+    size_t len = strlen(name);
+    size_t extension_len = strlen(extension);
+    return len > extension_len && !strcmp(name + len - extension_len, extension);
+}
+
+// Links the .bc files into the module before the program's own code is generated
+static int link_inputs(CodeGen *codegen, const char **inputs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (link_bitcode(codegen, inputs[i])) return 1;
+        printf("✅ Linked bitcode: %s\n", inputs[i]);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Every successful s_malloc/s_calloc/s_realloc, atomic since the parallel lexer allocates from several threads
+static size_t alloc_count = 0;
+
 void *s_malloc(size_t size) {
     if (size == 0) {
         fprintf(stderr, "Warning: malloc called with size 0\n");
@@ -14,6 +17,7 @@ void *s_malloc(size_t size) {
         fprintf(stderr, "Fatal error: malloc failed to allocate %zu bytes\n", size);
         exit(EXIT_FAILURE);
     }
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
     
     return ptr;
 }
@@ -29,6 +33,7 @@ void *s_calloc(size_t nmemb, size_t size) {
         fprintf(stderr, "Fatal error: calloc failed to allocate %zu * %zu bytes\n", nmemb, size);
         exit(EXIT_FAILURE);
     }
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
     
     return ptr;
 }
@@ -44,6 +49,7 @@ void *s_realloc(void *ptr, size_t size) {
         fprintf(stderr, "Fatal error: realloc failed to allocate %zu bytes\n", size);
         exit(EXIT_FAILURE);
     }
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
     
     return new_ptr;
 }
@@ -53,3 +59,7 @@ void s_free(void *ptr) {
         free(ptr);
     }
 }
+
+size_t s_alloc_count(void) {
+    return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
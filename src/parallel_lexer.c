@@ -0,0 +1,170 @@
+#include "lexer.h"
+
+#include <string.h>
+
+#include "memory.h"
+#include "workers.h"
+
+// What the serial lexer is in the middle of at the start of a line
+// A // comment always ends at the '\n', so a chunk can only start in code or inside a string
+typedef enum {
+    in_code,
+    in_string,
+} ChunkState;
+
+typedef struct {
+    const char *begin;
+    const char *end; // one past the '\n' that closes the chunk, or the '\0' for the last one
+    int is_last;
+
+    // pre-pass results, the state at end for either state at begin
+    ChunkState end_state[2];
+
+    ChunkState start_state;
+    Lexer lexer;
+    int failed;
+} Chunk;
+
+static const char *split_point(const char *target, const char *source_end);
+static ChunkState scan_state(const char *p, const char *end, ChunkState state);
+static void *scan_chunk(void *arg);
+static void *lex_chunk(void *arg);
+
+/**
+ * Lexes the source on several threads and leaves exactly the tokens lex() would in lexer.
+ * The source is cut into one chunk per thread at line starts. A pre-pass works out, for each chunk,
+ * whether it would end inside a string for both possible starting states, chaining those
+ * tells every chunk where the serial lexer would be when it reached it. Offsets are relative
+ * to the whole source so the chunks' token arrays are simply appended, and since lines are worked
+ * out from offsets by token_location nothing has to be renumbered.
+ * @param lexer A fresh lexer over the source.
+ * @param thread_count The most threads to use.
+ * @param min_chunk Each thread gets at least this many bytes, small sources are lexed serially.
+ * @return 0 on success, 1 on a lexing error (reported the same way lex() does).
+ */
+int lex_parallel(Lexer *lexer, int thread_count, size_t min_chunk) {
+    // the serial lexer stops at the first '\0', not at the end of the buffer
+    size_t len = strlen(lexer->cur_tok);
+    if (min_chunk == 0) min_chunk = 1;
+
+    int chunk_count = thread_count;
+    if (len / min_chunk < (size_t)chunk_count) chunk_count = (int)(len / min_chunk);
+    if (chunk_count <= 1) return lex(lexer);
+
+    if (!lexer->scanner) lexer->scanner = get_scanner();
+
+    const char *source_end = lexer->cur_tok + len;
+    Chunk *chunks = (Chunk *)s_calloc(chunk_count, sizeof(Chunk));
+
+    const char *begin = lexer->cur_tok;
+    for (int i = 0; i < chunk_count; i++) {
+        Chunk *chunk = &chunks[i];
+        chunk->begin = begin;
+        chunk->is_last = i == chunk_count - 1;
+        chunk->end = chunk->is_last ? source_end : split_point(lexer->cur_tok + len / chunk_count * (i + 1), source_end);
+        begin = chunk->end;
+
+        chunk->lexer = (Lexer){
+            .start_tok = lexer->start_tok,
+            .cur_tok = chunk->begin,
+            .scanner = lexer->scanner,
+            .quiet = 1,
+        };
+    }
+
+    // pre-pass, then chain the results so each chunk knows the state it starts in
+    run_workers(chunks, sizeof(Chunk), chunk_count, scan_chunk);
+    ChunkState state = in_code;
+    for (int i = 0; i < chunk_count; i++) {
+        chunks[i].start_state = state;
+        state = chunks[i].end_state[state];
+    }
+
+    run_workers(chunks, sizeof(Chunk), chunk_count, lex_chunk);
+
+    int failed = 0;
+    size_t total = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        failed |= chunks[i].failed;
+        total += chunks[i].lexer.token_count;
+    }
+
+    if (!failed) {
+        lexer->kinds = (uint8_t *)s_realloc(lexer->kinds, total * sizeof(uint8_t));
+        lexer->offsets = (uint32_t *)s_realloc(lexer->offsets, total * sizeof(uint32_t));
+        lexer->lengths = (uint32_t *)s_realloc(lexer->lengths, total * sizeof(uint32_t));
+        lexer->capacity = total;
+
+        for (int i = 0; i < chunk_count; i++) {
+            Lexer *part = &chunks[i].lexer;
+            int count = part->token_count;
+            if (count == 0) continue;
+
+            memcpy(lexer->kinds + lexer->token_count, part->kinds, count * sizeof(uint8_t));
+            memcpy(lexer->offsets + lexer->token_count, part->offsets, count * sizeof(uint32_t));
+            memcpy(lexer->lengths + lexer->token_count, part->lengths, count * sizeof(uint32_t));
+            lexer->token_count += count;
+        }
+        lexer->cur_tok = source_end;
+    }
+
+    for (int i = 0; i < chunk_count; i++) {
+        free_lexer(&chunks[i].lexer);
+    }
+    s_free(chunks);
+
+    // the chunks fail quietly, lexing again serially prints the same error lex() would
+    if (failed) return lex(lexer);
+    return 0;
+}
+
+// Returns the start of the first line at or after target
+static const char *split_point(const char *target, const char *source_end) {
+    if (target >= source_end) return source_end;
+
+    const char *newline = memchr(target, '\n', source_end - target);
+    return newline ? newline + 1 : source_end;
+}
+
+// Follows only what matters for the split: quotes open and close strings, // skips to the end of the line
+static ChunkState scan_state(const char *p, const char *end, ChunkState state) {
+    while (p < end) {
+        if (state == in_string) {
+            p = memchr(p, '"', end - p);
+            if (!p) return in_string;
+            p++;
+            state = in_code;
+            continue;
+        }
+
+        char c = *p++;
+        if (c == '"') {
+            state = in_string;
+        } else if (c == '/' && p < end && *p == '/') {
+            p = memchr(p, '\n', end - p);
+            if (!p) return in_code;
+        }
+    }
+    return state;
+}
+
+static void *scan_chunk(void *arg) {
+    Chunk *chunk = (Chunk *)arg;
+    chunk->end_state[in_code] = scan_state(chunk->begin, chunk->end, in_code);
+    chunk->end_state[in_string] = scan_state(chunk->begin, chunk->end, in_string);
+    return NULL;
+}
+
+static void *lex_chunk(void *arg) {
+    Chunk *chunk = (Chunk *)arg;
+
+    if (chunk->start_state == in_string) {
+        // the string belongs to the chunk it opened in, start after its closing quote
+        const char *quote = memchr(chunk->begin, '"', chunk->end - chunk->begin);
+        if (!quote) return NULL;
+        chunk->lexer.cur_tok = quote + 1;
+    }
+
+    chunk->failed = lex_until(&chunk->lexer, chunk->is_last ? NULL : chunk->end);
+    return NULL;
+}
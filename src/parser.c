@@ -1,23 +1,51 @@
 #include "parser.h"
 #include "memory.h"
+#include "workers.h"
 
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define true 1
 #define false 0
 
+// Frames parse_expression keeps on the C stack before it moves its stack to the heap
+#define EXPR_LOCAL_FRAMES 32
+
+// What the operand parse_expression is working on will become part of
+typedef enum {
+    FRAME_BINARY, // right side of left <op>
+    FRAME_UNARY,  // operand of a '-' or '!'
+    FRAME_PAREN,  // inside '(' ... ')'
+    FRAME_CALL,   // next argument of a call
+} ExprFrameKind;
+
+typedef struct {
+    ExprFrameKind kind;
+    Precedence precedence; // the operand only takes operators binding tighter than this
+    Expr *left;            // FRAME_BINARY
+    TokenData token;       // the operator, or the function name of a call
+    Expr **args;           // FRAME_CALL, allocated from the arena
+    int arg_count;
+    int arg_capacity;
+} ExprFrame;
+
+static TokenData pull_token(Parser *this, int index);
 static void consume(Parser *this);
 static Token peek(Parser *this);
 static TokenData curr_token_data(Parser *this);
 static TokenData next_token_data(Parser *this);
 
+static void fail_quietly(Parser *this);
 static void expect_next(Parser *this, Token expected);
 static void expect_next_and_consume_current(Parser *this, Token expected);
 static void add_statement(Program *prog, Stmt *stmt);
 
 static Stmt **parse_block_statements(Parser *this, int *out_stmt_count);
 static Stmt *parse_func_decl(Parser *this);
+static Stmt *parse_func_block(Parser *this);
+static void skip_func_body(Parser *this);
 static Stmt *parse_global_var_decl(Parser *this);
 static Stmt *parse_var_decl(Parser *this);
 static Stmt *parse_var_assign(Parser *this);
@@ -29,78 +57,307 @@ static Stmt *parse_while_stmt(Parser *this);
 static void parse_function_parameters(Parser *this, TokenData** out_parameter_names, TokenData** out_parameter_types, int *out_param_count);
 
 static Expr *parse_increment_expr(Parser *this, int is_prefix);
-static Expr **parse_function_arguments(Parser *this, int *out_arg_count);
-static Expr *parse_function_call(Parser *this);
 static Expr *parse_expression(Parser *this, Precedence precedence);
-static Expr *parse_prefix(Parser *this);
-static Expr *parse_infix(Parser *this, Expr *left);
-static Expr *parse_binary_expr(Parser *this, Expr *left, TokenData op_token);
 
 static Precedence get_precedence(Token token);
 
+static Parser parser_at(Lexer *lexer, int index);
+static void seek(Parser *this, int index);
+static int find_declarations(Lexer *lexer, int **out_starts);
+static void *parse_declarations(void *arg);
+
+// A run of top level declarations parsed by one worker of parse_parallel
+typedef struct {
+    Lexer *lexer;
+    const int *starts; // token index of every declaration, plus one past the last
+    Stmt **results;
+    int first;
+    int last;
+    Arena arena;
+    int lazy_bodies;
+    int failed;
+} ParseJob;
+
 Parser init_parser(Lexer *lexer) {
+    return parser_at(lexer, 0);
+}
+
+// A parser whose current token is token number index
+// Anywhere but 0 needs the token arrays, the streaming lexer can only start from the beginning
+static Parser parser_at(Lexer *lexer, int index) {
     Parser parser = {
         .lexer = lexer,
-        .cur_tok = lexer->tokens[0].type,
-        .next_tok = lexer->tokens[1].type,
-        .next_tok_index = 1,
     };
-
+    seek(&parser, index);
     return parser;
 }
 
+// Makes token number index the current one, with the same restriction as parser_at
+static void seek(Parser *this, int index) {
+    this->next_tok_index = index + 1;
+    this->window[index % PARSER_WINDOW] = pull_token(this, index);
+    this->window[(index + 1) % PARSER_WINDOW] = pull_token(this, index + 1);
+    this->cur_tok = this->window[index % PARSER_WINDOW].type;
+    this->next_tok = this->window[(index + 1) % PARSER_WINDOW].type;
+}
+
+// Fetches token number index for the window
+// Pre-lexed input is read from the token array, otherwise the lexer produces it on demand
+// so only the window is ever resident
+static TokenData pull_token(Parser *this, int index) {
+    Lexer *lexer = this->lexer;
+    if (lexer->kinds) {
+        // past the end we keep handing out the final tok_eof
+        return token_at(lexer, index < lexer->token_count ? index : lexer->token_count - 1);
+    }
+
+    TokenData tok;
+    if (next_token(lexer, &tok)) {
+        // the lexer already reported what went wrong
+        exit(1);
+    }
+    return tok;
+}
+
 // This function will parse the entire program
 // The only top level things this function will parse are function declarations and variable declarations
 Program *parse(Parser *this) {
     Program *prog = (Program *)s_malloc(sizeof(Program));
+
+    // every node and array from here on is bump-allocated from the program's arena
+    arena_init(&prog->arena, this->arena_chunk_size);
+    this->arena = &prog->arena;
+
     prog->stmt_count = 0;
     prog->capacity = 8; // Start with reasonable initial capacity
-    prog->statements = (Stmt **)s_malloc(prog->capacity * sizeof(Stmt *));
+    prog->statements = (Stmt **)arena_alloc(this->arena, prog->capacity * sizeof(Stmt *));
+    prog->lazy_lexer = this->lazy_bodies && this->lexer->kinds ? this->lexer : NULL;
 
     while (this->cur_tok != tok_eof) {
-        Stmt *stmt = NULL;
-        switch (this->cur_tok) {
-            case tok_func:
-                stmt = parse_func_decl(this);
-                break;
-            case tok_type:
-                stmt = parse_global_var_decl(this);
-                break;
-            default:
-                // throw an error
-                fprintf(stderr, "Unexpected token at top level: %s\n", token_to_string(this->cur_tok));
-                exit(1);
+        add_statement(prog, parse_declaration(this));
+    }
+
+    return prog;
+}
+
+/**
+ * Parses the top level declaration at the current token, a function or a global variable.
+ * The nodes come from this->arena, which the caller sets up when not going through parse().
+ * @return The declaration, or NULL at the end of the input.
+ */
+Stmt *parse_declaration(Parser *this) {
+    switch (this->cur_tok) {
+        case tok_eof:
+            return NULL;
+        case tok_func:
+            return parse_func_decl(this);
+        case tok_type:
+            return parse_global_var_decl(this);
+        default:
+            // throw an error
+            fail_quietly(this);
+            fprintf(stderr, "Unexpected token at top level: %s\n", token_to_string(this->cur_tok));
+            exit(1);
+    }
+}
+
+/**
+ * Parses the top level declarations on several threads.
+ * A pass over the token kinds finds where each declaration ends by brace matching, the declarations
+ * are then split into runs of about the same number of tokens and each run is parsed with its own
+ * parser and arena. The statements end up in source order and the arenas are merged into the program's.
+ * Anything the pass cannot split cleanly is left to parse(). The workers parse quietly and give up at a syntax
+ * error, and then the whole program is parsed again with parse(), so the error reported is the first one in the
+ * source no matter how many threads there are.
+ * @param this A fresh parser over a lexer whose token arrays are already filled (lex() or lex_parallel()).
+ * @param thread_count The most threads to use.
+ * @param min_tokens Each thread gets at least this many tokens, smaller inputs are parsed serially.
+ * @return The program, same as parse() would give.
+ */
+Program *parse_parallel(Parser *this, int thread_count, int min_tokens) {
+    Lexer *lexer = this->lexer;
+    if (min_tokens < 1) min_tokens = 1;
+    if (!lexer->kinds || thread_count <= 1 || lexer->token_count / min_tokens < 2) return parse(this);
+
+    int *starts = NULL;
+    int decl_count = find_declarations(lexer, &starts);
+    if (decl_count < 2) {
+        s_free(starts);
+        return parse(this);
+    }
+
+    int job_count = thread_count;
+    if (job_count > decl_count) job_count = decl_count;
+    if (job_count > lexer->token_count / min_tokens) job_count = lexer->token_count / min_tokens;
+
+    Stmt **results = (Stmt **)s_calloc(decl_count, sizeof(Stmt *));
+    ParseJob *jobs = (ParseJob *)s_calloc(job_count, sizeof(ParseJob));
+
+    // hand out consecutive declarations until each job has its share of the tokens
+    int decl = 0;
+    for (int i = 0; i < job_count; i++) {
+        int end_token = (int)((long long)starts[decl_count] * (i + 1) / job_count);
+        jobs[i].lexer = lexer;
+        jobs[i].starts = starts;
+        jobs[i].results = results;
+        jobs[i].first = decl;
+        while (decl < decl_count && (starts[decl] < end_token || decl == jobs[i].first)) decl++;
+        if (i == job_count - 1) decl = decl_count;
+        jobs[i].last = decl;
+        jobs[i].lazy_bodies = this->lazy_bodies;
+        arena_init(&jobs[i].arena, this->arena_chunk_size);
+    }
+
+    run_workers(jobs, sizeof(ParseJob), job_count, parse_declarations);
+
+    int failed = 0;
+    for (int i = 0; i < job_count; i++) {
+        failed |= jobs[i].failed;
+    }
+
+    Program *prog = NULL;
+    if (!failed) {
+        prog = (Program *)s_malloc(sizeof(Program));
+        arena_init(&prog->arena, this->arena_chunk_size);
+        prog->statements = (Stmt **)arena_alloc(&prog->arena, decl_count * sizeof(Stmt *));
+        memcpy(prog->statements, results, decl_count * sizeof(Stmt *));
+        prog->stmt_count = decl_count;
+        prog->capacity = decl_count;
+        prog->lazy_lexer = this->lazy_bodies ? lexer : NULL;
+    }
+
+    for (int i = 0; i < job_count; i++) {
+        if (prog) {
+            arena_merge(&prog->arena, &jobs[i].arena);
+        } else {
+            arena_free(&jobs[i].arena);
+        }
+    }
+    s_free(jobs);
+    s_free(results);
+    s_free(starts);
+
+    return prog ? prog : parse(this);
+}
+
+/**
+ * Finds the first token of every top level declaration.
+ * A declaration starts with func or a type and ends at a ';' outside of braces
+ * (globals and => functions) or at the '}' that closes its body.
+ * @param out_starts Set to the start indices, with the index of the final tok_eof appended.
+ * @return How many declarations there are, or -1 if the tokens do not split cleanly.
+ */
+static int find_declarations(Lexer *lexer, int **out_starts) {
+    int eof = lexer->token_count - 1;
+    int capacity = 64;
+    int count = 0;
+    int *starts = (int *)s_malloc(capacity * sizeof(int));
+
+    int i = 0;
+    int clean = 1;
+    while (clean && i < eof) {
+        Token kind = (Token)lexer->kinds[i];
+        if (kind != tok_func && kind != tok_type) {
+            clean = 0;
+            break;
+        }
+
+        if (count + 1 >= capacity) {
+            capacity *= 2;
+            starts = (int *)s_realloc(starts, capacity * sizeof(int));
+        }
+        starts[count++] = i;
+
+        int depth = 0;
+        for (; i < eof; i++) {
+            kind = (Token)lexer->kinds[i];
+            if (kind == tok_lbrace) {
+                depth++;
+            } else if (kind == tok_rbrace) {
+                if (--depth <= 0) break;
+            } else if (kind == tok_semi && depth == 0) {
                 break;
+            }
         }
-        add_statement(prog, stmt);
+        // ran off the end, or closed a brace that was never opened
+        if (i == eof || depth < 0) clean = 0;
+        i++;
     }
 
-    return prog;
+    starts[count] = i;
+    *out_starts = starts;
+    return clean ? count : -1;
+}
+
+// Worker of parse_parallel, parses declarations first to last into results
+static void *parse_declarations(void *arg) {
+    ParseJob *job = (ParseJob *)arg;
+    Parser parser = parser_at(job->lexer, job->starts[job->first]);
+    parser.arena = &job->arena;
+    parser.lazy_bodies = job->lazy_bodies;
+
+    // a syntax error lands here, what was parsed is dropped with the job's arena
+    // (an expression stack that had moved to the heap is not freed, parse() exits on the same error anyway)
+    jmp_buf bail;
+    if (setjmp(bail)) {
+        job->failed = 1;
+        return NULL;
+    }
+    parser.bail = &bail;
+
+    for (int decl = job->first; decl < job->last; decl++) {
+        // the parser has to end up exactly where the pre-pass said the next declaration starts
+        if (parser.next_tok_index - 1 != job->starts[decl]) {
+            job->failed = 1;
+            return NULL;
+        }
+
+        if (parser.cur_tok == tok_func) {
+            job->results[decl] = parse_func_decl(&parser);
+        } else {
+            job->results[decl] = parse_global_var_decl(&parser);
+        }
+    }
+
+    job->failed = parser.next_tok_index - 1 != job->starts[job->last];
+    return NULL;
 }
 
 static void consume(Parser *this) {
-    if (this->next_tok_index + 1 > this->lexer->token_count) {
+    if (this->cur_tok == tok_eof) {
+        fail_quietly(this);
         fprintf(stderr, "Unexpected end of input\n");
         exit(1);
     }
     this->cur_tok = this->next_tok;
-    this->next_tok = this->lexer->tokens[++this->next_tok_index].type;
+
+    // the slot of the old current token is free now, refill it with the new lookahead
+    int index = ++this->next_tok_index;
+    this->window[index % PARSER_WINDOW] = pull_token(this, index);
+    this->next_tok = this->window[index % PARSER_WINDOW].type;
 }
 
 static Token peek(Parser *this) { return this->next_tok; }
 
-static TokenData curr_token_data(Parser *this) { return this->lexer->tokens[this->next_tok_index - 1]; }
+static TokenData curr_token_data(Parser *this) { return this->window[(this->next_tok_index - 1) % PARSER_WINDOW]; }
 
-static TokenData next_token_data(Parser *this) { return this->lexer->tokens[this->next_tok_index]; }
+static TokenData next_token_data(Parser *this) { return this->window[this->next_tok_index % PARSER_WINDOW]; }
 
 static void expect_next_and_consume_current(Parser *this, Token expected) {
     expect_next(this, expected);
     consume(this);
 }
 
+// parse_parallel's workers parse quietly: on a syntax error they give up without printing and parse() reports it
+// Returns only for a parser that prints its errors and exits
+static void fail_quietly(Parser *this) {
+    if (this->bail) longjmp(*this->bail, 1);
+}
+
 static void expect_next(Parser *this, Token expected) {
     if (peek(this) != expected) {
-        Location loc = next_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, next_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected %s, got %s\n", loc.line, loc.col, token_to_string(expected),
                 token_to_string(peek(this)));
         exit(1);
@@ -112,7 +369,8 @@ static void add_statement(Program *prog, Stmt *stmt) {
     if (prog->stmt_count >= prog->capacity) {
         // Double the capacity
         int new_capacity = prog->capacity * 2;
-        prog->statements = (Stmt **)s_realloc(prog->statements, new_capacity * sizeof(Stmt *));
+        prog->statements = (Stmt **)arena_grow(&prog->arena, prog->statements, prog->capacity * sizeof(Stmt *),
+                                               new_capacity * sizeof(Stmt *));
         prog->capacity = new_capacity;
     }
     
@@ -127,7 +385,7 @@ static Stmt *parse_expression_stmt(Parser *this) {
     expect_next_and_consume_current(this, tok_semi);
     consume(this);
 
-    return expression_stmt(expr);
+    return expression_stmt(this->arena, expr);
 }
 
 static Stmt* parse_if_stmt(Parser *this) {
@@ -141,11 +399,12 @@ static Stmt* parse_if_stmt(Parser *this) {
     int then_stmt_count = 0;
     Stmt** then_stmts = parse_block_statements(this, &then_stmt_count);
     
-    Stmt *then_block = block_stmt(then_stmts, then_stmt_count);
+    Stmt *then_block = block_stmt(this->arena, then_stmts, then_stmt_count);
     
     // is this needed? got from the parse func decl
     if (this->cur_tok != tok_rbrace) {
-        Location loc = curr_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, curr_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected closing '}' for if statement, got %s\n", loc.line, loc.col,
                 token_to_string(this->cur_tok));
         exit(1);
@@ -155,13 +414,13 @@ static Stmt* parse_if_stmt(Parser *this) {
 
     // early exit if we don't have an else branch
     if (this->cur_tok != tok_else) {
-        return if_stmt(condition, then_block, 0, NULL, NULL, NULL);
+        return if_stmt(this->arena, condition, then_block, 0, NULL, NULL, NULL);
     }
 
     // Store the else-if condition and branch
     int max_else_if = 8;
-    Expr** else_if_conditions = s_malloc(max_else_if * sizeof(Expr*));
-    Stmt** else_if_branches = s_malloc(max_else_if * sizeof(Stmt*));
+    Expr** else_if_conditions = arena_alloc(this->arena, max_else_if * sizeof(Expr*));
+    Stmt** else_if_branches = arena_alloc(this->arena, max_else_if * sizeof(Stmt*));
     int else_if_count = 0;
 
     // else if branches
@@ -174,10 +433,11 @@ static Stmt* parse_if_stmt(Parser *this) {
 
         int else_if_stmt_count = 0;
         Stmt** else_if_stmts = parse_block_statements(this, &else_if_stmt_count);
-        Stmt *else_if_block = block_stmt(else_if_stmts, else_if_stmt_count);
+        Stmt *else_if_block = block_stmt(this->arena, else_if_stmts, else_if_stmt_count);
 
         if (this->cur_tok != tok_rbrace) {
-            Location loc = curr_token_data(this).loc;
+            fail_quietly(this);
+            Location loc = token_location(this->lexer, curr_token_data(this));
             fprintf(stderr, "(%zu:%zu) Expected closing '}' for else-if statement, got %s\n", loc.line, loc.col,
                     token_to_string(this->cur_tok));
             exit(1);
@@ -187,9 +447,9 @@ static Stmt* parse_if_stmt(Parser *this) {
 
         // Resize arrays if needed
         if (else_if_count >= max_else_if) {
+            else_if_conditions = arena_grow(this->arena, else_if_conditions, max_else_if * sizeof(Expr*), max_else_if * 2 * sizeof(Expr*));
+            else_if_branches = arena_grow(this->arena, else_if_branches, max_else_if * sizeof(Stmt*), max_else_if * 2 * sizeof(Stmt*));
             max_else_if *= 2;
-            else_if_conditions = s_realloc(else_if_conditions, max_else_if * sizeof(Expr*));
-            else_if_branches = s_realloc(else_if_branches, max_else_if * sizeof(Stmt*));
         }
 
         else_if_conditions[else_if_count] = else_if_condition;
@@ -197,13 +457,8 @@ static Stmt* parse_if_stmt(Parser *this) {
         else_if_count++;
     }
 
-    if (else_if_count == 0) {
-        s_free(else_if_conditions);
-        s_free(else_if_branches);
-    }
-
     if (this->cur_tok != tok_else && else_if_count > 0) {
-        return if_stmt(condition, then_block, else_if_count, else_if_conditions, else_if_branches, NULL);
+        return if_stmt(this->arena, condition, then_block, else_if_count, else_if_conditions, else_if_branches, NULL);
 
         // it is impossible to get this case below because we checked above that an else branch exists at least
         // even though we are checking to see if the current token is else and the else if count is > 0
@@ -217,11 +472,12 @@ static Stmt* parse_if_stmt(Parser *this) {
 
     int else_stmt_count = 0;
     Stmt** else_stmts = parse_block_statements(this, &else_stmt_count);
-    Stmt *else_block = block_stmt(else_stmts, else_stmt_count);
+    Stmt *else_block = block_stmt(this->arena, else_stmts, else_stmt_count);
 
     // is this needed? got from the parse func decl
     if (this->cur_tok != tok_rbrace) {
-        Location loc = curr_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, curr_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected closing '}' for if-else statement, got %s\n", loc.line, loc.col,
                 token_to_string(this->cur_tok));
         exit(1);
@@ -230,9 +486,9 @@ static Stmt* parse_if_stmt(Parser *this) {
     consume(this); // consume current token, }
 
     if (else_if_count > 0) {
-        return if_stmt(condition, then_block, else_if_count, else_if_conditions, else_if_branches, else_block);
+        return if_stmt(this->arena, condition, then_block, else_if_count, else_if_conditions, else_if_branches, else_block);
     } else {
-        return if_stmt(condition, then_block, 0, NULL, NULL, else_block);
+        return if_stmt(this->arena, condition, then_block, 0, NULL, NULL, else_block);
     }
 }
 
@@ -246,18 +502,19 @@ static Stmt *parse_while_stmt(Parser *this) {
 
     int body_stmt_count = 0;
     Stmt** body_stmts = parse_block_statements(this, &body_stmt_count);
-    Stmt *body_block = block_stmt(body_stmts, body_stmt_count);
+    Stmt *body_block = block_stmt(this->arena, body_stmts, body_stmt_count);
 
     // is this needed? got from the parse func decl
     if (this->cur_tok != tok_rbrace) {
-        Location loc = curr_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, curr_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected closing '}' for while statement, got %s\n", loc.line, loc.col,
                 token_to_string(this->cur_tok));
         exit(1);
     }
     consume(this); // consume current token, }
 
-    return while_stmt(condition, body_block);
+    return while_stmt(this->arena, condition, body_block);
 }
 
 /**
@@ -268,8 +525,8 @@ static Stmt *parse_while_stmt(Parser *this) {
  */
 static void parse_function_parameters(Parser *this, TokenData** out_parameter_names, TokenData** out_parameter_types, int *out_param_count) {
     int capacity = 4; // initial capacity
-    *out_parameter_names = (TokenData *)s_malloc(capacity * sizeof(TokenData));
-    *out_parameter_types = (TokenData *)s_malloc(capacity * sizeof(TokenData));
+    *out_parameter_names = (TokenData *)arena_alloc(this->arena, capacity * sizeof(TokenData));
+    *out_parameter_types = (TokenData *)arena_alloc(this->arena, capacity * sizeof(TokenData));
     int param_count = 0;
 
     // parameters are formed as: name:type, name:type, ...
@@ -281,9 +538,11 @@ static void parse_function_parameters(Parser *this, TokenData** out_parameter_na
 
         // Add parameter to the array
         if (param_count >= capacity) {
+            *out_parameter_names = (TokenData *)arena_grow(this->arena, *out_parameter_names, capacity * sizeof(TokenData),
+                                                           capacity * 2 * sizeof(TokenData));
+            *out_parameter_types = (TokenData *)arena_grow(this->arena, *out_parameter_types, capacity * sizeof(TokenData),
+                                                           capacity * 2 * sizeof(TokenData));
             capacity *= 2;
-            *out_parameter_names = (TokenData *)s_realloc(*out_parameter_names, capacity * sizeof(TokenData));
-            *out_parameter_types = (TokenData *)s_realloc(*out_parameter_types, capacity * sizeof(TokenData));
         }
         (*out_parameter_names)[param_count] = param_name;
         (*out_parameter_types)[param_count] = param_type;
@@ -338,39 +597,114 @@ static Stmt *parse_func_decl(Parser *this) {
         consume(this); // consume ';' token
 
         // create function body with return statement
-        Stmt **statements = (Stmt **)s_malloc(sizeof(Stmt *));
-        statements[0] = return_stmt(return_expr);
+        Stmt **statements = (Stmt **)arena_alloc(this->arena, sizeof(Stmt *));
+        statements[0] = return_stmt(this->arena, return_expr);
         int stmt_count = 1;
-        Stmt *body = block_stmt(statements, stmt_count);
+        Stmt *body = block_stmt(this->arena, statements, stmt_count);
         
-        return func_decl_stmt(func_name, body, return_type, parameter_names, parameter_types, parameter_count);
+        return func_decl_stmt(this->arena, func_name, body, return_type, parameter_names, parameter_types, parameter_count);
     }
 
     expect_next_and_consume_current(this, tok_lbrace);
+
+    // lazy mode only finds the closing '}', the body is parsed by parse_func_body if it turns out to be needed
+    if ((this->lazy_bodies && this->lexer->kinds) || this->skip_bodies) {
+        int body_start = this->next_tok_index - 1;
+        skip_func_body(this);
+        Stmt *func = func_decl_stmt(this->arena, func_name, NULL, return_type, parameter_names, parameter_types, parameter_count);
+        func->func_decl.body_start = body_start;
+        return func;
+    }
+
+    Stmt *body = parse_func_block(this);
+
+    return func_decl_stmt(this->arena, func_name, body, return_type, parameter_names, parameter_types, parameter_count);
+}
+
+// Parses a function body from its '{' up to and past its '}'
+static Stmt *parse_func_block(Parser *this) {
     consume(this); // move past '{' token
 
     int stmt_count = 0;
     // this is the body of the function
     Stmt **statements = parse_block_statements(this, &stmt_count);
     // Create block statement for function body
-    Stmt *body = block_stmt(statements, stmt_count);
+    Stmt *body = block_stmt(this->arena, statements, stmt_count);
 
     if (this->cur_tok != tok_rbrace) {
-        Location loc = curr_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, curr_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected closing '}' for function body, got %s\n", loc.line, loc.col,
                 token_to_string(this->cur_tok));
         exit(1);
     }
 
     consume(this); // move past '}' token
+    return body;
+}
+
+// Moves from a function body's '{' to the token after its '}' by counting braces
+// in the token kinds, or in the tokens themselves when they are pulled from the lexer one by one
+static void skip_func_body(Parser *this) {
+    Lexer *lexer = this->lexer;
+    if (!lexer->kinds) {
+        int depth = 0;
+        while (this->cur_tok != tok_eof) {
+            if (this->cur_tok == tok_lbrace) {
+                depth++;
+            } else if (this->cur_tok == tok_rbrace && --depth == 0) {
+                consume(this); // move past '}' token
+                return;
+            }
+            consume(this);
+        }
+
+        fail_quietly(this);
+        Location loc = token_location(lexer, curr_token_data(this));
+        fprintf(stderr, "(%zu:%zu) Expected closing '}' for function body, got %s\n", loc.line, loc.col,
+                token_to_string(tok_eof));
+        exit(1);
+    }
+
+    int eof = lexer->token_count - 1;
+    int depth = 0;
+    int i = this->next_tok_index - 1;
+    for (; i < eof; i++) {
+        if (lexer->kinds[i] == tok_lbrace) {
+            depth++;
+        } else if (lexer->kinds[i] == tok_rbrace && --depth == 0) {
+            break;
+        }
+    }
+
+    if (i == eof) {
+        fail_quietly(this);
+        Location loc = token_location(lexer, token_at(lexer, eof));
+        fprintf(stderr, "(%zu:%zu) Expected closing '}' for function body, got %s\n", loc.line, loc.col,
+                token_to_string(tok_eof));
+        exit(1);
+    }
+
+    seek(this, i + 1);
+}
 
+/**
+ * Parses the body of a function that was skipped in lazy mode.
+ * The nodes go into the program's arena like everything else, so the body lives as long as the program.
+ * @param prog The program the function belongs to.
+ * @param func A STMT_FUNC_DECL of prog, its body is filled in.
+ */
+void parse_func_body(Program *prog, Stmt *func) {
+    if (func->func_decl.body || !prog->lazy_lexer) return;
 
-    return func_decl_stmt(func_name, body, return_type, parameter_names, parameter_types, parameter_count);
+    Parser parser = parser_at(prog->lazy_lexer, func->func_decl.body_start);
+    parser.arena = &prog->arena;
+    func->func_decl.body = parse_func_block(&parser);
 }
 
 static Stmt **parse_block_statements(Parser *this, int *out_stmt_count) {
     int capacity = 8; // initial capacity
-    Stmt **statements = (Stmt **)s_malloc(capacity * sizeof(Stmt *));
+    Stmt **statements = (Stmt **)arena_alloc(this->arena, capacity * sizeof(Stmt *));
     int stmt_count = 0;
 
     while (this->cur_tok != tok_rbrace && this->cur_tok != tok_eof) {
@@ -388,7 +722,7 @@ static Stmt **parse_block_statements(Parser *this, int *out_stmt_count) {
                 } else if (peek(this) == tok_increment || peek(this) == tok_decrement) {
                     // postfix operator
                     // x++ or x--
-                    stmt = expression_stmt(parse_increment_expr(this, false));
+                    stmt = expression_stmt(this->arena, parse_increment_expr(this, false));
                     expect_next_and_consume_current(this, tok_semi); // consume postfix operator
                     consume(this); // consume semicolon
 
@@ -406,7 +740,7 @@ static Stmt **parse_block_statements(Parser *this, int *out_stmt_count) {
             case tok_increment:
             case tok_decrement:
             // --x or ++x
-                stmt = expression_stmt(parse_increment_expr(this, true));
+                stmt = expression_stmt(this->arena, parse_increment_expr(this, true));
                 expect_next_and_consume_current(this, tok_semi); // consume identifier
                 consume(this); // consume semicolon
                 break;
@@ -417,8 +751,8 @@ static Stmt **parse_block_statements(Parser *this, int *out_stmt_count) {
 
         // Add statement to the array
         if (stmt_count >= capacity) {
+            statements = (Stmt **)arena_grow(this->arena, statements, capacity * sizeof(Stmt *), capacity * 2 * sizeof(Stmt *));
             capacity *= 2;
-            statements = (Stmt **)s_realloc(statements, capacity * sizeof(Stmt *));
         }
         statements[stmt_count++] = stmt;
     }
@@ -444,7 +778,7 @@ static Stmt *parse_var_decl(Parser *this) {
     // consume the semicolon
     consume(this);
 
-    return var_decl_stmt(type, identifier, value);
+    return var_decl_stmt(this->arena, type, identifier, value);
 }
 
 static Stmt *parse_global_var_decl(Parser *this) {
@@ -462,7 +796,8 @@ static Stmt *parse_var_assign(Parser *this) {
     // if it is not an assignment operator, throw an error
     if (this->cur_tok != tok_equal && this->cur_tok != tok_plus_equal && this->cur_tok != tok_minus_equal &&
         this->cur_tok != tok_star_equal && this->cur_tok != tok_slash_equal) {
-        Location loc = next_token_data(this).loc;
+        fail_quietly(this);
+        Location loc = token_location(this->lexer, next_token_data(this));
         fprintf(stderr, "(%zu:%zu) Expected assignment operator after identifier, got %s\n", loc.line, loc.col,
                 token_to_string(this->next_tok));
         exit(1);
@@ -476,7 +811,7 @@ static Stmt *parse_var_assign(Parser *this) {
     expect_next_and_consume_current(this, tok_semi);  // expect a semicolon after the expression
     consume(this); // consume the semicolon
 
-    return var_assign_stmt(identifier, modifying_tok, new_value);
+    return var_assign_stmt(this->arena, identifier, modifying_tok, new_value);
 }
 
 static Stmt *parse_return(Parser *this) {
@@ -489,148 +824,191 @@ static Stmt *parse_return(Parser *this) {
     expect_next_and_consume_current(this, tok_semi);  // expect a semicolon after the return value
     consume(this); // move past ';' token
 
-    return return_stmt(value);
-}
-
-static Expr **parse_function_arguments(Parser *this, int *out_arg_count) {
-    int capacity = 4; // initial capacity
-    Expr **args = (Expr **)s_malloc(capacity * sizeof(Expr *));
-    int arg_count = 0;
-
-    while (this->cur_tok != tok_rparen && this->cur_tok != tok_eof) {
-        Expr *arg = parse_expression(this, LOWEST);
-        
-        if (arg_count >= capacity) {
-            capacity *= 2;
-            args = (Expr **)s_realloc(args, capacity * sizeof(Expr *));
-        }
-        
-        // Add argument to the array
-        args[arg_count++] = arg;
-
-        if (peek(this) == tok_comma) {
-            consume(this); // consume current
-            consume(this); // consume comma and move to next argument
-        } else {
-            break; // no more arguments
-        }
-    }
-
-    *out_arg_count = arg_count;
-    return args;
-}
-
-static Expr *parse_function_call(Parser *this) {
-    TokenData func_name = curr_token_data(this);
-    expect_next_and_consume_current(this, tok_lparen);
-    
-    // Check for no arguments
-    if (peek(this) == tok_rparen) {
-        // no arguments
-        expect_next_and_consume_current(this, tok_rparen);
-        return func_call(func_name, NULL, 0);
-    } else {
-        consume(this); // move to first argument
-        int arg_count = 0;
-        Expr **args = parse_function_arguments(this, &arg_count);
-        expect_next_and_consume_current(this, tok_rparen);
-        return func_call(func_name, args, arg_count);
-    }
+    return return_stmt(this->arena, value);
 }
 
 static Expr *parse_increment_expr(Parser *this, int is_prefix) {
     TokenData op_token = is_prefix ? curr_token_data(this) : next_token_data(this);
     TokenData identifier = is_prefix ? next_token_data(this) : curr_token_data(this);
     consume(this); // consume current token so that we move past the operator/identifier and the next_tok is another expression
-    return increment_expr(op_token, identifier, is_prefix);
+    return increment_expr(this->arena, op_token, identifier, is_prefix);
 }
 
+/**
+ * Parses an expression with a Pratt parser that keeps its pending operators on an explicit stack.
+ * Every operand that is still waiting for an operator, an opening parenthesis or a call argument gets
+ * a frame instead of a C stack frame, so deeply nested or very long expressions only cost heap memory.
+ * A chain of operators of the same precedence never holds more than one frame at a time.
+ * @param precedence Only operators binding tighter than this are part of the expression.
+ * @return The expression, the current token is its last token.
+ */
 static Expr *parse_expression(Parser *this, Precedence precedence) {
-    Expr *left = parse_prefix(this);
-
-    while (peek(this) != tok_semi && precedence < get_precedence(this->next_tok)) {
-        left = parse_infix(this, left);
+    // most expressions fit in the local frames, the heap is only used past that
+    ExprFrame local_frames[EXPR_LOCAL_FRAMES];
+    ExprFrame *frames = local_frames;
+    int frame_count = 0;
+    int frame_capacity = EXPR_LOCAL_FRAMES;
+    Expr *left;
+
+operand:
+    // a frame was pushed for the operand starting at the current token, or this is the first one
+    if (frame_count == frame_capacity) {
+        frame_capacity *= 2;
+        if (frames == local_frames) {
+            frames = (ExprFrame *)s_malloc(frame_capacity * sizeof(ExprFrame));
+            memcpy(frames, local_frames, sizeof(local_frames));
+        } else {
+            frames = (ExprFrame *)s_realloc(frames, frame_capacity * sizeof(ExprFrame));
+        }
     }
 
-    return left;
-}
-
-static Expr *parse_prefix(Parser *this) {
     switch (this->cur_tok) {
         case tok_identifier:
-            return identifier_expr(curr_token_data(this));
+            left = identifier_expr(this->arena, curr_token_data(this));
+            break;
         case tok_number:
-            return int_literal(curr_token_data(this).val);
-        case tok_minus: {
-            TokenData op = curr_token_data(this);
-            consume(this);  // consume the '-' token
-            return unary_expr(op, parse_expression(this, PREFIX));
-        }
-        case tok_not: {
-            TokenData op = curr_token_data(this);
-            consume(this);  // consume the '!' token
-            return unary_expr(op, parse_expression(this, PREFIX));
-        }
+            left = int_literal(this->arena, curr_token_data(this));
+            break;
+        case tok_minus:
+        case tok_not:
+            frames[frame_count++] = (ExprFrame){.kind = FRAME_UNARY, .precedence = PREFIX, .token = curr_token_data(this)};
+            consume(this);  // consume the '-' or '!' token
+            goto operand;
         case tok_lparen:
+            frames[frame_count++] = (ExprFrame){.kind = FRAME_PAREN, .precedence = LOWEST};
             consume(this);
-            Expr *expr = parse_expression(this, LOWEST);
-            expect_next(this, tok_rparen);  // error out if we don't have a closing parenthesis
-            consume(this);                  // consume the closing parenthesis
-            return expr;
+            goto operand;
         case tok_increment:
         case tok_decrement:
-            return parse_increment_expr(this, true);
+            left = parse_increment_expr(this, true);
+            break;
         case tok_string:
-            return string_literal(curr_token_data(this).val);
+            left = string_literal(this->arena, curr_token_data(this));
+            break;
         default:
+            fail_quietly(this);
             fprintf(stderr, "Unknown prefix token: %s\n", token_to_string(this->cur_tok));
             exit(1);
     }
-}
 
-static Expr *parse_infix(Parser *this, Expr *left) {
-    // We need to make sure that the next token is an operator
-    // which is why we switch off of this->next_tok
-    switch (this->next_tok) {
-        case tok_plus:
-        case tok_minus:
-        case tok_star:
-        case tok_slash:
-        case tok_mod:
-        case tok_lessthan:
-        case tok_greaterthan:
-        case tok_lessthan_equal:
-        case tok_greaterthan_equal:
-        case tok_equality:
-        case tok_inequality: {
-            TokenData op_token = next_token_data(this);
-            // move past operator token completely
-            consume(this);
-            consume(this);
-            return parse_binary_expr(this, left, op_token);
-        }
-        // the left expression is just an identifier expr which 
-        // we don't need because we only need to get the function name
-        // and we can get that using the curr_token_data function
-        case tok_lparen:
-            return parse_function_call(this);
-        case tok_increment:
-        case tok_decrement:
-            if (this->cur_tok != tok_identifier) {
-                fprintf(stderr, "Expected identifier before increment/decrement operator\n");
-                exit(1);
+    for (;;) {
+        Precedence current = frame_count > 0 ? frames[frame_count - 1].precedence : precedence;
+
+        if (peek(this) != tok_semi && current < get_precedence(this->next_tok)) {
+            // We need to make sure that the next token is an operator
+            // which is why we switch off of this->next_tok
+            switch (this->next_tok) {
+                case tok_plus:
+                case tok_minus:
+                case tok_star:
+                case tok_slash:
+                case tok_mod:
+                case tok_lessthan:
+                case tok_greaterthan:
+                case tok_lessthan_equal:
+                case tok_greaterthan_equal:
+                case tok_equality:
+                case tok_inequality: {
+                    TokenData op_token = next_token_data(this);
+                    frames[frame_count++] = (ExprFrame){
+                        .kind = FRAME_BINARY,
+                        .precedence = get_precedence(op_token.type),
+                        .left = left,
+                        .token = op_token,
+                    };
+                    // move past operator token completely
+                    consume(this);
+                    consume(this);
+                    goto operand;
+                }
+                // the left expression is just an identifier expr which
+                // we don't need because we only need to get the function name
+                // and we can get that using the curr_token_data function
+                case tok_lparen: {
+                    TokenData func_name = curr_token_data(this);
+                    expect_next_and_consume_current(this, tok_lparen);
+
+                    // Check for no arguments
+                    if (peek(this) == tok_rparen) {
+                        expect_next_and_consume_current(this, tok_rparen);
+                        left = func_call(this->arena, func_name, NULL, 0);
+                        continue;
+                    }
+                    consume(this); // move to first argument
+                    if (this->cur_tok == tok_eof) {
+                        expect_next_and_consume_current(this, tok_rparen);
+                        left = func_call(this->arena, func_name, NULL, 0);
+                        continue;
+                    }
+
+                    int capacity = 4; // initial capacity
+                    frames[frame_count++] = (ExprFrame){
+                        .kind = FRAME_CALL,
+                        .precedence = LOWEST,
+                        .token = func_name,
+                        .args = (Expr **)arena_alloc(this->arena, capacity * sizeof(Expr *)),
+                        .arg_capacity = capacity,
+                    };
+                    goto operand;
+                }
+                case tok_increment:
+                case tok_decrement:
+                    if (this->cur_tok != tok_identifier) {
+                        fail_quietly(this);
+                        fprintf(stderr, "Expected identifier before increment/decrement operator\n");
+                        exit(1);
+                    }
+                    left = parse_increment_expr(this, 0);
+                    continue;
+                default:
+                    fail_quietly(this);
+                    fprintf(stderr, "Unexpected token in expression: %s\n", token_to_string(this->next_tok));
+                    exit(1);
             }
-            return parse_increment_expr(this, 0);
-        default:
-            return NULL; 
+        }
+
+        // left is a complete operand of the innermost frame
+        if (frame_count == 0) break;
+
+        ExprFrame *frame = &frames[frame_count - 1];
+        switch (frame->kind) {
+            case FRAME_BINARY:
+                left = binary_expr(this->arena, frame->left, frame->token, left);
+                frame_count--;
+                break;
+            case FRAME_UNARY:
+                left = unary_expr(this->arena, frame->token, left);
+                frame_count--;
+                break;
+            case FRAME_PAREN:
+                expect_next(this, tok_rparen);  // error out if we don't have a closing parenthesis
+                consume(this);                  // consume the closing parenthesis
+                frame_count--;
+                break;
+            case FRAME_CALL:
+                if (frame->arg_count >= frame->arg_capacity) {
+                    frame->args = (Expr **)arena_grow(this->arena, frame->args, frame->arg_capacity * sizeof(Expr *),
+                                                      frame->arg_capacity * 2 * sizeof(Expr *));
+                    frame->arg_capacity *= 2;
+                }
+                // Add argument to the array
+                frame->args[frame->arg_count++] = left;
+
+                if (peek(this) == tok_comma) {
+                    consume(this); // consume current
+                    consume(this); // consume comma and move to next argument
+                    if (this->cur_tok != tok_rparen && this->cur_tok != tok_eof) goto operand;
+                }
+
+                expect_next_and_consume_current(this, tok_rparen);
+                left = func_call(this->arena, frame->token, frame->args, frame->arg_count);
+                frame_count--;
+                break;
+        }
     }
-}
 
-static Expr *parse_binary_expr(Parser *this, Expr *left, TokenData op_token) {
-    Precedence curr_precedence = get_precedence(op_token.type);
-    
-    Expr *right = parse_expression(this, curr_precedence);
-    return binary_expr(left, op_token, right);
+    if (frames != local_frames) s_free(frames);
+    return left;
 }
 
 Precedence get_precedence(Token token) {
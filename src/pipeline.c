@@ -0,0 +1,110 @@
+#include "pipeline.h"
+
+#include <string.h>
+
+#include "memory.h"
+#include "parser.h"
+
+static Stmt *next_declaration(Parser *parser, Program *unit, int ast_opt, AstPassResult *totals);
+
+/**
+ * Compiles a source one top level declaration at a time.
+ * A first pass streams over the source with function bodies brace-matched and dropped, declaring every
+ * prototype and global so calls resolve no matter where the callee is defined. A second pass streams over it
+ * again, parsing one declaration, generating its code and freeing its AST before moving on to the next. The
+ * functions can then go through FUNCTION_PIPELINE together. Tokens are pulled from the lexer on demand in both passes, so the only front-end memory
+ * alive at any point is the AST of the declaration being compiled. The module still holds all of the generated IR.
+ * @param codegen A fresh code generator, the program is generated into its module.
+ * @param source The source, it has to stay loaded as long as the module refers to names from it.
+ * @param stats Filled in.
+ * @return The main function, or NULL if the program has none.
+ */
+LLVMValueRef compile_streaming(CodeGen *codegen, Source *source, StreamOptions *options, StreamStats *stats) {
+    memset(stats, 0, sizeof(StreamStats));
+    if (options->ast_results) {
+        for (int i = 0; i < ast_pass_count; i++) {
+            options->ast_results[i] = (AstPassResult){.name = ast_passes[i].name};
+        }
+    }
+
+    // the declaration being worked on, passed around as a program of one statement so the AST passes take it
+    Stmt *statement = NULL;
+    Program unit = {
+        .statements = &statement,
+        .capacity = 1,
+    };
+    arena_init(&unit.arena, 0);
+
+    // 1) Prototypes and globals, in source order
+    int function_capacity = 64;
+    LLVMValueRef *functions = (LLVMValueRef *)s_malloc(function_capacity * sizeof(LLVMValueRef));
+    Lexer lexer = {
+        .start_tok = source->text,
+        .cur_tok = source->text,
+    };
+    Parser parser = init_parser(&lexer);
+    parser.skip_bodies = 1;
+    Stmt *stmt;
+    while ((stmt = next_declaration(&parser, &unit, options->ast_opt, NULL))) {
+        LLVMValueRef func = codegen_declare(codegen, stmt);
+        if (func) {
+            if (stats->function_count == function_capacity) {
+                function_capacity *= 2;
+                functions = (LLVMValueRef *)s_realloc(functions, function_capacity * sizeof(LLVMValueRef));
+            }
+            functions[stats->function_count++] = func;
+        } else if (stmt->type == STMT_GLOBAL_VAR_DECL) {
+            stats->global_count++;
+        }
+        arena_free(&unit.arena);
+    }
+    free_lexer(&lexer);
+
+    // Add functions from standard library
+    setup_stdlib(codegen);
+
+    // 2) Function bodies, each declaration's AST is gone before the next one is parsed
+    // The functions come in the same order as in the first pass
+    lexer = (Lexer){
+        .start_tok = source->text,
+        .cur_tok = source->text,
+    };
+    parser = init_parser(&lexer);
+    int function_index = 0;
+    while ((stmt = next_declaration(&parser, &unit, options->ast_opt, options->ast_results))) {
+        if (stmt->type == STMT_FUNC_DECL) {
+            codegen_stmt(codegen, stmt);
+            function_index++;
+        }
+
+        if (unit.arena.used > stats->peak_ast_bytes) stats->peak_ast_bytes = unit.arena.used;
+        stats->total_ast_bytes += unit.arena.used;
+        arena_free(&unit.arena);
+    }
+    free_lexer(&lexer);
+    s_free(functions);
+
+    // the bodies are cleaned up as one batch, the function passes only ever look at one function at a time anyway
+    if (options->optimize_functions) run_function_passes(codegen->module, codegen->target_machine);
+
+    return LLVMGetNamedFunction(codegen->module, "main");
+}
+
+// Parses the next declaration into the unit's (empty) arena and runs the AST passes on it, NULL at the end
+// What the passes removed is added to totals if it is set
+static Stmt *next_declaration(Parser *parser, Program *unit, int ast_opt, AstPassResult *totals) {
+    parser->arena = &unit->arena;
+    Stmt *stmt = parse_declaration(parser);
+    if (!stmt) return NULL;
+
+    unit->statements[0] = stmt;
+    unit->stmt_count = 1;
+    if (ast_opt) {
+        AstPassResult results[ast_pass_count];
+        optimize_ast(unit, results);
+        for (int i = 0; totals && i < ast_pass_count; i++) {
+            totals[i].removed += results[i].removed;
+        }
+    }
+    return unit->statements[0];
+}
@@ -0,0 +1,242 @@
+#include "scanner.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Plain C kernels, used when no vector unit is available
+
+static const char *whitespace_scalar(const char *p) {
+    while (*p == ' ' || *p == '\n') p++;
+    return p;
+}
+
+static const char *line_end_scalar(const char *p) {
+    while (*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+static const char *string_end_scalar(const char *p) {
+    while (*p != '"' && *p != '\0') p++;
+    return p;
+}
+
+static int is_identifier_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static const char *identifier_end_scalar(const char *p) {
+    while (is_identifier_char(*p)) p++;
+    return p;
+}
+
+static const char *digits_end_scalar(const char *p) {
+    while (*p >= '0' && *p <= '9') p++;
+    return p;
+}
+
+static const Scanner scalar_scanner = {
+    .whitespace = whitespace_scalar,
+    .line_end = line_end_scalar,
+    .string_end = string_end_scalar,
+    .identifier_end = identifier_end_scalar,
+    .digits_end = digits_end_scalar,
+    .name = "scalar",
+};
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+/**
+ * Every vector kernel is built from a STOP function that turns one block into a bitmask
+ * of the bytes that end the run, SCAN_BLOCKS then returns the position of the first set bit.
+ * Loads are aligned to the block width so they can never cross into an unmapped page
+ * past the null terminator, the bytes before p in the first block are shifted out.
+ */
+#define SCAN_BLOCKS(vec, width, load, p, STOP)                                              \
+    do {                                                                                    \
+        const char *block = (const char *)((uintptr_t)(p) & ~(uintptr_t)((width) - 1));     \
+        uint32_t mask = STOP(load((const vec *)block)) >> ((p) - block);                    \
+        if (mask) return (p) + __builtin_ctz(mask);                                         \
+        for (;;) {                                                                          \
+            block += (width);                                                               \
+            mask = STOP(load((const vec *)block));                                          \
+            if (mask) return block + __builtin_ctz(mask);                                   \
+        }                                                                                   \
+    } while (0)
+
+// SSE2 is part of x86-64 so these need no runtime check
+
+#define SSE2_EQ(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8(c))
+#define SSE2_MASK(v) (uint32_t)_mm_movemask_epi8(v)
+// lo <= v <= hi, only valid for ASCII bounds since the compare is signed
+#define SSE2_IN_RANGE(v, lo, hi) \
+    _mm_and_si128(_mm_cmpgt_epi8((v), _mm_set1_epi8((lo) - 1)), _mm_cmpgt_epi8(_mm_set1_epi8((hi) + 1), (v)))
+
+static inline uint32_t whitespace_stop_sse2(__m128i v) { return ~SSE2_MASK(_mm_or_si128(SSE2_EQ(v, ' '), SSE2_EQ(v, '\n'))) & 0xFFFF; }
+
+static inline uint32_t line_end_stop_sse2(__m128i v) { return SSE2_MASK(_mm_or_si128(SSE2_EQ(v, '\n'), SSE2_EQ(v, '\0'))); }
+
+static inline uint32_t string_end_stop_sse2(__m128i v) { return SSE2_MASK(_mm_or_si128(SSE2_EQ(v, '"'), SSE2_EQ(v, '\0'))); }
+
+static inline uint32_t identifier_stop_sse2(__m128i v) {
+    // setting bit 5 folds 'A'-'Z' onto 'a'-'z' without letting anything else in
+    __m128i alpha = SSE2_IN_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i ident = _mm_or_si128(_mm_or_si128(alpha, SSE2_IN_RANGE(v, '0', '9')), SSE2_EQ(v, '_'));
+    return ~SSE2_MASK(ident) & 0xFFFF;
+}
+
+static inline uint32_t digits_stop_sse2(__m128i v) { return ~SSE2_MASK(SSE2_IN_RANGE(v, '0', '9')) & 0xFFFF; }
+
+static const char *whitespace_sse2(const char *p) { SCAN_BLOCKS(__m128i, 16, _mm_load_si128, p, whitespace_stop_sse2); }
+
+static const char *line_end_sse2(const char *p) { SCAN_BLOCKS(__m128i, 16, _mm_load_si128, p, line_end_stop_sse2); }
+
+static const char *string_end_sse2(const char *p) { SCAN_BLOCKS(__m128i, 16, _mm_load_si128, p, string_end_stop_sse2); }
+
+static const char *identifier_end_sse2(const char *p) { SCAN_BLOCKS(__m128i, 16, _mm_load_si128, p, identifier_stop_sse2); }
+
+static const char *digits_end_sse2(const char *p) { SCAN_BLOCKS(__m128i, 16, _mm_load_si128, p, digits_stop_sse2); }
+
+static const Scanner sse2_scanner = {
+    .whitespace = whitespace_sse2,
+    .line_end = line_end_sse2,
+    .string_end = string_end_sse2,
+    .identifier_end = identifier_end_sse2,
+    .digits_end = digits_end_sse2,
+    .name = "sse2",
+};
+
+// AVX2 kernels, only picked when the CPU reports AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX2_EQ(v, c) _mm256_cmpeq_epi8((v), _mm256_set1_epi8(c))
+#define AVX2_MASK(v) (uint32_t)_mm256_movemask_epi8(v)
+#define AVX2_IN_RANGE(v, lo, hi) \
+    _mm256_and_si256(_mm256_cmpgt_epi8((v), _mm256_set1_epi8((lo) - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), (v)))
+
+AVX2 static inline uint32_t whitespace_stop_avx2(__m256i v) { return ~AVX2_MASK(_mm256_or_si256(AVX2_EQ(v, ' '), AVX2_EQ(v, '\n'))); }
+
+AVX2 static inline uint32_t line_end_stop_avx2(__m256i v) { return AVX2_MASK(_mm256_or_si256(AVX2_EQ(v, '\n'), AVX2_EQ(v, '\0'))); }
+
+AVX2 static inline uint32_t string_end_stop_avx2(__m256i v) { return AVX2_MASK(_mm256_or_si256(AVX2_EQ(v, '"'), AVX2_EQ(v, '\0'))); }
+
+AVX2 static inline uint32_t identifier_stop_avx2(__m256i v) {
+    __m256i alpha = AVX2_IN_RANGE(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i ident = _mm256_or_si256(_mm256_or_si256(alpha, AVX2_IN_RANGE(v, '0', '9')), AVX2_EQ(v, '_'));
+    return ~AVX2_MASK(ident);
+}
+
+AVX2 static inline uint32_t digits_stop_avx2(__m256i v) { return ~AVX2_MASK(AVX2_IN_RANGE(v, '0', '9')); }
+
+AVX2 static const char *whitespace_avx2(const char *p) { SCAN_BLOCKS(__m256i, 32, _mm256_load_si256, p, whitespace_stop_avx2); }
+
+AVX2 static const char *line_end_avx2(const char *p) { SCAN_BLOCKS(__m256i, 32, _mm256_load_si256, p, line_end_stop_avx2); }
+
+AVX2 static const char *string_end_avx2(const char *p) { SCAN_BLOCKS(__m256i, 32, _mm256_load_si256, p, string_end_stop_avx2); }
+
+AVX2 static const char *identifier_end_avx2(const char *p) { SCAN_BLOCKS(__m256i, 32, _mm256_load_si256, p, identifier_stop_avx2); }
+
+AVX2 static const char *digits_end_avx2(const char *p) { SCAN_BLOCKS(__m256i, 32, _mm256_load_si256, p, digits_stop_avx2); }
+
+static const Scanner avx2_scanner = {
+    .whitespace = whitespace_avx2,
+    .line_end = line_end_avx2,
+    .string_end = string_end_avx2,
+    .identifier_end = identifier_end_avx2,
+    .digits_end = digits_end_avx2,
+    .name = "avx2",
+};
+
+static const Scanner *best_scanner(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return &avx2_scanner;
+    return &sse2_scanner;
+}
+
+#elif defined(__aarch64__)
+
+#include <arm_neon.h>
+
+// NEON is part of AArch64, so like SSE2 on x86-64 it needs no runtime check
+
+/**
+ * NEON has no movemask, narrowing every 16-bit lane by 4 instead packs a compare result into
+ * a 64-bit mask with 4 bits per byte. Blocks are loaded aligned like SCAN_BLOCKS does, and
+ * blocks with nothing to stop at are skipped with a horizontal max before the mask is built.
+ */
+#define SCAN_BLOCKS_NEON(p, STOP)                                                                 \
+    do {                                                                                          \
+        const char *block = (const char *)((uintptr_t)(p) & ~(uintptr_t)15);                      \
+        uint64_t mask = neon_mask(STOP(vld1q_u8((const uint8_t *)block))) >> (4 * ((p) - block)); \
+        if (mask) return (p) + (__builtin_ctzll(mask) >> 2);                                      \
+        for (;;) {                                                                                \
+            block += 16;                                                                          \
+            uint8x16_t stop = STOP(vld1q_u8((const uint8_t *)block));                             \
+            if (vmaxvq_u8(stop)) return block + (__builtin_ctzll(neon_mask(stop)) >> 2);          \
+        }                                                                                         \
+    } while (0)
+
+#define NEON_EQ(v, c) vceqq_u8((v), vdupq_n_u8(c))
+// lo <= v <= hi, the compare is unsigned so one subtraction covers both bounds
+#define NEON_IN_RANGE(v, lo, hi) vcleq_u8(vsubq_u8((v), vdupq_n_u8(lo)), vdupq_n_u8((hi) - (lo)))
+
+static inline uint64_t neon_mask(uint8x16_t v) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+}
+
+static inline uint8x16_t whitespace_stop_neon(uint8x16_t v) { return vmvnq_u8(vorrq_u8(NEON_EQ(v, ' '), NEON_EQ(v, '\n'))); }
+
+static inline uint8x16_t line_end_stop_neon(uint8x16_t v) { return vorrq_u8(NEON_EQ(v, '\n'), NEON_EQ(v, '\0')); }
+
+static inline uint8x16_t string_end_stop_neon(uint8x16_t v) { return vorrq_u8(NEON_EQ(v, '"'), NEON_EQ(v, '\0')); }
+
+static inline uint8x16_t identifier_stop_neon(uint8x16_t v) {
+    uint8x16_t alpha = NEON_IN_RANGE(vorrq_u8(v, vdupq_n_u8(0x20)), 'a', 'z');
+    uint8x16_t ident = vorrq_u8(vorrq_u8(alpha, NEON_IN_RANGE(v, '0', '9')), NEON_EQ(v, '_'));
+    return vmvnq_u8(ident);
+}
+
+static inline uint8x16_t digits_stop_neon(uint8x16_t v) { return vmvnq_u8(NEON_IN_RANGE(v, '0', '9')); }
+
+static const char *whitespace_neon(const char *p) { SCAN_BLOCKS_NEON(p, whitespace_stop_neon); }
+
+static const char *line_end_neon(const char *p) { SCAN_BLOCKS_NEON(p, line_end_stop_neon); }
+
+static const char *string_end_neon(const char *p) { SCAN_BLOCKS_NEON(p, string_end_stop_neon); }
+
+static const char *identifier_end_neon(const char *p) { SCAN_BLOCKS_NEON(p, identifier_stop_neon); }
+
+static const char *digits_end_neon(const char *p) { SCAN_BLOCKS_NEON(p, digits_stop_neon); }
+
+static const Scanner neon_scanner = {
+    .whitespace = whitespace_neon,
+    .line_end = line_end_neon,
+    .string_end = string_end_neon,
+    .identifier_end = identifier_end_neon,
+    .digits_end = digits_end_neon,
+    .name = "neon",
+};
+
+static const Scanner *best_scanner(void) {
+    return &neon_scanner;
+}
+
+#else
+
+static const Scanner *best_scanner(void) {
+    return &scalar_scanner;
+}
+
+#endif
+
+const Scanner *get_scanner(void) {
+    // PHI_SCANNER=scalar (or sse2) forces a slower scanner so the kernels can be checked against each other
+    const char *forced = getenv("PHI_SCANNER");
+    if (forced && !strcmp(forced, "scalar")) return &scalar_scanner;
+#if defined(__x86_64__)
+    if (forced && !strcmp(forced, "sse2")) return &sse2_scanner;
+#endif
+    return best_scanner();
+}
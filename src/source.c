@@ -0,0 +1,126 @@
+#include "source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static int map_file(int fd, size_t size, Source *source);
+static int read_all(int fd, Source *source);
+
+/**
+ * Loads a source file so it can be handed to the lexer.
+ * Regular files are mmap'ed read-only instead of copied, anything else (pipes, "-" for stdin)
+ * is read in chunks into a heap buffer.
+ * @param path The file to load, "-" reads stdin.
+ * @param source Filled in on success.
+ * @return 0 on success, 1 on failure (after printing why).
+ */
+int load_source(const char *path, Source *source) {
+    memset(source, 0, sizeof(Source));
+
+    if (!strcmp(path, "-")) {
+        return read_all(STDIN_FILENO, source);
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Error reading file");
+        close(fd);
+        return 1;
+    }
+
+    int result;
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        result = map_file(fd, (size_t)st.st_size, source);
+    } else {
+        // empty files and things like FIFOs have no size we can map
+        result = read_all(fd, source);
+    }
+
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    return result;
+}
+
+void free_source(Source *source) {
+    if (source->mapped_len) {
+        munmap((void *)source->text, source->mapped_len);
+    } else {
+        s_free((void *)source->text);
+    }
+    memset(source, 0, sizeof(Source));
+}
+
+/**
+ * Maps the file read-only with one zero page reserved behind it.
+ * The tail of the last file page is zero-filled by the kernel, but when the size is an
+ * exact multiple of the page size there is no tail, the extra anonymous page is the '\0' then.
+ */
+static int map_file(int fd, size_t size, Source *source) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t file_pages = (size + page_size - 1) / page_size * page_size;
+    size_t mapped_len = file_pages + page_size;
+
+    // reserve the whole range as zero pages first, then put the file over the front of it
+    char *base = mmap(NULL, mapped_len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return read_all(fd, source);
+    }
+
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, mapped_len);
+        return read_all(fd, source);
+    }
+
+    // the lexer walks the file front to back
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    source->text = base;
+    source->len = size;
+    source->mapped_len = mapped_len;
+    return 0;
+}
+
+// Reads until end of file, growing the buffer as needed
+static int read_all(int fd, Source *source) {
+    size_t capacity = READ_CHUNK_SIZE;
+    size_t len = 0;
+    char *buffer = (char *)s_malloc(capacity + 1);
+
+    for (;;) {
+        if (len == capacity) {
+            capacity *= 2;
+            buffer = (char *)s_realloc(buffer, capacity + 1);
+        }
+
+        ssize_t n = read(fd, buffer + len, capacity - len);
+        if (n == 0) break;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("Error reading file");
+            s_free(buffer);
+            return 1;
+        }
+        len += (size_t)n;
+    }
+
+    buffer[len] = '\0';  // Null-terminate the string
+    source->text = buffer;
+    source->len = len;
+    source->mapped_len = 0;
+    return 0;
+}
@@ -0,0 +1,396 @@
+#include "ssa.h"
+
+#include <string.h>
+
+#include "memory.h"
+
+#define SSA_MAP_INITIAL_CAPACITY 64
+// A map that grew past this for one big function is given back instead of cleared for the next one
+#define SSA_MAP_KEEP_CAPACITY (64 * 1024)
+
+static void map_init(SsaValueMap *map);
+static void map_free(SsaValueMap *map);
+static void map_clear(SsaValueMap *map);
+static LLVMValueRef map_get(SsaValueMap *map, uint64_t key);
+static void map_put(SsaValueMap *map, uint64_t key, LLVMValueRef value);
+static uint64_t def_key(int block, int variable);
+static uint64_t value_key(LLVMValueRef value);
+static uint32_t map_slot(SsaValueMap *map, uint64_t key);
+static LLVMValueRef resolve(SsaBuilder *ssa, LLVMValueRef value);
+static LLVMValueRef read_predecessors(SsaBuilder *ssa, int variable, int block);
+static int walk_up(SsaBuilder *ssa, int variable, int start, int *join, LLVMValueRef *value);
+static void finish_walk(SsaBuilder *ssa, int variable, int start, int end, LLVMValueRef value);
+static void push_pending(SsaBuilder *ssa, int start, int join, LLVMValueRef phi);
+static void add_incoming(SsaBuilder *ssa, LLVMValueRef phi, LLVMValueRef value, int pred);
+static LLVMValueRef new_phi(SsaBuilder *ssa, int variable, int block);
+static LLVMValueRef add_phi_operands(SsaBuilder *ssa, int variable, int block, LLVMValueRef phi);
+static LLVMValueRef remove_trivial_phi(SsaBuilder *ssa, LLVMValueRef phi);
+
+void ssa_init(SsaBuilder *ssa, LLVMContextRef context) {
+    memset(ssa, 0, sizeof(SsaBuilder));
+    ssa->context = context;
+    ssa->phi_builder = LLVMCreateBuilderInContext(context);
+    map_init(&ssa->defs);
+    map_init(&ssa->forwarded);
+}
+
+void ssa_free(SsaBuilder *ssa) {
+    // drops the per-block arrays
+    ssa_begin_function(ssa);
+
+    LLVMDisposeBuilder(ssa->phi_builder);
+    s_free(ssa->blocks);
+    s_free(ssa->variables);
+    s_free(ssa->removed);
+    s_free(ssa->pending);
+    map_free(&ssa->defs);
+    map_free(&ssa->forwarded);
+    memset(ssa, 0, sizeof(SsaBuilder));
+}
+
+void ssa_begin_function(SsaBuilder *ssa) {
+    for (int i = 0; i < ssa->block_count; i++) {
+        s_free(ssa->blocks[i].preds);
+        s_free(ssa->blocks[i].incomplete);
+    }
+    ssa->block_count = 0;
+    ssa->variable_count = 0;
+    ssa->removed_count = 0;
+    map_clear(&ssa->defs);
+    map_clear(&ssa->forwarded);
+}
+
+void ssa_end_function(SsaBuilder *ssa) {
+    // removed phis can only be used by other removed phis, so they are all cut loose before any is erased
+    for (int i = 0; i < ssa->removed_count; i++) {
+        LLVMReplaceAllUsesWith(ssa->removed[i], LLVMGetUndef(LLVMTypeOf(ssa->removed[i])));
+    }
+    for (int i = 0; i < ssa->removed_count; i++) {
+        LLVMInstructionEraseFromParent(ssa->removed[i]);
+    }
+    ssa->removed_count = 0;
+}
+
+int ssa_add_block(SsaBuilder *ssa, LLVMValueRef func, const char *name) {
+    if (ssa->block_count == ssa->block_capacity) {
+        ssa->block_capacity = ssa->block_capacity ? ssa->block_capacity * 2 : 16;
+        ssa->blocks = (SsaBlock *)s_realloc(ssa->blocks, ssa->block_capacity * sizeof(SsaBlock));
+    }
+
+    SsaBlock *block = &ssa->blocks[ssa->block_count];
+    memset(block, 0, sizeof(SsaBlock));
+    block->block = LLVMAppendBasicBlockInContext(ssa->context, func, name);
+    return ssa->block_count++;
+}
+
+LLVMBasicBlockRef ssa_block(SsaBuilder *ssa, int block) {
+    return ssa->blocks[block].block;
+}
+
+void ssa_add_predecessor(SsaBuilder *ssa, int block, int pred) {
+    SsaBlock *b = &ssa->blocks[block];
+    if (b->pred_count == b->pred_capacity) {
+        b->pred_capacity = b->pred_capacity ? b->pred_capacity * 2 : 2;
+        b->preds = (int *)s_realloc(b->preds, b->pred_capacity * sizeof(int));
+    }
+    b->preds[b->pred_count++] = pred;
+}
+
+void ssa_seal_block(SsaBuilder *ssa, int block) {
+    // the placeholder phis can get their operands now that every predecessor is known
+    for (int i = 0; i < ssa->blocks[block].incomplete_count; i++) {
+        SsaIncompletePhi incomplete = ssa->blocks[block].incomplete[i];
+        add_phi_operands(ssa, incomplete.variable, block, incomplete.phi);
+    }
+    ssa->blocks[block].incomplete_count = 0;
+    ssa->blocks[block].sealed = 1;
+}
+
+int ssa_add_variable(SsaBuilder *ssa, LLVMTypeRef type, const char *name, size_t len) {
+    if (ssa->variable_count == ssa->variable_capacity) {
+        ssa->variable_capacity = ssa->variable_capacity ? ssa->variable_capacity * 2 : 16;
+        ssa->variables = (SsaVariable *)s_realloc(ssa->variables, ssa->variable_capacity * sizeof(SsaVariable));
+    }
+    ssa->variables[ssa->variable_count] = (SsaVariable){
+        .type = type,
+        .name = name,
+        .len = len,
+    };
+    return ssa->variable_count++;
+}
+
+void ssa_write(SsaBuilder *ssa, int variable, int block, LLVMValueRef value) {
+    map_put(&ssa->defs, def_key(block, variable), value);
+}
+
+LLVMValueRef ssa_read(SsaBuilder *ssa, int variable, int block) {
+    LLVMValueRef value = map_get(&ssa->defs, def_key(block, variable));
+    if (value) return resolve(ssa, value);
+    return read_predecessors(ssa, variable, block);
+}
+
+/**
+ * Reads a variable the block has not written from its predecessors.
+ * Every join on the way gets a phi, whose operands are read from the join's predecessors in turn. The joins
+ * still waiting for operands are kept on a stack, so a read that goes back through many joins does not recurse.
+ */
+static LLVMValueRef read_predecessors(SsaBuilder *ssa, int variable, int block) {
+    int base = ssa->pending_count;
+    LLVMValueRef value;
+    int join;
+    if (walk_up(ssa, variable, block, &join, &value)) return value;
+    push_pending(ssa, block, join, value);
+
+    while (ssa->pending_count > base) {
+        SsaPendingPhi *top = &ssa->pending[ssa->pending_count - 1];
+        SsaBlock *b = &ssa->blocks[top->join];
+        if (top->next_pred < b->pred_count) {
+            int pred = b->preds[top->next_pred];
+            LLVMValueRef operand;
+            int pred_join;
+            if (!walk_up(ssa, variable, pred, &pred_join, &operand)) {
+                // another join, its phi has to be complete first
+                push_pending(ssa, pred, pred_join, operand);
+                continue;
+            }
+            add_incoming(ssa, top->phi, operand, pred);
+            top->next_pred++;
+            continue;
+        }
+
+        // every operand is in
+        SsaPendingPhi done = *top;
+        ssa->pending_count--;
+        value = remove_trivial_phi(ssa, done.phi);
+        finish_walk(ssa, variable, done.start, done.join, value);
+
+        // it is an operand of the join below it
+        if (ssa->pending_count > base) {
+            top = &ssa->pending[ssa->pending_count - 1];
+            add_incoming(ssa, top->phi, value, ssa->blocks[top->join].preds[top->next_pred]);
+            top->next_pred++;
+        }
+    }
+    return value;
+}
+
+/**
+ * Walks from start up through blocks with a single predecessor until one of them has a value for the variable.
+ * @param join Set to the join the walk ended at if it returns 0.
+ * @param value The variable's value, or a new phi at join if it returns 0.
+ * @return 1 if the value is known, it is recorded in every block walked through. 0 if the walk ended at a join,
+ * whose phi needs its operands before the blocks get their value.
+ */
+static int walk_up(SsaBuilder *ssa, int variable, int start, int *join, LLVMValueRef *value) {
+    int block = start;
+    LLVMValueRef found = map_get(&ssa->defs, def_key(block, variable));
+    while (!found && ssa->blocks[block].sealed && ssa->blocks[block].pred_count == 1) {
+        block = ssa->blocks[block].preds[0];
+        found = map_get(&ssa->defs, def_key(block, variable));
+    }
+
+    SsaBlock *b = &ssa->blocks[block];
+    if (found) {
+        found = resolve(ssa, found);
+    } else if (!b->sealed) {
+        // a loop header whose back edge is not generated yet, the phi gets its operands on sealing
+        found = new_phi(ssa, variable, block);
+        if (b->incomplete_count == b->incomplete_capacity) {
+            b->incomplete_capacity = b->incomplete_capacity ? b->incomplete_capacity * 2 : 4;
+            b->incomplete = (SsaIncompletePhi *)s_realloc(b->incomplete,
+                                                          b->incomplete_capacity * sizeof(SsaIncompletePhi));
+        }
+        b->incomplete[b->incomplete_count++] = (SsaIncompletePhi){variable, found};
+    } else if (b->pred_count == 0) {
+        // the entry block or an unreachable one, the variable has no value here
+        found = LLVMGetUndef(ssa->variables[variable].type);
+    } else {
+        // the phi is recorded first, so a loop that leads back here finds it and ends
+        found = new_phi(ssa, variable, block);
+        ssa_write(ssa, variable, block, found);
+        *join = block;
+        *value = found;
+        return 0;
+    }
+
+    finish_walk(ssa, variable, start, block, found);
+    *value = found;
+    return 1;
+}
+
+// Records the value in end and in every block on the single predecessor path from start to end
+static void finish_walk(SsaBuilder *ssa, int variable, int start, int end, LLVMValueRef value) {
+    ssa_write(ssa, variable, end, value);
+    for (int block = start; block != end; block = ssa->blocks[block].preds[0]) {
+        ssa_write(ssa, variable, block, value);
+    }
+}
+
+static void push_pending(SsaBuilder *ssa, int start, int join, LLVMValueRef phi) {
+    if (ssa->pending_count == ssa->pending_capacity) {
+        ssa->pending_capacity = ssa->pending_capacity ? ssa->pending_capacity * 2 : 16;
+        ssa->pending = (SsaPendingPhi *)s_realloc(ssa->pending, ssa->pending_capacity * sizeof(SsaPendingPhi));
+    }
+    ssa->pending[ssa->pending_count++] = (SsaPendingPhi){
+        .start = start,
+        .join = join,
+        .phi = phi,
+    };
+}
+
+static void add_incoming(SsaBuilder *ssa, LLVMValueRef phi, LLVMValueRef value, int pred) {
+    LLVMBasicBlockRef pred_block = ssa->blocks[pred].block;
+    LLVMAddIncoming(phi, &value, &pred_block, 1);
+}
+
+static LLVMValueRef new_phi(SsaBuilder *ssa, int variable, int block) {
+    // phis go before anything else in the block
+    LLVMBasicBlockRef bb = ssa->blocks[block].block;
+    LLVMPositionBuilder(ssa->phi_builder, bb, LLVMGetFirstInstruction(bb));
+
+    SsaVariable *var = &ssa->variables[variable];
+    LLVMValueRef phi = LLVMBuildPhi(ssa->phi_builder, var->type, "");
+    LLVMSetValueName2(phi, var->name, var->len);
+    return phi;
+}
+
+// Completes a phi of a block that just got sealed
+static LLVMValueRef add_phi_operands(SsaBuilder *ssa, int variable, int block, LLVMValueRef phi) {
+    for (int i = 0; i < ssa->blocks[block].pred_count; i++) {
+        int pred = ssa->blocks[block].preds[i];
+        add_incoming(ssa, phi, ssa_read(ssa, variable, pred), pred);
+    }
+    return remove_trivial_phi(ssa, phi);
+}
+
+/**
+ * Replaces a phi that only merges one value (apart from itself) with that value.
+ * The phi stays in its block without uses until the end of the function, so its address cannot be reused
+ * by a new value while definitions still point at it. Reads follow it to its replacement.
+ * @return What the phi stands for now, the phi itself if it is needed.
+ */
+static LLVMValueRef remove_trivial_phi(SsaBuilder *ssa, LLVMValueRef phi) {
+    LLVMValueRef same = NULL;
+    unsigned count = LLVMCountIncoming(phi);
+    for (unsigned i = 0; i < count; i++) {
+        LLVMValueRef op = LLVMGetIncomingValue(phi, i);
+        if (op == same || op == phi) continue;
+        if (same) return phi;
+        same = op;
+    }
+    // only reachable from itself or without any value
+    if (!same) same = LLVMGetUndef(LLVMTypeOf(phi));
+
+    // the phis using this one may only merge one value once it is replaced
+    int user_count = 0;
+    int user_capacity = 0;
+    LLVMValueRef *users = NULL;
+    for (LLVMUseRef use = LLVMGetFirstUse(phi); use; use = LLVMGetNextUse(use)) {
+        LLVMValueRef user = LLVMGetUser(use);
+        if (user == phi || !LLVMIsAPHINode(user) || map_get(&ssa->forwarded, value_key(user))) continue;
+        if (user_count == user_capacity) {
+            user_capacity = user_capacity ? user_capacity * 2 : 4;
+            users = (LLVMValueRef *)s_realloc(users, user_capacity * sizeof(LLVMValueRef));
+        }
+        users[user_count++] = user;
+    }
+
+    LLVMReplaceAllUsesWith(phi, same);
+    map_put(&ssa->forwarded, value_key(phi), same);
+    if (ssa->removed_count == ssa->removed_capacity) {
+        ssa->removed_capacity = ssa->removed_capacity ? ssa->removed_capacity * 2 : 16;
+        ssa->removed = (LLVMValueRef *)s_realloc(ssa->removed, ssa->removed_capacity * sizeof(LLVMValueRef));
+    }
+    ssa->removed[ssa->removed_count++] = phi;
+
+    for (int i = 0; i < user_count; i++) {
+        // a user can appear more than once, or go away while an earlier one is removed
+        if (!map_get(&ssa->forwarded, value_key(users[i]))) remove_trivial_phi(ssa, users[i]);
+    }
+    s_free(users);
+
+    // same may have been one of the users
+    return resolve(ssa, same);
+}
+
+// Follows removed phis to the value that replaced them
+static LLVMValueRef resolve(SsaBuilder *ssa, LLVMValueRef value) {
+    if (ssa->forwarded.count == 0) return value;
+    LLVMValueRef next;
+    while ((next = map_get(&ssa->forwarded, value_key(value)))) value = next;
+    return value;
+}
+
+static uint64_t def_key(int block, int variable) {
+    return ((uint64_t)(uint32_t)block << 32) | (uint32_t)variable;
+}
+
+static uint64_t value_key(LLVMValueRef value) {
+    return (uint64_t)(uintptr_t)value;
+}
+
+static void map_init(SsaValueMap *map) {
+    map->capacity = SSA_MAP_INITIAL_CAPACITY;
+    map->count = 0;
+    map->keys = (uint64_t *)s_malloc(map->capacity * sizeof(uint64_t));
+    map->values = (LLVMValueRef *)s_malloc(map->capacity * sizeof(LLVMValueRef));
+    memset(map->values, 0, map->capacity * sizeof(LLVMValueRef));
+}
+
+static void map_free(SsaValueMap *map) {
+    s_free(map->keys);
+    s_free(map->values);
+    memset(map, 0, sizeof(SsaValueMap));
+}
+
+static void map_clear(SsaValueMap *map) {
+    if (map->capacity > SSA_MAP_KEEP_CAPACITY) {
+        map_free(map);
+        map_init(map);
+        return;
+    }
+    if (map->count == 0) return;
+    memset(map->values, 0, map->capacity * sizeof(LLVMValueRef));
+    map->count = 0;
+}
+
+// Fibonacci hashing, the high bits of the product are the best mixed
+static uint32_t map_slot(SsaValueMap *map, uint64_t key) {
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & (map->capacity - 1);
+}
+
+static LLVMValueRef map_get(SsaValueMap *map, uint64_t key) {
+    uint32_t mask = map->capacity - 1;
+    for (uint32_t i = map_slot(map, key); map->values[i]; i = (i + 1) & mask) {
+        if (map->keys[i] == key) return map->values[i];
+    }
+    return NULL;
+}
+
+static void map_put(SsaValueMap *map, uint64_t key, LLVMValueRef value) {
+    // kept at most half full
+    if ((map->count + 1) * 2 > map->capacity) {
+        SsaValueMap old = *map;
+        map->capacity *= 2;
+        map->count = 0;
+        map->keys = (uint64_t *)s_malloc(map->capacity * sizeof(uint64_t));
+        map->values = (LLVMValueRef *)s_malloc(map->capacity * sizeof(LLVMValueRef));
+        memset(map->values, 0, map->capacity * sizeof(LLVMValueRef));
+        for (uint32_t i = 0; i < old.capacity; i++) {
+            if (old.values[i]) map_put(map, old.keys[i], old.values[i]);
+        }
+        map_free(&old);
+    }
+
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = map_slot(map, key);
+    for (; map->values[i]; i = (i + 1) & mask) {
+        if (map->keys[i] == key) {
+            map->values[i] = value;
+            return;
+        }
+    }
+    map->keys[i] = key;
+    map->values[i] = value;
+    map->count++;
+}
@@ -0,0 +1,143 @@
+#include "symbol_table.h"
+
+#include <string.h>
+
+#include "memory.h"
+
+#define SYMBOL_TABLE_INITIAL_CAPACITY 64
+
+static uint32_t hash_name(const char *name, size_t len, int callable);
+static uint32_t find_slot(SymbolTable *table, const char *name, size_t len, uint32_t hash, int callable);
+static void grow(SymbolTable *table);
+static void remove_slot(SymbolTable *table, uint32_t index);
+
+void symbol_table_init(SymbolTable *table) {
+    memset(table, 0, sizeof(SymbolTable));
+    table->capacity = SYMBOL_TABLE_INITIAL_CAPACITY;
+    table->slots = (Symbol *)s_malloc(table->capacity * sizeof(Symbol));
+    memset(table->slots, 0, table->capacity * sizeof(Symbol));
+}
+
+void symbol_table_free(SymbolTable *table) {
+    s_free(table->slots);
+    s_free(table->shadowed);
+    s_free(table->scopes);
+    memset(table, 0, sizeof(SymbolTable));
+}
+
+Symbol *symbol_lookup(SymbolTable *table, const char *name, size_t len, int callable) {
+    uint32_t index = find_slot(table, name, len, hash_name(name, len, callable), callable);
+    return table->slots[index].name ? &table->slots[index] : NULL;
+}
+
+Symbol *symbol_define(SymbolTable *table, Symbol symbol) {
+    // keep the table at most half full so probe sequences stay short
+    if ((table->count + 1) * 2 > table->capacity) grow(table);
+
+    int callable = SYMBOL_IS_CALLABLE(symbol.kind);
+    symbol.hash = hash_name(symbol.name, symbol.len, callable);
+    uint32_t index = find_slot(table, symbol.name, symbol.len, symbol.hash, callable);
+    Symbol *slot = &table->slots[index];
+
+    // remember what the local hides so popping its scope brings it back
+    if (symbol.kind == SYMBOL_LOCAL && table->scope_count > 0) {
+        if (table->shadowed_count == table->shadowed_capacity) {
+            table->shadowed_capacity = table->shadowed_capacity ? table->shadowed_capacity * 2 : 16;
+            table->shadowed = (ShadowedSymbol *)s_realloc(table->shadowed,
+                                                          table->shadowed_capacity * sizeof(ShadowedSymbol));
+        }
+        table->shadowed[table->shadowed_count++] = (ShadowedSymbol){
+            .previous = *slot,
+            .name = symbol.name,
+            .len = symbol.len,
+            .hash = symbol.hash,
+        };
+    }
+
+    if (!slot->name) table->count++;
+    *slot = symbol;
+    return slot;
+}
+
+void symbol_push_scope(SymbolTable *table) {
+    if (table->scope_count == table->scope_capacity) {
+        table->scope_capacity = table->scope_capacity ? table->scope_capacity * 2 : 16;
+        table->scopes = (int *)s_realloc(table->scopes, table->scope_capacity * sizeof(int));
+    }
+    table->scopes[table->scope_count++] = table->shadowed_count;
+}
+
+void symbol_pop_scope(SymbolTable *table) {
+    if (table->scope_count == 0) return;
+    int start = table->scopes[--table->scope_count];
+
+    // newest first, so a name declared twice in the scope ends up with what it had before the first declaration
+    while (table->shadowed_count > start) {
+        ShadowedSymbol *entry = &table->shadowed[--table->shadowed_count];
+        uint32_t index = find_slot(table, entry->name, entry->len, entry->hash, 0);
+        if (entry->previous.name) {
+            table->slots[index] = entry->previous;
+        } else {
+            remove_slot(table, index);
+        }
+    }
+}
+
+// FNV-1a, the namespace picks the offset basis so a function and a variable of the same name rarely collide
+static uint32_t hash_name(const char *name, size_t len, int callable) {
+    uint32_t hash = callable ? 0x050c5d1fu : 0x811c9dc5u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+// The slot holding the name, or the empty slot where it would go
+static uint32_t find_slot(SymbolTable *table, const char *name, size_t len, uint32_t hash, int callable) {
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+        Symbol *slot = &table->slots[index];
+        if (!slot->name) return index;
+        if (slot->hash == hash && slot->len == len && SYMBOL_IS_CALLABLE(slot->kind) == callable &&
+            !memcmp(slot->name, name, len)) {
+            return index;
+        }
+    }
+}
+
+static void grow(SymbolTable *table) {
+    Symbol *old_slots = table->slots;
+    uint32_t old_capacity = table->capacity;
+
+    table->capacity *= 2;
+    table->slots = (Symbol *)s_malloc(table->capacity * sizeof(Symbol));
+    memset(table->slots, 0, table->capacity * sizeof(Symbol));
+
+    // names are unique per namespace, so every symbol just goes into the first free slot of its probe sequence
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (!old_slots[i].name) continue;
+        uint32_t index = old_slots[i].hash & mask;
+        while (table->slots[index].name) index = (index + 1) & mask;
+        table->slots[index] = old_slots[i];
+    }
+    s_free(old_slots);
+}
+
+// Empties a slot without tombstones, later entries of the probe run move back into the gap
+// unless their home slot lies between the gap and where they are now
+static void remove_slot(SymbolTable *table, uint32_t index) {
+    uint32_t mask = table->capacity - 1;
+    uint32_t gap = index;
+    for (uint32_t next = (gap + 1) & mask; table->slots[next].name; next = (next + 1) & mask) {
+        uint32_t home = table->slots[next].hash & mask;
+        int stays = gap <= next ? (home > gap && home <= next) : (home > gap || home <= next);
+        if (stays) continue;
+
+        table->slots[gap] = table->slots[next];
+        gap = next;
+    }
+    table->slots[gap].name = NULL;
+    table->count--;
+}
@@ -0,0 +1,27 @@
+#include "workers.h"
+
+#include <pthread.h>
+
+#include "memory.h"
+
+void run_workers(void *jobs, size_t job_size, int count, void *(*work)(void *)) {
+    if (count <= 0) return;
+
+    char *job = (char *)jobs;
+    pthread_t *threads = (pthread_t *)s_malloc(count * sizeof(pthread_t));
+    int *started = (int *)s_calloc(count, sizeof(int));
+
+    for (int i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, work, job + i * job_size) == 0;
+        // out of threads, do it here instead
+        if (!started[i]) work(job + i * job_size);
+    }
+    work(job);
+
+    for (int i = 1; i < count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+
+    s_free(started);
+    s_free(threads);
+}
@@ -0,0 +1,82 @@
+#include "writer.h"
+
+#include <string.h>
+
+#include "memory.h"
+
+void writer_init_buffer(Writer *writer) {
+    memset(writer, 0, sizeof(Writer));
+}
+
+void writer_init_file(Writer *writer, FILE *file) {
+    memset(writer, 0, sizeof(Writer));
+    writer->file = file;
+}
+
+void write_bytes(Writer *writer, const char *bytes, size_t len) {
+    if (writer->file) {
+        fwrite(bytes, 1, len, writer->file);
+        return;
+    }
+
+    if (writer->len + len + 1 > writer->capacity) {
+        size_t capacity = writer->capacity ? writer->capacity : 256;
+        while (writer->len + len + 1 > capacity) capacity *= 2;
+        writer->data = (char *)s_realloc(writer->data, capacity);
+        writer->capacity = capacity;
+    }
+
+    memcpy(writer->data + writer->len, bytes, len);
+    writer->len += len;
+    writer->data[writer->len] = '\0';
+}
+
+void write_str(Writer *writer, const char *str) {
+    write_bytes(writer, str, strlen(str));
+}
+
+void write_char(Writer *writer, char c) {
+    write_bytes(writer, &c, 1);
+}
+
+void write_escaped(Writer *writer, const char *str, size_t len) {
+    // runs of plain characters go out in one piece
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)str[i];
+        char escape[5];
+        size_t escape_len = 2;
+        switch (c) {
+            case '\n': memcpy(escape, "\\n", 2); break;
+            case '\t': memcpy(escape, "\\t", 2); break;
+            case '\r': memcpy(escape, "\\r", 2); break;
+            case '\\': memcpy(escape, "\\\\", 2); break;
+            case '"': memcpy(escape, "\\\"", 2); break;
+            default:
+                if (c >= 32 && c != 127) continue;
+                snprintf(escape, sizeof(escape), "\\x%02x", c);
+                escape_len = 4;
+        }
+
+        write_bytes(writer, str + run, i - run);
+        write_bytes(writer, escape, escape_len);
+        run = i + 1;
+    }
+    write_bytes(writer, str + run, len - run);
+}
+
+char *writer_take(Writer *writer) {
+    char *data = writer->data;
+    // nothing written still gives a valid empty string
+    if (!data) {
+        data = (char *)s_malloc(1);
+        data[0] = '\0';
+    }
+    memset(writer, 0, sizeof(Writer));
+    return data;
+}
+
+void writer_free(Writer *writer) {
+    s_free(writer->data);
+    memset(writer, 0, sizeof(Writer));
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ast_opt.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source.h"
+
+// Prints the program after the AST passes, followed by what each pass removed
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <filename | ->\n", argv[0]);
+        return 1;
+    }
+
+    // Map the file (or read stdin for "-")
+    Source source;
+    if (load_source(argv[1], &source)) {
+        return 1;
+    }
+
+    Lexer lexer = {
+        .start_tok = source.text,
+        .cur_tok = source.text,
+    };
+
+    Parser parser = init_parser(&lexer);
+    Program *prog = parse(&parser);
+
+    AstPassResult results[ast_pass_count];
+    optimize_ast(prog, results);
+
+    Writer out;
+    writer_init_file(&out, stdout);
+    for (int i = 0; i < prog->stmt_count; i++) {
+        write_stmt(&out, prog->statements[i]);
+        write_char(&out, '\n');
+    }
+    for (int i = 0; i < ast_pass_count; i++) {
+        printf("%s: removed %zu nodes\n", results[i].name, results[i].removed);
+    }
+
+    free_program(prog);
+    // Release the source
+    free_source(&source);
+    free_lexer(&lexer);
+    return 0;
+}
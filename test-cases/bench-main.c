@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "codegen.h"
+#include "flat_ast.h"
+#include "lexer.h"
+#include "memory.h"
+#include "parser.h"
+#include "source.h"
+
+#define DEFAULT_ITERATIONS 10
+
+// Timings of one phase over every iteration
+typedef struct {
+    const char *name;
+    const char *unit; // what items counts
+    double *seconds;
+    size_t items;  // processed per iteration
+    size_t allocs; // s_malloc/s_calloc/s_realloc calls per iteration
+} Phase;
+
+static double now(void);
+static int compare_doubles(const void *a, const void *b);
+static void report(Phase *phase, int iterations);
+static size_t count_instructions(LLVMModuleRef module);
+
+// Runs each front-end phase on the same source several times in-process and reports how fast it went
+// Usage: bench <filename | -> [iterations]
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <filename | -> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    int iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations < 1) iterations = 1;
+
+    // The source is loaded once, every phase reads the same buffer
+    Source source;
+    if (load_source(argv[1], &source)) {
+        return 1;
+    }
+
+    Phase lex_phase = {.name = "lex", .unit = "tokens"};
+    Phase parse_phase = {.name = "parse", .unit = "nodes"};
+    Phase codegen_phase = {.name = "codegen", .unit = "instrs"};
+    Phase optimize_phase = {.name = "optimize", .unit = "instrs"};
+    Phase *phases[] = {&lex_phase, &parse_phase, &codegen_phase, &optimize_phase};
+    for (int i = 0; i < 4; i++) {
+        phases[i]->seconds = (double *)s_malloc(iterations * sizeof(double));
+    }
+
+    // lex: the whole token array from scratch each time
+    Lexer lexer;
+    for (int i = 0; i < iterations; i++) {
+        if (i > 0) free_lexer(&lexer);
+        lexer = (Lexer){
+            .start_tok = source.text,
+            .cur_tok = source.text,
+        };
+
+        size_t allocs = s_alloc_count();
+        double start = now();
+        if (lex(&lexer)) {
+            free_lexer(&lexer);
+            free_source(&source);
+            return 1;
+        }
+        lex_phase.seconds[i] = now() - start;
+        lex_phase.allocs = s_alloc_count() - allocs;
+    }
+    lex_phase.items = lexer.token_count;
+
+    // parse: reads the token array left by the last lex, so lexing is not counted again
+    Program *prog = NULL;
+    for (int i = 0; i < iterations; i++) {
+        if (prog) free_program(prog);
+
+        size_t allocs = s_alloc_count();
+        double start = now();
+        Parser parser = init_parser(&lexer);
+        prog = parse(&parser);
+        parse_phase.seconds[i] = now() - start;
+        parse_phase.allocs = s_alloc_count() - allocs;
+    }
+    parse_phase.items = program_node_count(prog);
+
+    // the same program in the flat encoding, to compare what each representation costs per node
+    FlatAst flat;
+    flatten_program(prog, source.text, &flat);
+    size_t tree_bytes = prog->arena.used + sizeof(Program);
+    size_t flat_bytes = flat_ast_bytes(&flat);
+    size_t flat_nodes = flat.node_count;
+    free_flat_ast(&flat);
+
+    // codegen and optimize both need a fresh module every iteration, setting one up is not timed
+    for (int i = 0; i < iterations; i++) {
+        CodeGen *codegen = init_codegen("phi_module", NULL);
+
+        size_t allocs = s_alloc_count();
+        double start = now();
+        LLVMValueRef main_func = codegen_program(codegen, prog);
+        codegen_phase.seconds[i] = now() - start;
+        codegen_phase.allocs = s_alloc_count() - allocs;
+
+        if (!main_func && i == 0) {
+            fprintf(stderr, "Warning: no main function was generated\n");
+        }
+        codegen_phase.items = optimize_phase.items = count_instructions(codegen->module);
+
+        allocs = s_alloc_count();
+        start = now();
+        optimize_module(codegen, &(OptOptions){.level = 2});
+        optimize_phase.seconds[i] = now() - start;
+        optimize_phase.allocs = s_alloc_count() - allocs;
+
+        cleanup_codegen(codegen);
+    }
+
+    printf("%s: %zu bytes, %d iterations\n", argv[1], source.len, iterations);
+    printf("%-10s %12s %12s %20s %12s\n", "phase", "min ms", "median ms", "throughput", "allocs");
+    for (int i = 0; i < 4; i++) {
+        report(phases[i], iterations);
+        s_free(phases[i]->seconds);
+    }
+
+    printf("\nAST memory for %zu nodes:\n", parse_phase.items);
+    printf("  pointer tree %12zu bytes %8.1f bytes/node\n", tree_bytes, (double)tree_bytes / parse_phase.items);
+    printf("  flat         %12zu bytes %8.1f bytes/node\n", flat_bytes, (double)flat_bytes / flat_nodes);
+
+    free_program(prog);
+    free_lexer(&lexer);
+    free_source(&source);
+    return 0;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Prints one row, throughput is taken from the median so a single slow run does not skew it
+static void report(Phase *phase, int iterations) {
+    qsort(phase->seconds, iterations, sizeof(double), compare_doubles);
+
+    double min = phase->seconds[0];
+    double median = iterations % 2 ? phase->seconds[iterations / 2]
+                                   : (phase->seconds[iterations / 2 - 1] + phase->seconds[iterations / 2]) / 2;
+
+    char throughput[64];
+    double rate = median > 0 ? phase->items / median : 0;
+    if (rate >= 1e6) {
+        snprintf(throughput, sizeof(throughput), "%.2fM %s/s", rate / 1e6, phase->unit);
+    } else if (rate >= 1e3) {
+        snprintf(throughput, sizeof(throughput), "%.2fK %s/s", rate / 1e3, phase->unit);
+    } else {
+        snprintf(throughput, sizeof(throughput), "%.2f %s/s", rate, phase->unit);
+    }
+
+    printf("%-10s %12.3f %12.3f %20s %12zu\n", phase->name, min * 1e3, median * 1e3, throughput, phase->allocs);
+}
+
+static size_t count_instructions(LLVMModuleRef module) {
+    size_t count = 0;
+    for (LLVMValueRef func = LLVMGetFirstFunction(module); func; func = LLVMGetNextFunction(func)) {
+        for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block; block = LLVMGetNextBasicBlock(block)) {
+            for (LLVMValueRef inst = LLVMGetFirstInstruction(block); inst; inst = LLVMGetNextInstruction(inst)) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <llvm-c/Analysis.h>
+
+#include "ast_opt.h"
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source.h"
+
+// Generates code the way --lazy does and prints the program afterwards, only the bodies main reaches are parsed
+// (and run through the AST passes) by then, followed by whether the module passed the verifier
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <filename | ->\n", argv[0]);
+        return 1;
+    }
+
+    // Map the file (or read stdin for "-")
+    Source source;
+    if (load_source(argv[1], &source)) {
+        return 1;
+    }
+
+    Lexer lexer = {
+        .start_tok = source.text,
+        .cur_tok = source.text,
+    };
+
+    // lazy bodies are parsed from the token arrays, so the whole source is lexed first
+    if (lex_parallel(&lexer, 1, LEX_PARALLEL_MIN_CHUNK)) {
+        free_source(&source);
+        free_lexer(&lexer);
+        return 1;
+    }
+
+    Parser parser = init_parser(&lexer);
+    parser.lazy_bodies = 1;
+    Program *prog = parse(&parser);
+    prog->lazy_ast_opt = 1;
+    optimize_ast(prog, NULL);
+
+    CodeGen *codegen = init_codegen("phi_module", NULL);
+    codegen_program(codegen, prog);
+
+    Writer out;
+    writer_init_file(&out, stdout);
+    for (int i = 0; i < prog->stmt_count; i++) {
+        write_stmt(&out, prog->statements[i]);
+        write_char(&out, '\n');
+    }
+
+    char *error = NULL;
+    if (LLVMVerifyModule(codegen->module, LLVMReturnStatusAction, &error) != 0) {
+        printf("Module verification failed: %s\n", error);
+    } else {
+        printf("Module verified\n");
+    }
+    LLVMDisposeMessage(error);
+
+    cleanup_codegen(codegen);
+    free_program(prog);
+    // Release the source
+    free_source(&source);
+    free_lexer(&lexer);
+    return 0;
+}
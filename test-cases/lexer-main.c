@@ -4,74 +4,91 @@
 
 #include "lexer.h"
 #include "memory.h"
+#include "source.h"
 
 // Helper: write a string with C-style escapes into a buffer (returns buffer pointer)
 static char* escape_c_string(const char* s);
+static int check_parallel(Lexer *serial, const char *text);
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
+        printf("Usage: %s <filename | ->\n", argv[0]);
         return 1;
     }
 
-    // Open the file
-    FILE *file = fopen(argv[1], "r");
-    if (!file) {
-        perror("Error opening file");
+    // Map the file (or read stdin for "-")
+    Source source;
+    if (load_source(argv[1], &source)) {
         return 1;
     }
 
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-
-    // Allocate buffer
-    char *buffer = (char *)s_malloc(file_size + 1);
-    if (!buffer) {
-        perror("Error allocating memory");
-        fclose(file);
-        return 1;
-    }
-
-    // read the file into the buffer
-    fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';  // Null-terminate the string
-    fclose(file);
-
     Lexer lexer = {
-        .start_tok = buffer,
-        .cur_tok = buffer,
-        .line_start = buffer,
+        .start_tok = source.text,
+        .cur_tok = source.text,
     };
 
     // Call the lex function (to be implemented)
     int result = lex(&lexer);
 
     if (result == 1) {
-        s_free(buffer);
+        free_source(&source);
+        free_lexer(&lexer);
+        return 1;
+    }
+
+    if (check_parallel(&lexer, source.text)) {
+        free_source(&source);
         free_lexer(&lexer);
         return 1;
     }
 
     for (int i = 0; i < lexer.token_count; i++) {
-        TokenData token = lexer.tokens[i];
+        TokenData token = token_at(&lexer, i);
 
-        if (token.type == tok_identifier || token.type == tok_string || token.type == tok_number || token.type == tok_type) {
-            char* escaped_val = escape_c_string(token.val);
+        if (token.type == tok_string) {
+            char* val = unescape_string(token.start, token.len);
+            char* escaped_val = escape_c_string(val);
             printf("%s(%s)\n", token_to_string(token.type), escaped_val);
             s_free(escaped_val);
+            s_free(val);
+        } else if (token.type == tok_identifier || token.type == tok_number || token.type == tok_type) {
+            printf("%s(%.*s)\n", token_to_string(token.type), TOK_FMT(token));
         } else {
             printf("%s\n", token_to_string(token.type));
         }
     }
 
-    // Free the buffer
-    s_free(buffer);
+    // Release the source
+    free_source(&source);
     free_lexer(&lexer);
     return 0;
 }
 
+// Lexes the file again split into small chunks on several threads, the tokens have to match lex() exactly
+static int check_parallel(Lexer *serial, const char *text) {
+    Lexer parallel = {
+        .start_tok = text,
+        .cur_tok = text,
+    };
+
+    int result = lex_parallel(&parallel, 4, 1);
+    if (!result && parallel.token_count != serial->token_count) {
+        printf("Parallel lexing produced %d tokens, expected %d\n", parallel.token_count, serial->token_count);
+        result = 1;
+    }
+
+    for (int i = 0; !result && i < serial->token_count; i++) {
+        if (parallel.kinds[i] != serial->kinds[i] || parallel.offsets[i] != serial->offsets[i]
+            || parallel.lengths[i] != serial->lengths[i]) {
+            printf("Parallel lexing differs at token %d\n", i);
+            result = 1;
+        }
+    }
+
+    free_lexer(&parallel);
+    return result;
+}
+
 // Helper: write a string with C-style escapes into a buffer (returns buffer pointer)
 static char* escape_c_string(const char* s) {
     // Allocate a buffer large enough for worst case (every char is escaped)
@@ -1,79 +1,147 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "flat_ast.h"
 #include "lexer.h"
 #include "memory.h"
 #include "parser.h"
+#include "source.h"
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("Usage: %s <filename>\n", argv[0]);
+        printf("Usage: %s <filename | ->\n", argv[0]);
         return 1;
     }
 
-    // Open the file
-    FILE *file = fopen(argv[1], "r");
-    if (!file) {
-        perror("Error opening file");
+    // Map the file (or read stdin for "-")
+    Source source;
+    if (load_source(argv[1], &source)) {
         return 1;
     }
 
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
-
-    // Allocate buffer
-    char *buffer = (char *)s_malloc(file_size + 1);
-    if (!buffer) {
-        perror("Error allocating memory");
-        fclose(file);
-        return 1;
-    }
-
-    // read the file into the buffer
-    fread(buffer, 1, file_size, file);
-    buffer[file_size] = '\0';  // Null-terminate the string
-    fclose(file);
-
     Lexer lexer = {
-        .start_tok = buffer,
-        .cur_tok = buffer,
-        .line_start = buffer,
+        .start_tok = source.text,
+        .cur_tok = source.text,
     };
 
-    // Call the lex function (to be implemented)
-    int result = lex(&lexer);
+    // Tokens are pulled from the lexer on demand while parsing
+    Parser parser = init_parser(&lexer);
 
-    if (result == 1) {
-        s_free(buffer);
-        free_lexer(&lexer);
-        return 1;
+    Program *prog = parse(&parser);
+
+    // Printed straight to stdout, no string is built per statement
+    Writer out;
+    writer_init_file(&out, stdout);
+    for (int i = 0; i < prog->stmt_count; i++) {
+        write_stmt(&out, prog->statements[i]);
+        write_char(&out, '\n');
     }
 
-    // for (int i = 0; i < lexer.token_count; i++) {
-    //     TokenData token = lexer.tokens[i];
+    // The flat encoding of the same program has to print exactly the same
+    FlatAst flat;
+    flatten_program(prog, source.text, &flat);
+    int result = 0;
+    for (int i = 0; i < prog->stmt_count; i++) {
+        char *expected = stmt_to_string(prog->statements[i]);
+        char *actual = flat_stmt_to_string(&flat, flat_block_child(&flat, flat.root, i));
+        if (strcmp(expected, actual) != 0) {
+            printf("Flat AST differs at statement %d:\n%s\n", i, actual);
+            result = 1;
+        }
+        s_free(expected);
+        s_free(actual);
+    }
 
-    //     if (token.type == tok_identifier || token.type == tok_string || token.type == tok_number || token.type ==
-    //     tok_type) {
-    //         printf("%s(%s)\n", token_to_string(token.type), token.val);
-    //     } else {
-    //         printf("%s\n", token_to_string(token.type));
-    //     }
-    // }
-    // printf("\n\n");
+    // and the tree built back from it, which is what a hit in the AST cache hands to codegen
+    Program *unflattened = unflatten_program(&flat);
+    for (int i = 0; i < prog->stmt_count; i++) {
+        char *expected = stmt_to_string(prog->statements[i]);
+        char *actual = stmt_to_string(unflattened->statements[i]);
+        if (strcmp(expected, actual) != 0) {
+            printf("Unflattened AST differs at statement %d:\n%s\n", i, actual);
+            result = 1;
+        }
+        s_free(expected);
+        s_free(actual);
+    }
+    free_program(unflattened);
+    free_flat_ast(&flat);
 
-    Parser parser = init_parser(&lexer);
+    // So does the program parsed in parallel from the token arrays
+    Lexer token_lexer = {
+        .start_tok = source.text,
+        .cur_tok = source.text,
+    };
+    if (lex(&token_lexer) == 0) {
+        Parser parallel_parser = init_parser(&token_lexer);
+        Program *parallel = parse_parallel(&parallel_parser, 4, 1);
+        for (int i = 0; i < prog->stmt_count || i < parallel->stmt_count; i++) {
+            char *expected = i < prog->stmt_count ? stmt_to_string(prog->statements[i]) : strdup("");
+            char *actual = i < parallel->stmt_count ? stmt_to_string(parallel->statements[i]) : strdup("");
+            if (strcmp(expected, actual) != 0) {
+                printf("Parallel parse differs at statement %d:\n%s\n", i, actual);
+                result = 1;
+            }
+            s_free(expected);
+            s_free(actual);
+        }
+        free_program(parallel);
 
-    Program *prog = parse(&parser);
+        // and the program parsed with lazy bodies, once every body has been filled in
+        Parser lazy_parser = init_parser(&token_lexer);
+        lazy_parser.lazy_bodies = 1;
+        Program *lazy = parse(&lazy_parser);
+        for (int i = 0; i < prog->stmt_count || i < lazy->stmt_count; i++) {
+            if (i < lazy->stmt_count && lazy->statements[i]->type == STMT_FUNC_DECL) {
+                parse_func_body(lazy, lazy->statements[i]);
+            }
+            char *expected = i < prog->stmt_count ? stmt_to_string(prog->statements[i]) : strdup("");
+            char *actual = i < lazy->stmt_count ? stmt_to_string(lazy->statements[i]) : strdup("");
+            if (strcmp(expected, actual) != 0) {
+                printf("Lazy parse differs at statement %d:\n%s\n", i, actual);
+                result = 1;
+            }
+            s_free(expected);
+            s_free(actual);
+        }
+        free_program(lazy);
+    }
+    free_lexer(&token_lexer);
 
+    // Declarations parsed one at a time from a streaming lexer with the bodies skipped, like the first pass of --stream,
+    // print the same up to where the body starts (a `=>` function keeps its body, so only the first line is compared)
+    Lexer stream_lexer = {
+        .start_tok = source.text,
+        .cur_tok = source.text,
+    };
+    Parser stream_parser = init_parser(&stream_lexer);
+    stream_parser.skip_bodies = 1;
     for (int i = 0; i < prog->stmt_count; i++) {
-        Stmt *stmt = prog->statements[i];
-        printf("%s\n", stmt_to_string(stmt));
+        Arena arena;
+        arena_init(&arena, 0);
+        stream_parser.arena = &arena;
+        Stmt *decl = parse_declaration(&stream_parser);
+
+        char *expected = stmt_to_string(prog->statements[i]);
+        char *actual = decl ? stmt_to_string(decl) : strdup("");
+        if (prog->statements[i]->type == STMT_FUNC_DECL) {
+            expected[strcspn(expected, "\n")] = '\0';
+            actual[strcspn(actual, "\n")] = '\0';
+        }
+        if (strcmp(expected, actual) != 0) {
+            printf("Streamed declaration differs at statement %d:\n%s\n", i, actual);
+            result = 1;
+        }
+        s_free(expected);
+        s_free(actual);
+        arena_free(&arena);
     }
+    free_lexer(&stream_lexer);
+    free_program(prog);
 
-    // Free the buffer
-    s_free(buffer);
+    // Release the source
+    free_source(&source);
     free_lexer(&lexer);
-    return 0;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lexer.h"
+#include "memory.h"
+#include "parser.h"
+
+#define DEFAULT_TERMS 1000000
+
+// Growable source text being generated
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} Text;
+
+// One generated expression and what it has to evaluate to
+typedef struct {
+    const char *name;
+    void (*generate)(Text *text, int terms);
+    long long (*expected)(int terms);
+} StressCase;
+
+static double now(void);
+static void append(Text *text, const char *str);
+static void append_repeated(Text *text, const char *str, int count);
+static void gen_chain(Text *text, int terms);
+static void gen_parens(Text *text, int terms);
+static void gen_unary(Text *text, int terms);
+static void gen_calls(Text *text, int terms);
+static void gen_arguments(Text *text, int terms);
+static long long chain_value(int terms);
+static long long seven(int terms);
+static long long unary_value(int terms);
+static long long terms_value(int terms);
+static long long evaluate(Expr *root);
+
+static const StressCase cases[] = {
+    {"chain", gen_chain, chain_value},
+    {"parens", gen_parens, seven},
+    {"unary", gen_unary, unary_value},
+    {"calls", gen_calls, seven},
+    {"arguments", gen_arguments, terms_value},
+};
+
+// Parses machine-generated expressions that are very long or very deeply nested and checks the trees
+// Usage: stress [terms]
+int main(int argc, char *argv[]) {
+    int terms = argc > 1 ? atoi(argv[1]) : DEFAULT_TERMS;
+    if (terms < 2) terms = 2;
+
+    int result = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Text text = {0};
+        append(&text, "func main() {\n    int x = ");
+        cases[i].generate(&text, terms);
+        append(&text, ";\n}\n");
+
+        Lexer lexer = {
+            .start_tok = text.data,
+            .cur_tok = text.data,
+        };
+        Parser parser = init_parser(&lexer);
+
+        double start = now();
+        Program *prog = parse(&parser);
+        double seconds = now() - start;
+
+        Stmt *decl = prog->statements[0]->func_decl.body->block_stmt.statements[0];
+        long long value = evaluate(decl->var_decl.value);
+        long long expected = cases[i].expected(terms);
+        printf("%-10s %8d terms %10zu bytes %8.1f ms  %s\n", cases[i].name, terms, text.len, seconds * 1e3,
+               value == expected ? "ok" : "WRONG");
+        if (value != expected) {
+            printf("  evaluated to %lld, expected %lld\n", value, expected);
+            result = 1;
+        }
+
+        free_program(prog);
+        free_lexer(&lexer);
+        s_free(text.data);
+    }
+    return result;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append(Text *text, const char *str) {
+    size_t len = strlen(str);
+    if (text->len + len + 1 > text->capacity) {
+        size_t capacity = text->capacity ? text->capacity : 4096;
+        while (text->len + len + 1 > capacity) capacity *= 2;
+        text->data = (char *)s_realloc(text->data, capacity);
+        text->capacity = capacity;
+    }
+    memcpy(text->data + text->len, str, len + 1);
+    text->len += len;
+}
+
+static void append_repeated(Text *text, const char *str, int count) {
+    for (int i = 0; i < count; i++) append(text, str);
+}
+
+// 1 + 2 * 3 - 5 + 2 * 3 - 5 ..., one long left-leaning chain with a product every third term
+static void gen_chain(Text *text, int terms) {
+    append(text, "1");
+    append_repeated(text, " + 2 * 3 - 5", (terms - 1) / 3);
+}
+
+// ((((7))))
+static void gen_parens(Text *text, int terms) {
+    append_repeated(text, "(", terms - 1);
+    append(text, "7");
+    append_repeated(text, ")", terms - 1);
+}
+
+// - - - - 7
+static void gen_unary(Text *text, int terms) {
+    append_repeated(text, "- ", terms - 1);
+    append(text, "7");
+}
+
+// f(f(f(f(7))))
+static void gen_calls(Text *text, int terms) {
+    append_repeated(text, "f(", terms - 1);
+    append(text, "7");
+    append_repeated(text, ")", terms - 1);
+}
+
+// f(1, 1, 1, 1)
+static void gen_arguments(Text *text, int terms) {
+    append(text, "f(1");
+    append_repeated(text, ", 1", terms - 1);
+    append(text, ")");
+}
+
+static long long chain_value(int terms) {
+    return 1 + (terms - 1) / 3;
+}
+
+static long long seven(int terms) {
+    (void)terms;
+    return 7;
+}
+
+static long long unary_value(int terms) {
+    return (terms - 1) % 2 ? -7 : 7;
+}
+
+static long long terms_value(int terms) {
+    return terms;
+}
+
+/**
+ * Evaluates an expression of integers, + - *, unary minus and calls, which give the sum of their arguments.
+ * The trees are far too deep to recurse over, so the nodes are first listed in post-order with an
+ * explicit stack and then folded with a stack of values.
+ */
+static long long evaluate(Expr *root) {
+    size_t capacity = 1024;
+    Expr **pending = (Expr **)s_malloc(capacity * sizeof(Expr *));
+    Expr **order = (Expr **)s_malloc(capacity * sizeof(Expr *));
+    size_t pending_count = 0;
+    size_t order_count = 0;
+
+    // root, right, left in reverse is left, right, root
+    pending[pending_count++] = root;
+    while (pending_count > 0) {
+        Expr *expr = pending[--pending_count];
+        int children = expr->type == EXPR_BINARY ? 2 : expr->type == EXPR_UNARY ? 1
+                       : expr->type == EXPR_FUNC_CALL ? expr->func_call.arg_count : 0;
+        while (pending_count + children > capacity || order_count + 1 > capacity) {
+            capacity *= 2;
+            pending = (Expr **)s_realloc(pending, capacity * sizeof(Expr *));
+            order = (Expr **)s_realloc(order, capacity * sizeof(Expr *));
+        }
+
+        order[order_count++] = expr;
+        if (expr->type == EXPR_BINARY) {
+            pending[pending_count++] = expr->binary.left;
+            pending[pending_count++] = expr->binary.right;
+        } else if (expr->type == EXPR_UNARY) {
+            pending[pending_count++] = expr->unary.right;
+        } else if (expr->type == EXPR_FUNC_CALL) {
+            for (int i = 0; i < expr->func_call.arg_count; i++) pending[pending_count++] = expr->func_call.args[i];
+        }
+    }
+
+    long long *values = (long long *)s_malloc(order_count * sizeof(long long));
+    size_t value_count = 0;
+    for (size_t i = order_count; i-- > 0;) {
+        Expr *expr = order[i];
+        switch (expr->type) {
+            case EXPR_LITERAL_INT:
+                values[value_count++] = expr->int_literal.tok.int_val;
+                break;
+            case EXPR_UNARY:
+                values[value_count - 1] = -values[value_count - 1];
+                break;
+            case EXPR_BINARY: {
+                long long right = values[--value_count];
+                long long left = values[value_count - 1];
+                char op = expr->binary.op_token.start[0];
+                values[value_count - 1] = op == '+' ? left + right : op == '-' ? left - right : left * right;
+                break;
+            }
+            case EXPR_FUNC_CALL: {
+                long long sum = 0;
+                for (int j = 0; j < expr->func_call.arg_count; j++) sum += values[--value_count];
+                values[value_count++] = sum;
+                break;
+            }
+            default:
+                fprintf(stderr, "Unexpected expression type %d\n", expr->type);
+                exit(1);
+        }
+    }
+
+    long long value = values[0];
+    s_free(values);
+    s_free(order);
+    s_free(pending);
+    return value;
+}